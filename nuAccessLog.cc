@@ -0,0 +1,221 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuAccessLog.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Records formatted for a single fwrite
+#define ACCESS_LOG_BATCH 64
+
+
+/* -------------------------------------------------------------------------- */
+
+// Appends a string as a JSON string (the name of a file comes from
+// the client: anything but printable ASCII is escaped)
+static void json_string(string& out, const char* s)
+{
+    char esc[8];
+
+    out += '"';
+
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += char(c);
+        }
+        else if (c < 0x20 || c >= 0x7F) {
+            snprintf(esc, sizeof(esc), "\\u%04x", unsigned(c));
+            out += esc;
+        }
+        else {
+            out += char(c);
+        }
+    }
+
+    out += '"';
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+access_log::access_log(const char* path) :
+    path_(path)
+{
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+access_log::~access_log()
+{
+    stop();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool access_log::start()
+{
+    file_ = fopen(path_.c_str(), "a");
+
+    if (!file_)
+        return false;
+
+    stop_ = false;
+
+    if (pthread_create(&writer_, NULL, writer_thread, this) != 0) {
+        fclose(file_);
+        file_ = 0;
+
+        return false;
+    }
+
+    running_ = true;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void access_log::stop()
+{
+    if (!running_)
+        return;
+
+    stop_ = true;
+    pthread_join(writer_, NULL);
+    running_ = false;
+
+    fclose(file_);
+    file_ = 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void access_log::log(access_record_t& record)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record.real_us = uint64_t(ts.tv_sec) * 1000000 + uint64_t(ts.tv_nsec) / 1000;
+
+    if (!ring_.push(record))
+        ++dropped_; // never wait for the writer
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void access_log::format(const access_record_t& r, string& line)
+{
+    char buf[256];
+    time_t secs = time_t(r.real_us / 1000000);
+    struct tm tm;
+
+    gmtime_r(&secs, &tm);
+    size_t len = strftime(buf, sizeof(buf), "{\"time\":\"%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + len, sizeof(buf) - len, ".%06uZ\",", unsigned(r.real_us % 1000000));
+    line += buf;
+
+    snprintf(buf, sizeof(buf),
+            "\"session\":%u,\"client\":\"%u.%u.%u.%u:%u\",\"op\":\"%s\",\"file\":",
+            r.session,
+            (r.addr >> 24) & 0xFF, (r.addr >> 16) & 0xFF,
+            (r.addr >> 8) & 0xFF, r.addr & 0xFF, unsigned(r.port),
+            r.opcode == 1 ? "RRQ" : "WRQ");
+    line += buf;
+
+    json_string(line, r.filename);
+
+    uint64_t rate = r.duration_us ? r.bytes * 1000000 / r.duration_us : 0;
+
+    snprintf(buf, sizeof(buf),
+            ",\"bytes\":%llu,\"duration_ms\":%.3f,\"bytes_per_s\":%llu,"
+            "\"retransmits\":%u,\"timeouts\":%u,\"result\":\"%s\",\"error\":%i}\n",
+            (unsigned long long)r.bytes,
+            r.duration_us / 1000.0,
+            (unsigned long long)rate,
+            r.retransmits,
+            r.timeouts,
+            r.error >= 0 ? "failed" : "ok",
+            r.error);
+    line += buf;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+size_t access_log::drain()
+{
+    access_record_t record;
+    string batch;
+    size_t total = 0;
+    size_t count;
+
+    do {
+        count = 0;
+        batch.clear();
+
+        while (count < ACCESS_LOG_BATCH && ring_.pop(&record)) {
+            format(record, batch);
+            ++count;
+        }
+
+        if (count)
+            fwrite(batch.data(), 1, batch.size(), file_);
+
+        total += count;
+    }
+    while (count == ACCESS_LOG_BATCH);
+
+    if (total)
+        fflush(file_);
+
+    return total;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void* access_log::writer_thread(void* arg)
+{
+    access_log* self = (access_log*)arg;
+
+    while (!self->stop_) {
+        if (!self->drain())
+            usleep(NU_ACCESS_LOG_PERIOD * 1000);
+    }
+
+    self->drain();
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
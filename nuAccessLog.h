@@ -0,0 +1,121 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_ACCESS_LOG_H__
+#define __NU_ACCESS_LOG_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuRing.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Bytes of the file name kept in a record (the name of a file requested
+//!fits in a datagram of 516 bytes)
+#define NU_ACCESS_LOG_FILENAME_SIZE 512
+
+//!Records waiting for the writer thread
+#define NU_ACCESS_LOG_RING_SIZE 2048
+
+//!Period of the writer thread, when there is nothing left to write
+#define NU_ACCESS_LOG_PERIOD 50 //!< ms
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    //! A transfer, as it ended
+    struct access_record_t {
+        uint64_t real_us;      //!< end (CLOCK_REALTIME, set by log())
+        uint64_t duration_us;
+        uint64_t bytes;        //!< of the file, transferred
+        uint32_t session;
+        uint32_t addr;         //!< of the client (host byte order)
+        uint16_t port;
+        uint16_t opcode;       //!< 1 = RRQ, 2 = WRQ
+        int error;             //!< TFTP error code, -1 = completed
+        uint32_t retransmits;
+        uint32_t timeouts;
+        char filename[NU_ACCESS_LOG_FILENAME_SIZE];
+    };
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * Access log: a JSON object per line for each transfer.
+     *
+     * Sessions queue their records in a lock-free ring (a record is
+     * dropped if the ring is full, a session never waits) and a
+     * background thread formats and appends them in batches.
+     * The file is opened in append mode, to be rotated by copy and
+     * truncate.
+     */
+    class access_log
+    {
+        public:
+            explicit access_log(const char* path);
+            ~access_log();
+
+            /**
+             * Opens the log and starts the writer thread
+             * @return bool: false if the log is not available
+             */
+            bool start();
+
+            /**
+             * Writes the records left and stops the writer thread
+             */
+            void stop();
+
+            /**
+             * Queues the record of a transfer (any thread, never blocks)
+             */
+            void log(access_record_t& record);
+
+            unsigned long dropped() const { return dropped_; }
+
+        private:
+            access_log(const access_log&) = delete;
+            access_log& operator=(const access_log&) = delete;
+
+            static void* writer_thread(void* arg);
+
+            size_t drain();
+            void format(const access_record_t& record, std::string& line);
+
+            std::string path_;
+
+            mpsc_ring<access_record_t> ring_ { NU_ACCESS_LOG_RING_SIZE };
+            std::atomic<unsigned long> dropped_ { 0 };
+
+            FILE* file_ = 0;
+            pthread_t writer_;
+            bool running_ = false;
+            std::atomic<bool> stop_ { false };
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_ACCESS_LOG_H__ */
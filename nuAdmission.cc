@@ -0,0 +1,197 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuAdmission.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Weight of the last session in the average duration (1/8)
+#define ADMISSION_AVG_SHIFT 3
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+admission_queue::admission_queue(
+        int slots,
+        int capacity,
+        size_t frame_size,
+        uint64_t budget_ms) :
+    slots_(slots > 0 ? slots : 1),
+    capacity_(capacity > 0 ? capacity : 0),
+    frame_size_(frame_size),
+    budget_ms_(budget_ms)
+{
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    entries_.resize(capacity_);
+    frames_.resize(capacity_ * frame_size_);
+    queued_.reserve(capacity_);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+admission_queue::~admission_queue()
+{
+    if (wakeup_fd_ >= 0)
+        close(wakeup_fd_);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool admission_queue::acquire()
+{
+    // Only the listener takes slots: no other thread may raise busy_
+    if (busy_.load() >= slots_)
+        return false;
+
+    ++busy_;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void admission_queue::release(uint64_t duration_ms)
+{
+    // Exponential moving average: a lost update just skips a sample
+    uint64_t avg = avg_ms_.load(memory_order_relaxed);
+
+    if (avg == 0)
+        avg = duration_ms;
+    else
+        avg += (int64_t(duration_ms) - int64_t(avg)) >> ADMISSION_AVG_SHIFT;
+
+    avg_ms_.store(avg, memory_order_relaxed);
+
+    --busy_;
+    notify();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void admission_queue::notify()
+{
+    uint64_t one = 1;
+    ssize_t ret = write(wakeup_fd_, &one, sizeof(one));
+    (void) ret; // if full, the listener is already awake
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void admission_queue::clear_wakeup()
+{
+    uint64_t count;
+    ssize_t ret = read(wakeup_fd_, &count, sizeof(count));
+    (void) ret;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+uint64_t admission_queue::estimated_wait_ms(int position) const
+{
+    // Each round of slots freed up starts slots_ queued requests
+    return uint64_t(position / slots_ + 1) * avg_ms_.load(memory_order_relaxed);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+admission_queue::result_t admission_queue::push(
+        uint32_t addr,
+        uint16_t port,
+        const char* frame,
+        int size,
+        uint64_t now_ms)
+{
+    uint64_t key = make_key(addr, port);
+
+    if (queued_.count(key))
+        return DUPLICATE;
+
+    if (count_ >= capacity_ ||
+            size_t(size) > frame_size_ ||
+            estimated_wait_ms(count_) > budget_ms_)
+    {
+        return REFUSED;
+    }
+
+    int tail = (head_ + count_) % capacity_;
+
+    entry_t& e = entries_[tail];
+    e.addr = addr;
+    e.port = port;
+    e.size = uint16_t(size);
+    e.enqueued_ms = now_ms;
+
+    memcpy(&frames_[tail * frame_size_], frame, size);
+
+    queued_.insert(key);
+    ++count_;
+
+    return QUEUED;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool admission_queue::front(request_t* request) const
+{
+    if (count_ == 0)
+        return false;
+
+    const entry_t& e = entries_[head_];
+
+    request->addr = e.addr;
+    request->port = e.port;
+    request->size = e.size;
+    request->enqueued_ms = e.enqueued_ms;
+    request->frame = &frames_[head_ * frame_size_];
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void admission_queue::pop()
+{
+    if (count_ == 0)
+        return;
+
+    const entry_t& e = entries_[head_];
+    queued_.erase(make_key(e.addr, e.port));
+
+    head_ = (head_ + 1) % capacity_;
+    --count_;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
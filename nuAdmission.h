@@ -0,0 +1,149 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_ADMISSION_H__
+#define __NU_ADMISSION_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <unordered_set>
+#include <vector>
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Admission control of the requests of a server.
+     *
+     * Up to a given count of sessions run at the same time. The requests
+     * coming when all the slots are taken wait in a bounded FIFO, and
+     * are started as the slots free up, instead of being dropped (which
+     * would leave the clients waiting for their retransmission timeout).
+     * Retransmissions of a request already queued are recognized by the
+     * client endpoint and discarded.
+     * The wait of a request is estimated from the average duration of
+     * the last sessions: requests which would wait beyond the latency
+     * budget are refused, so that the client may be told at once.
+     * Until a session has completed, only the actual wait is checked.
+     */
+    class admission_queue
+    {
+        public:
+            struct request_t {
+                uint32_t addr;
+                uint16_t port;
+                uint16_t size;
+                uint64_t enqueued_ms;
+                const char* frame; //!< valid until pop()
+            };
+
+            enum result_t {
+                QUEUED,
+                DUPLICATE, //!< already queued
+                REFUSED    //!< queue full or latency budget exceeded
+            };
+
+            /**
+             * @param slots: [in] sessions allowed to run at the same time
+             * @param capacity: [in] max count of requests waiting
+             * @param frame_size: [in] max size of a request
+             * @param budget_ms: [in] max time a request may wait
+             */
+            admission_queue(int slots, int capacity, size_t frame_size, uint64_t budget_ms);
+            ~admission_queue();
+
+            bool valid() const { return wakeup_fd_ >= 0; }
+
+            /**
+             * Takes a slot, if any is free (listener thread)
+             */
+            bool acquire();
+
+            /**
+             * Gives back the slot of a session, which lasted duration_ms,
+             * and wakes the listener up (any thread)
+             */
+            void release(uint64_t duration_ms);
+
+            /**
+             * Gives back a slot taken for a session not started
+             */
+            void cancel() { --busy_; }
+
+            //! Readable once a slot has been released
+            int wakeup_fd() const { return wakeup_fd_; }
+            void clear_wakeup();
+            void notify();
+
+            /**
+             * Queues a request waiting for a slot (listener thread)
+             */
+            result_t push(uint32_t addr, uint16_t port,
+                    const char* frame, int size, uint64_t now_ms);
+
+            bool front(request_t* request) const;
+            void pop();
+
+            bool empty() const { return count_ == 0; }
+            int size() const { return count_; }
+
+            uint64_t budget_ms() const { return budget_ms_; }
+            uint64_t average_session_ms() const { return avg_ms_; }
+
+            /**
+             * Estimated wait of a request queued behind position others
+             */
+            uint64_t estimated_wait_ms(int position) const;
+
+        private:
+            admission_queue(const admission_queue&) = delete;
+            admission_queue& operator=(const admission_queue&) = delete;
+
+            static uint64_t make_key(uint32_t addr, uint16_t port) {
+                return (uint64_t(addr) << 16) | port;
+            }
+
+            int slots_;
+            std::atomic<int> busy_ { 0 };
+            std::atomic<uint64_t> avg_ms_ { 0 }; //!< 0 = no session completed
+            int wakeup_fd_ = -1;
+
+            int capacity_;
+            size_t frame_size_;
+            uint64_t budget_ms_;
+
+            struct entry_t {
+                uint32_t addr;
+                uint16_t port;
+                uint16_t size;
+                uint64_t enqueued_ms;
+            };
+
+            std::vector<entry_t> entries_;
+            std::vector<char> frames_;
+            int head_ = 0;
+            int count_ = 0;
+            std::unordered_set<uint64_t> queued_;
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_ADMISSION_H__ */
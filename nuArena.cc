@@ -0,0 +1,150 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuArena.h"
+
+#include <sys/mman.h>
+#include <atomic>
+
+
+/* -------------------------------------------------------------------------- */
+
+#define ARENA_ALIGNMENT 64 // cache line
+
+#define ARENA_HUGEPAGE_SIZE (2 << 20)
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+buffer_arena::buffer_arena(size_t buffer_size, size_t count, bool hugepages)
+{
+    buffer_size_ = (buffer_size + ARENA_ALIGNMENT - 1) & ~size_t(ARENA_ALIGNMENT - 1);
+
+    if (buffer_size_ < sizeof(node_t))
+        buffer_size_ = ARENA_ALIGNMENT;
+
+    size_t bytes = buffer_size_ * count;
+    void* base = MAP_FAILED;
+
+    if (bytes == 0)
+        return;
+
+    if (hugepages) {
+        size_t huge_bytes = 
+            (bytes + ARENA_HUGEPAGE_SIZE - 1) & ~size_t(ARENA_HUGEPAGE_SIZE - 1);
+
+        base = mmap(0, huge_bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (base != MAP_FAILED) {
+            bytes = huge_bytes;
+            hugepages_ = true;
+        }
+    }
+
+    // No huge pages reserved: fall back to normal pages
+    if (base == MAP_FAILED) {
+        base = mmap(0, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (base == MAP_FAILED)
+            return;
+
+        if (hugepages)
+            madvise(base, bytes, MADV_HUGEPAGE);
+    }
+
+    base_ = (char*)base;
+    bytes_ = bytes;
+    count_ = count;
+
+    // Buffers are spread round robin over the shards
+    for (size_t i = count; i-- > 0;) {
+        node_t* node = (node_t*)(base_ + i * buffer_size_);
+        shard_t& shard = shards_[i % NU_ARENA_SHARDS];
+
+        node->next = shard.head;
+        shard.head = node;
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+buffer_arena::~buffer_arena()
+{
+    if (base_)
+        munmap(base_, bytes_);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int buffer_arena::shard_index()
+{
+    static std::atomic<unsigned> next_shard { 0 };
+    static thread_local int index = -1;
+
+    if (index < 0)
+        index = int(next_shard++ % NU_ARENA_SHARDS);
+
+    return index;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+char* buffer_arena::alloc()
+{
+    int first = shard_index();
+
+    for (int i = 0; i < NU_ARENA_SHARDS; ++i) {
+        shard_t& shard = shards_[(first + i) % NU_ARENA_SHARDS];
+        autoCs_t acs(shard.cs);
+
+        node_t* node = shard.head;
+
+        if (node) {
+            shard.head = node->next;
+            return (char*)node;
+        }
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void buffer_arena::free(char* buffer)
+{
+    if (!buffer)
+        return;
+
+    NU_ASSERT(buffer >= base_ && buffer < base_ + count_ * buffer_size_);
+
+    shard_t& shard = shards_[shard_index()];
+    autoCs_t acs(shard.cs);
+
+    node_t* node = (node_t*)buffer;
+    node->next = shard.head;
+    shard.head = node;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
@@ -0,0 +1,92 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_ARENA_H__
+#define __NU_ARENA_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuCriticalSection.h"
+
+#include <stddef.h>
+
+
+/* -------------------------------------------------------------------------- */
+
+#define NU_ARENA_SHARDS 8
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Preallocated arena of fixed-size packet buffers.
+     *
+     * The whole arena is mapped once (on huge pages, if requested and
+     * available), then split in buffers kept in per-shard free lists.
+     * A thread allocates from and frees to its own shard, and steals
+     * from the other shards only when its own is empty.
+     */
+    class buffer_arena
+    {
+        public:
+            /**
+             * @param buffer_size: [in] size of a buffer (rounded up to 64)
+             * @param count: [in] count of buffers
+             * @param hugepages: [in] try to map the arena on huge pages
+             */
+            buffer_arena(size_t buffer_size, size_t count, bool hugepages);
+            ~buffer_arena();
+
+            /**
+             * @return char*: a buffer, 0 if the arena is exhausted
+             */
+            char* alloc();
+            void free(char* buffer);
+
+            size_t buffer_size() const { return buffer_size_; }
+            size_t count() const { return count_; }
+            size_t bytes() const { return bytes_; }
+            bool hugepages() const { return hugepages_; }
+
+        private:
+            struct node_t {
+                node_t* next;
+            };
+
+            struct shard_t {
+                critical_section cs { "buffer_arena" };
+                node_t* head = nullptr;
+            };
+
+            buffer_arena(const buffer_arena&) = delete;
+            buffer_arena& operator=(const buffer_arena&) = delete;
+
+            static int shard_index();
+
+            char* base_ = nullptr;
+            size_t buffer_size_;
+            size_t count_ = 0;
+            size_t bytes_ = 0;
+            bool hugepages_ = false;
+
+            shard_t shards_[NU_ARENA_SHARDS];
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_ARENA_H__ */
@@ -0,0 +1,253 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuBlockPool.h"
+
+#include <unistd.h>
+#include <sched.h>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+enum {
+    BLOCK_LOADING, BLOCK_READY, BLOCK_FAILED
+};
+
+struct block_pool::block_t
+{
+    key_t key;
+    int refs;                // protected by the shard lock
+    std::atomic<int> state;
+    block_t* prev; // LRU links, valid only while refs == 0
+    block_t* next;
+    uint16_t size;
+    char data[TFTP_MAX_BUFFER_SIZE];
+};
+
+
+/* -------------------------------------------------------------------------- */
+
+size_t block_pool::key_hash_t::operator()(const key_t& k) const
+{
+    size_t h = size_t(k.meta.ino) * 0x9E3779B97F4A7C15ULL;
+    h ^= size_t(k.meta.dev) + (h << 6) + (h >> 2);
+    h ^= size_t(k.meta.mtime.tv_sec) + (h << 6) + (h >> 2);
+    h ^= size_t(k.meta.mtime.tv_nsec) + (h << 6) + (h >> 2);
+    h ^= size_t(k.block) * 0xC2B2AE3D27D4EB4FULL;
+
+    return h ^ (h >> 29);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+block_pool::block_pool(size_t capacity) :
+    shard_capacity_(capacity / NU_BLOCK_POOL_SHARDS + 1)
+{
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+block_pool::~block_pool()
+{
+    for (auto& s : shards_) {
+        for (auto& kv : s.map)
+            delete kv.second;
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+const char* block_pool::data(const block_t* b)
+{
+    return b->data;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+uint16_t block_pool::size(const block_t* b)
+{
+    return b->size;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void block_pool::lru_unlink(shard_t& s, block_t* b)
+{
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        s.lru_head = b->next;
+
+    if (b->next)
+        b->next->prev = b->prev;
+    else
+        s.lru_tail = b->prev;
+
+    b->prev = b->next = nullptr;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void block_pool::evict(shard_t& s)
+{
+    // Only unreferenced blocks are linked in the LRU list
+    while (s.count > shard_capacity_ && s.lru_tail) {
+        block_t* b = s.lru_tail;
+        lru_unlink(s, b);
+        s.map.erase(b->key);
+        --s.count;
+        delete b;
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+const block_pool::block_t* block_pool::acquire(
+        int fd,
+        const file_meta_t& meta,
+        uint32_t block)
+{
+    key_t key;
+    key.meta = meta;
+    key.block = block;
+
+    shard_t& s = shards_[key_hash_t()(key) % NU_BLOCK_POOL_SHARDS];
+    block_t* b = nullptr;
+    bool loader = false;
+
+    {
+        autoCs_t acs(s.cs);
+
+        auto it = s.map.find(key);
+
+        if (it != s.map.end()) {
+            b = it->second;
+
+            if (b->refs++ == 0)
+                lru_unlink(s, b);
+        }
+        else {
+            b = new block_t;
+            b->key = key;
+            b->refs = 1;
+            b->state = BLOCK_LOADING;
+            b->prev = b->next = nullptr;
+            b->size = 0;
+
+            s.map[key] = b;
+            ++s.count;
+            evict(s);
+
+            loader = true;
+        }
+    }
+
+    if (!loader) {
+        // Someone else may still be reading the payload
+        int state;
+
+        while ((state = b->state.load(std::memory_order_acquire)) == BLOCK_LOADING)
+            sched_yield();
+
+        if (state == BLOCK_READY)
+            return b;
+
+        release(b);
+        return 0;
+    }
+
+    // Load the payload out of the shard lock
+    off_t offset = off_t(block) * TFTP_MAX_BUFFER_SIZE;
+    off_t remaining = meta.size > offset ? meta.size - offset : 0;
+    size_t to_read = remaining < TFTP_MAX_BUFFER_SIZE ? size_t(remaining) : TFTP_MAX_BUFFER_SIZE;
+    size_t done = 0;
+
+    while (done < to_read) {
+        ssize_t n = pread(fd, b->data + done, to_read - done, offset + done);
+
+        if (n <= 0)
+            break;
+
+        done += size_t(n);
+    }
+
+    b->size = uint16_t(done);
+
+    if (done == to_read) {
+        b->state.store(BLOCK_READY, std::memory_order_release);
+        return b;
+    }
+
+    // Short read (file truncated meanwhile): never serve this payload
+    {
+        autoCs_t acs(s.cs);
+        s.map.erase(key);
+        --s.count;
+        b->state.store(BLOCK_FAILED, std::memory_order_release);
+
+        if (--b->refs == 0)
+            delete b;
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void block_pool::release(const block_t* cb)
+{
+    block_t* b = const_cast<block_t*>(cb);
+    shard_t& s = shards_[key_hash_t()(b->key) % NU_BLOCK_POOL_SHARDS];
+
+    autoCs_t acs(s.cs);
+
+    if (--b->refs > 0)
+        return;
+
+    if (b->state.load() == BLOCK_FAILED) {
+        // Already unlinked from the map by the loader
+        delete b;
+        return;
+    }
+
+    b->prev = nullptr;
+    b->next = s.lru_head;
+
+    if (s.lru_head)
+        s.lru_head->prev = b;
+    else
+        s.lru_tail = b;
+
+    s.lru_head = b;
+
+    evict(s);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
+
@@ -0,0 +1,112 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_BLOCK_POOL_H__
+#define __NU_BLOCK_POOL_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuTftpUtil.h"
+#include "nuFileCache.h"
+#include "nuCriticalSection.h"
+
+#include <atomic>
+#include <unordered_map>
+
+
+/* -------------------------------------------------------------------------- */
+
+#define NU_BLOCK_POOL_SHARDS 16
+
+//!Default count of payloads kept in memory (512 bytes each)
+#define NU_BLOCK_POOL_CAPACITY 16384
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Pool of read-only file blocks shared across sessions.
+     *
+     * A (file, block) payload is read once into a refcounted slab and
+     * handed out to every session sending it. Files are identified by
+     * device, inode, size, mtime and ctime (to the nanosecond), so a modified file never hits the
+     * payloads of its previous version.
+     * Unreferenced slabs stay cached and are evicted LRU first once the
+     * pool is over capacity.
+     */
+    class block_pool
+    {
+        public:
+            struct block_t;
+
+            explicit block_pool(size_t capacity = NU_BLOCK_POOL_CAPACITY);
+            ~block_pool();
+
+            /**
+             * Returns a referenced block of a file, reading it on miss
+             *
+             * @param fd: [in] descriptor of the file (read with pread)
+             * @param meta: [in] metadata of the file (identity of the file)
+             * @param block: [in] 0-based index of the block
+             * @return const block_t*: 0 if the block cannot be read
+             */
+            const block_t* acquire(int fd, const file_meta_t& meta, uint32_t block);
+
+            /**
+             * Drops a reference obtained by acquire()
+             */
+            void release(const block_t* b);
+
+            static const char* data(const block_t* b);
+            static uint16_t size(const block_t* b);
+
+        private:
+            struct key_t {
+                file_meta_t meta;
+                uint32_t block;
+
+                bool operator==(const key_t& k) const {
+                    return block == k.block && file_meta_equal(meta, k.meta);
+                }
+            };
+
+            struct key_hash_t {
+                size_t operator()(const key_t& k) const;
+            };
+
+            struct shard_t {
+                critical_section cs { "block_pool" };
+                std::unordered_map<key_t, block_t*, key_hash_t> map;
+                block_t* lru_head = nullptr; // most recently released
+                block_t* lru_tail = nullptr;
+                size_t count = 0;
+            };
+
+            block_pool(const block_pool&) = delete;
+            block_pool& operator=(const block_pool&) = delete;
+
+            static void lru_unlink(shard_t& s, block_t* b);
+            void evict(shard_t& s);
+
+            size_t shard_capacity_;
+            shard_t shards_[NU_BLOCK_POOL_SHARDS];
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_BLOCK_POOL_H__ */
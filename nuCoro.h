@@ -0,0 +1,530 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_CORO_H__
+#define __NU_CORO_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuTimerWheel.h"
+#include "nuFairQueue.h"
+
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <utility>
+#include <vector>
+#include <mutex>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Events handled by a single epoll_wait of an event loop
+#define NU_EVENT_LOOP_BATCH 64
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    template <typename T = void> class task;
+
+    namespace detail
+    {
+        /**
+         * Recycles the frames of the coroutines of a thread.
+         * A session awaits a coroutine for each packet, whose frame is
+         * always of the same size: it is taken back from a free list,
+         * rather than from the heap, once the first one was freed
+         */
+        class frame_allocator
+        {
+            public:
+                static void* allocate(size_t size) {
+                    size_t c = size_class(size);
+                    cache_t& cache = thread_cache();
+
+                    if (c < CLASSES) {
+                        node_t* node = cache.head[c];
+                        cache.allocated += c * GRANULE;
+
+                        if (node) {
+                            cache.head[c] = node->next;
+                            --cache.count[c];
+                            return node;
+                        }
+
+                        return ::operator new(c * GRANULE);
+                    }
+
+                    cache.allocated += size;
+
+                    return ::operator new(size);
+                }
+
+                /**
+                 * @return size_t: bytes of the frames allocated by the
+                 *         thread so far (as held, rounded to a class)
+                 */
+                static size_t allocated() {
+                    return thread_cache().allocated;
+                }
+
+                static void deallocate(void* p, size_t size) noexcept {
+                    size_t c = size_class(size);
+
+                    if (c < CLASSES) {
+                        cache_t& cache = thread_cache();
+
+                        if (cache.count[c] < DEPTH) {
+                            node_t* node = (node_t*)p;
+                            node->next = cache.head[c];
+                            cache.head[c] = node;
+                            ++cache.count[c];
+                            return;
+                        }
+                    }
+
+                    ::operator delete(p);
+                }
+
+            private:
+                static constexpr size_t GRANULE = 64;
+                static constexpr size_t CLASSES = 32; // frames up to 2 KB
+                static constexpr unsigned DEPTH = 64; // frames kept by class
+
+                struct node_t {
+                    node_t* next;
+                };
+
+                struct cache_t {
+                    node_t* head[CLASSES] = {};
+                    unsigned count[CLASSES] = {};
+                    size_t allocated = 0;
+
+                    ~cache_t() {
+                        for (size_t c = 0; c < CLASSES; ++c) {
+                            while (node_t* node = head[c]) {
+                                head[c] = node->next;
+                                ::operator delete(node);
+                            }
+                        }
+                    }
+                };
+
+                static size_t size_class(size_t size) {
+                    return (size + GRANULE - 1) / GRANULE;
+                }
+
+                // A frame freed by another thread just joins its cache
+                static cache_t& thread_cache() {
+                    thread_local cache_t cache;
+                    return cache;
+                }
+        };
+
+        struct promise_base
+        {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            static void* operator new(size_t size) {
+                return frame_allocator::allocate(size);
+            }
+
+            static void operator delete(void* p, size_t size) noexcept {
+                frame_allocator::deallocate(p, size);
+            }
+
+            // Lazy: the body runs once the task is awaited
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            // Symmetric transfer back to the awaiting coroutine
+            struct final_awaiter {
+                bool await_ready() noexcept { return false; }
+
+                template <typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                    std::coroutine_handle<> c = h.promise().continuation;
+                    return c ? c : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            final_awaiter final_suspend() noexcept { return {}; }
+            void unhandled_exception() { error = std::current_exception(); }
+        };
+
+        template <typename T>
+        struct promise : promise_base
+        {
+            T value {};
+
+            task<T> get_return_object() noexcept;
+            void return_value(T v) { value = std::move(v); }
+
+            T result() {
+                if (error)
+                    std::rethrow_exception(error);
+
+                return std::move(value);
+            }
+        };
+
+        template <>
+        struct promise<void> : promise_base
+        {
+            task<void> get_return_object() noexcept;
+            void return_void() {}
+
+            void result() {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+        };
+
+        // Fire and forget coroutine, its frame is freed on completion
+        struct detached
+        {
+            struct promise_type {
+                detached get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() { std::terminate(); }
+            };
+        };
+    }
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * Coroutine producing a T, started when it is co_awaited.
+     * Exceptions escaping the body are rethrown to the awaiting coroutine.
+     * Its frame comes from the frame_allocator of the thread
+     *
+     * NOTE: g++ 12 miscompiles a co_await used as the condition of an if
+     * (the awaited coroutine never runs): store its result first
+     */
+    template <typename T>
+    class task
+    {
+        public:
+            using promise_type = detail::promise<T>;
+            using handle_t = std::coroutine_handle<promise_type>;
+
+            explicit task(handle_t h) noexcept : h_(h) {}
+            task(task&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+
+            ~task() {
+                if (h_)
+                    h_.destroy();
+            }
+
+            bool await_ready() const noexcept { return !h_ || h_.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                h_.promise().continuation = awaiting;
+                return h_;
+            }
+
+            T await_resume() { return h_.promise().result(); }
+
+        private:
+            task(const task&) = delete;
+            task& operator=(const task&) = delete;
+            task& operator=(task&&) = delete;
+
+            handle_t h_;
+    };
+
+    namespace detail
+    {
+        template <typename T>
+        inline task<T> promise<T>::get_return_object() noexcept {
+            return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+        }
+
+        inline task<void> promise<void>::get_return_object() noexcept {
+            return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+        }
+    }
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * Single threaded scheduler of coroutines.
+     *
+     * Coroutines suspend on the readiness of a descriptor (epoll) or on
+     * a timeout (timer wheel), and are resumed by run_once() on the
+     * thread owning the loop. Other threads may only post() a coroutine
+     * to resume or notify() the loop.
+     * If a fair_queue is attached, a batch of the sends it holds is
+     * run at each iteration.
+     */
+    class event_loop
+    {
+        public:
+            // State of a coroutine waiting for a descriptor
+            struct io_waiter {
+                std::coroutine_handle<> handle;
+                wheel_timer timer;
+                int fd = -1;
+                bool ready = false;
+            };
+
+            // co_await loop.readable(fd, ms): true if fd can be read,
+            // false on timeout
+            struct readable_awaiter {
+                event_loop* loop;
+                int fd;
+                uint64_t timeout_ms;
+                io_waiter waiter;
+
+                bool await_ready() const noexcept { return false; }
+
+                bool await_suspend(std::coroutine_handle<> h) {
+                    waiter.handle = h;
+                    return loop->watch(&waiter, fd, timeout_ms);
+                }
+
+                bool await_resume() const noexcept { return waiter.ready; }
+            };
+
+            // co_await loop.sleep(ms): resumed once the timeout expired
+            struct sleep_awaiter {
+                event_loop* loop;
+                uint64_t timeout_ms;
+                io_waiter waiter;
+
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<> h) {
+                    waiter.handle = h;
+                    loop->arm(&waiter, timeout_ms);
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            event_loop() : wheel_(nu_coarse_ms()) {
+                epfd_ = epoll_create1(EPOLL_CLOEXEC);
+                wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+                if (epfd_ >= 0 && wakeup_fd_ >= 0) {
+                    struct epoll_event ev;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = nullptr; // the wakeup descriptor
+                    epoll_ctl(epfd_, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+                }
+            }
+
+            ~event_loop() {
+                if (wakeup_fd_ >= 0)
+                    close(wakeup_fd_);
+
+                if (epfd_ >= 0)
+                    close(epfd_);
+            }
+
+            bool valid() const { return epfd_ >= 0 && wakeup_fd_ >= 0; }
+
+            //! Count of the spawned tasks not completed yet
+            int tasks() const { return tasks_; }
+
+            void attach(fair_queue* sends) { sends_ = sends; }
+            fair_queue* sends() const { return sends_; }
+
+            readable_awaiter readable(int fd, uint64_t timeout_ms) {
+                return readable_awaiter { this, fd, timeout_ms, {} };
+            }
+
+            //! The resolution is the one of the timers (a tick)
+            sleep_awaiter sleep(uint64_t timeout_ms) {
+                return sleep_awaiter { this, timeout_ms, {} };
+            }
+
+            /**
+             * Starts a task, which runs up to its first suspension.
+             * The loop owns it until it completes
+             */
+            void spawn(task<void> t) {
+                run_detached(this, std::move(t), nullptr);
+            }
+
+            /**
+             * Blocking adapter: runs the loop until the task completes
+             */
+            void run_until(task<void> t) {
+                bool done = false;
+                run_detached(this, std::move(t), &done);
+
+                while (!done)
+                    run_once();
+            }
+
+            /**
+             * Resumes a coroutine on the thread of the loop (thread safe)
+             */
+            void post(std::coroutine_handle<> h) {
+                {
+                    std::lock_guard<std::mutex> lock(posted_mtx_);
+                    posted_.push_back(h);
+                }
+
+                notify();
+            }
+
+            //! Wakes run_once up (thread safe)
+            void notify() {
+                uint64_t one = 1;
+                ssize_t ret = write(wakeup_fd_, &one, sizeof(one));
+                (void) ret; // if full, the loop is already awake
+            }
+
+            /**
+             * Waits for the next events (while timers are armed, for a
+             * tick at most) and resumes the coroutines they concern
+             */
+            void run_once() {
+                struct epoll_event events[NU_EVENT_LOOP_BATCH];
+
+                int timeout = wheel_.armed_count() ? int(wheel_.tick_ms()) : -1;
+
+                // Sends waiting for the next batch: just poll
+                if (sends_ && sends_->pending())
+                    timeout = 0;
+
+                int n = epoll_wait(epfd_, events, NU_EVENT_LOOP_BATCH, timeout);
+
+                for (int i = 0; i < n; ++i) {
+                    io_waiter* w = (io_waiter*)events[i].data.ptr;
+
+                    if (!w) {
+                        uint64_t count;
+                        ssize_t ret = read(wakeup_fd_, &count, sizeof(count));
+                        (void) ret;
+                        continue;
+                    }
+
+                    complete(w, true);
+                }
+
+                resume_posted();
+
+                expired_.clear();
+                wheel_.advance(nu_coarse_ms(), expired_);
+
+                for (wheel_timer* t : expired_)
+                    complete((io_waiter*)t->owner, false);
+
+                expired_.clear();
+
+                if (sends_)
+                    sends_->run_batch();
+            }
+
+        private:
+            event_loop(const event_loop&) = delete;
+            event_loop& operator=(const event_loop&) = delete;
+
+            static detail::detached run_detached(event_loop* loop, task<void> t, bool* done) {
+                ++loop->tasks_;
+                co_await t;
+                --loop->tasks_;
+
+                if (done)
+                    *done = true;
+            }
+
+            // Returns false if the coroutine is not to be suspended
+            bool watch(io_waiter* w, int fd, uint64_t timeout_ms) {
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLONESHOT;
+                ev.data.ptr = w;
+
+                if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                    w->ready = true; // let the receive report the error
+                    return false;
+                }
+
+                w->fd = fd;
+                arm(w, timeout_ms);
+
+                return true;
+            }
+
+            void arm(io_waiter* w, uint64_t timeout_ms) {
+                w->timer.owner = w;
+
+                // After an idle period the wheel lags behind the clock
+                // (with no timer armed, it just jumps to the current tick)
+                if (!wheel_.armed_count())
+                    wheel_.advance(nu_coarse_ms(), expired_);
+
+                wheel_.arm(&w->timer, timeout_ms);
+            }
+
+            void complete(io_waiter* w, bool ready) {
+                wheel_.cancel(&w->timer);
+
+                if (w->fd >= 0)
+                    epoll_ctl(epfd_, EPOLL_CTL_DEL, w->fd, nullptr);
+
+                w->ready = ready;
+                w->handle.resume();
+            }
+
+            void resume_posted() {
+                {
+                    std::lock_guard<std::mutex> lock(posted_mtx_);
+
+                    if (posted_.empty())
+                        return;
+
+                    resuming_.swap(posted_);
+                }
+
+                for (std::coroutine_handle<> h : resuming_)
+                    h.resume();
+
+                resuming_.clear();
+            }
+
+            int epfd_ = -1;
+            int wakeup_fd_ = -1;
+            int tasks_ = 0;
+            fair_queue* sends_ = nullptr;
+
+            timer_wheel wheel_;
+            std::vector<wheel_timer*> expired_;
+
+            std::mutex posted_mtx_;
+            std::vector<std::coroutine_handle<>> posted_;
+            std::vector<std::coroutine_handle<>> resuming_;
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_CORO_H__ */
@@ -0,0 +1,127 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuCriticalSection.h"
+
+#include <string.h>
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+// The registry is plain static data: locks defined at namespace scope
+// register themselves during the static initialization
+std::atomic<bool> lock_stats_on { false };
+
+static lock_stats_t lock_stats_table[NU_LOCK_STATS_MAX];
+static std::atomic<int> lock_stats_used { 0 };
+static pthread_mutex_t lock_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* -------------------------------------------------------------------------- */
+
+void set_lock_stats(bool on)
+{
+    lock_stats_on.store(on, std::memory_order_relaxed);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int lock_stats_count()
+{
+    return lock_stats_used.load(std::memory_order_acquire);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+const lock_stats_t* lock_stats_at(int index)
+{
+    return &lock_stats_table[index];
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+lock_stats_t* lock_stats(const char* name)
+{
+    lock_stats_t* stats = 0;
+
+    pthread_mutex_lock(&lock_stats_mutex);
+
+    int used = lock_stats_used.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < used && !stats; ++i) {
+        if (strncmp(lock_stats_table[i].name, name,
+                    sizeof(lock_stats_table[i].name) - 1) == 0)
+        {
+            stats = &lock_stats_table[i];
+        }
+    }
+
+    if (!stats && used < NU_LOCK_STATS_MAX) {
+        stats = &lock_stats_table[used];
+        strncpy(stats->name, name, sizeof(stats->name) - 1);
+        lock_stats_used.store(used + 1, std::memory_order_release);
+    }
+
+    pthread_mutex_unlock(&lock_stats_mutex);
+
+    return stats;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool critical_section::recorded_enter()
+{
+    stats_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+
+    if (pthread_mutex_trylock(&muid_) != 0) {
+        uint64_t begin = clock_ns();
+
+        if (pthread_mutex_lock(&muid_) != 0)
+            return false;
+
+        stats_->contended.fetch_add(1, std::memory_order_relaxed);
+        stats_->wait_ns.fetch_add(clock_ns() - begin, std::memory_order_relaxed);
+    }
+
+    if (++_counter == 1)
+        hold_start_ns_ = clock_ns();
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void critical_section::hold_end()
+{
+    uint64_t held = clock_ns() - hold_start_ns_;
+    uint64_t max = stats_->max_hold_ns.load(std::memory_order_relaxed);
+
+    while (held > max &&
+            !stats_->max_hold_ns.compare_exchange_weak(max, held,
+                std::memory_order_relaxed))
+    {
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
@@ -17,6 +17,8 @@
 
 #include <pthread.h>
 #include <memory.h>
+#include <stdint.h>
+#include <time.h>
 
 
 /* -------------------------------------------------------------------------- */
@@ -26,6 +28,13 @@
 #include "nuTerminal.h"
 
 #include <string>
+#include <atomic>
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Names of locks whose contention is recorded
+#define NU_LOCK_STATS_MAX 64
 
 
 /* -------------------------------------------------------------------------- */
@@ -33,19 +42,60 @@
 namespace nu
 {
 
+    //! Contention of the locks of a name (all their instances)
+    struct lock_stats_t
+    {
+        char name[32];
+        std::atomic<uint64_t> acquisitions;
+        std::atomic<uint64_t> contended;   //!< acquisitions which waited
+        std::atomic<uint64_t> wait_ns;     //!< total
+        std::atomic<uint64_t> max_hold_ns;
+    };
+
+    /**
+     * Turns the recording of the contention of the locks on or off
+     * (off by default: a lock then costs just the mutex)
+     */
+    void set_lock_stats(bool on);
+
+    //! Count of the names of locks recorded
+    int lock_stats_count();
+
+    //! Stats of the locks of a name (index < lock_stats_count())
+    const lock_stats_t* lock_stats_at(int index);
+
+    /**
+     * @return lock_stats_t*: the stats of the locks of a name, added if
+     *         needed (0 if there is no room for it)
+     */
+    lock_stats_t* lock_stats(const char* name);
+
+    extern std::atomic<bool> lock_stats_on;
+
+
+/* -------------------------------------------------------------------------- */
+
     class critical_section
     {
         private:
             int _timeout;
-            int _counter;
+            int _counter; //!< depth of the owner (recorded locks only)
 
             int create_success_;
             mutable pthread_mutex_t muid_;
             std::string name_;
 
+            lock_stats_t* stats_;
+            uint64_t hold_start_ns_ = 0;
+
+            bool recorded_enter();
+            void hold_end();
+
         public:
+            //! MU_ADAPTIVE: not recursive, spins a while before sleeping 
+            //! (for short sections, contended by threads on other CPUs)
             enum {
-                MU_RECURSIVE, MU_NORECURSIVE
+                MU_RECURSIVE, MU_NORECURSIVE, MU_ADAPTIVE
             };
 
             critical_section( 
@@ -60,11 +110,14 @@ namespace nu
             {
                 NU_ASSERT(name);
                 name_ = name;
+                stats_ = lock_stats(name);
 
                 pthread_mutexattr_t attr;
                 pthread_mutexattr_init(&attr);
 #if defined(__linux__)
                 pthread_mutexattr_settype(&attr,
+                        flags == MU_ADAPTIVE ?
+                        PTHREAD_MUTEX_ADAPTIVE_NP :
                         flags != MU_RECURSIVE ? 
                         PTHREAD_MUTEX_FAST_NP : 
                         PTHREAD_MUTEX_RECURSIVE_NP);
@@ -89,6 +142,9 @@ namespace nu
                 if (!create_success())  
                     return false;
 
+                if (stats_ && lock_stats_on.load(std::memory_order_relaxed))
+                    return recorded_enter();
+
                 unsigned long result = pthread_mutex_lock(&muid_);
                 return (result == 0);
             }
@@ -98,6 +154,16 @@ namespace nu
                     return false;
 
                 unsigned long result = pthread_mutex_trylock(&muid_);
+
+                if (result == 0 && stats_ && 
+                        lock_stats_on.load(std::memory_order_relaxed)) 
+                {
+                    stats_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+
+                    if (++_counter == 1)
+                        hold_start_ns_ = clock_ns();
+                }
+
                 return (result == 0);
             }
 
@@ -105,10 +171,44 @@ namespace nu
                 if (!create_success()) 
                     return false;
 
+                // Entered while recording
+                if (_counter > 0 && --_counter == 0)
+                    hold_end();
+
                 unsigned long result = pthread_mutex_unlock(&muid_);
                 return (result == 0);
             }
 
+            /**
+             * Waits for a condition, the section being left meanwhile 
+             * (the wait is not accounted as held)
+             * @return int: as pthread_cond_timedwait
+             */
+            int wait(pthread_cond_t* cond, const struct timespec* deadline) {
+                int depth = _counter;
+
+                if (depth) {
+                    _counter = 0;
+                    hold_end();
+                }
+
+                int result = pthread_cond_timedwait(cond, &muid_, deadline);
+
+                if (depth) {
+                    _counter = depth;
+                    hold_start_ns_ = clock_ns();
+                }
+
+                return result;
+            }
+
+            static uint64_t clock_ns() {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+
+                return uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+            }
+
             const char* name() const throw() {
                 return name_.c_str();
             }
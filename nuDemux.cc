@@ -0,0 +1,482 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuDemux.h"
+#include "nuTftpUtil.h"
+
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <poll.h>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Datagrams read by a single recvmmsg
+#define DEMUX_BATCH 16
+
+//!Period the receiver checks for a stop request
+#define DEMUX_POLL_TIMEOUT 500 // ms
+
+enum {
+    DEMUX_TIMER_RECV,  //!< receive timeout of the session
+    DEMUX_TIMER_IDLE   //!< no traffic for NU_DEMUX_IDLE_TIMEOUT
+};
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+struct demux::channel_t
+{
+    uint64_t key;
+    int sd;
+
+    critical_section cs { "demux_channel" };
+    event_loop* loop = nullptr;
+    std::coroutine_handle<> waiter; //!< session waiting for a datagram
+
+    wheel_timer timer;
+    wheel_timer idle;
+    uint64_t deadline = 0; //!< of the pending receive (coarse ms)
+    bool waiting = false;
+    bool closed = false;
+
+    int head = 0;
+    int count = 0;
+    uint16_t sizes[NU_DEMUX_QUEUE];
+    char* frames; //!< NU_DEMUX_QUEUE of frame_size_, after the channel
+};
+
+
+/* -------------------------------------------------------------------------- */
+
+demux::demux(int sockets, int frame_size) :
+    frame_size_(frame_size),
+    wheel_(nu_coarse_ms())
+{
+    int bufsize = NU_DEMUX_SOCKBUF;
+
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK);
+
+    for (int i = 0; i < sockets; ++i) {
+        socket_t s;
+        s.sd = nu_create();
+        s.port = 0;
+
+        if (s.sd < 0)
+            break;
+
+        setsockopt(s.sd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+        setsockopt(s.sd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+        if (!nu_bind_and_getprt(s.sd, &s.port)) {
+            nu_free_sock(s.sd);
+            break;
+        }
+
+        sockets_.push_back(s);
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+demux::~demux()
+{
+    stop();
+
+    for (auto& s : sockets_)
+        nu_free_sock(s.sd);
+
+    if (wakeup_fd_ >= 0)
+        ::close(wakeup_fd_);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool demux::start()
+{
+    if (sockets_.empty() || wakeup_fd_ < 0)
+        return false;
+
+    stop_ = false;
+
+    if (pthread_create(&receiver_, NULL, receiver_thread, this) != 0)
+        return false;
+
+    started_ = true;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void demux::stop()
+{
+    if (!started_)
+        return;
+
+    stop_ = true;
+    pthread_join(receiver_, NULL);
+    started_ = false;
+
+    // Nobody expires the timers any more: release the waiting sessions
+    autoCs_t acs(cs_);
+
+    for (auto& c : channels_) {
+        autoCs_t ccs(c.second->cs);
+        c.second->closed = true;
+        wake(c.second);
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+demux::channel_t* demux::open(uint32_t peerAddr, uint16_t peerPort, int* sd)
+{
+    autoCs_t acs(cs_);
+
+    // Sockets are assigned round robin, skipping the ones already
+    // used by a session of the same peer endpoint
+    for (size_t i = 0; i < sockets_.size(); ++i) {
+        const socket_t& s = sockets_[next_++ % sockets_.size()];
+        uint64_t key = make_key(peerAddr, peerPort, s.port);
+
+        if (channels_.find(key) != channels_.end())
+            continue;
+
+        // The queue is allocated along with the channel
+        channel_t* channel = new (::operator new(channel_size())) channel_t;
+        channel->frames = (char*)(channel + 1);
+        channel->key = key;
+        channel->sd = s.sd;
+        channel->timer.owner = channel->idle.owner = channel;
+        channel->timer.kind = DEMUX_TIMER_RECV;
+        channel->idle.kind = DEMUX_TIMER_IDLE;
+
+        {
+            autoCs_t wcs(wheel_cs_);
+            wheel_.arm(&channel->idle, NU_DEMUX_IDLE_TIMEOUT);
+        }
+
+        channels_[key] = channel;
+        *sd = s.sd;
+
+        return channel;
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void demux::close(channel_t* channel)
+{
+    if (!channel)
+        return;
+
+    {
+        // Once removed, the receiver cannot reach the channel any more
+        autoCs_t acs(cs_);
+        channels_.erase(channel->key);
+
+        autoCs_t wcs(wheel_cs_);
+        wheel_.cancel(&channel->timer);
+        wheel_.cancel(&channel->idle);
+    }
+
+    channel->~channel_t();
+    ::operator delete(channel);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+size_t demux::channel_size() const
+{
+    return sizeof(channel_t) + NU_DEMUX_QUEUE * size_t(frame_size_);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Returns false if the session is not to be suspended, as a datagram 
+// is already queued or the channel has been closed
+bool demux::wait(
+        channel_t* channel, 
+        uint64_t timeout_ms, 
+        event_loop* loop,
+        std::coroutine_handle<> h)
+{
+    autoCs_t acs(channel->cs);
+
+    if (channel->count > 0 || channel->closed)
+        return false;
+
+    channel->deadline = nu_coarse_ms() + timeout_ms;
+    channel->waiting = true;
+    channel->loop = loop;
+    channel->waiter = h;
+
+    bool wakeup = false;
+
+    {
+        autoCs_t wcs(wheel_cs_);
+
+        // With no receive pending, the receiver sleeps for longer
+        // than a tick: wake it up to run the timer
+        wakeup = recv_timers_++ == 0;
+        wheel_.arm(&channel->timer, timeout_ms);
+    }
+
+    if (wakeup) {
+        uint64_t one = 1;
+        ssize_t ret = write(wakeup_fd_, &one, sizeof(one));
+        (void) ret; // if full, the receiver is already awake
+    }
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int demux::take(channel_t* channel, char* buf, int len)
+{
+    autoCs_t acs(channel->cs);
+
+    if (channel->waiting) {
+        channel->waiting = false;
+
+        autoCs_t wcs(wheel_cs_);
+        wheel_.cancel(&channel->timer);
+        --recv_timers_;
+    }
+
+    if (channel->count == 0)
+        return channel->closed ? -1 : 0;
+
+    int size = channel->sizes[channel->head];
+
+    if (size > len)
+        size = len;
+
+    memcpy(buf, channel->frames + channel->head * frame_size_, size);
+
+    channel->head = (channel->head + 1) % NU_DEMUX_QUEUE;
+    channel->count--;
+
+    return size;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Resumes the session waiting on the channel, if any (channel locked)
+void demux::wake(channel_t* channel)
+{
+    if (!channel->waiter)
+        return;
+
+    std::coroutine_handle<> h = channel->waiter;
+    channel->waiter = nullptr;
+    channel->loop->post(h);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void demux::dispatch(
+        int index,
+        uint32_t addr,
+        uint16_t port,
+        const char* frame,
+        int size)
+{
+    const socket_t& s = sockets_[index];
+
+    {
+        autoCs_t acs(cs_);
+
+        auto it = channels_.find(make_key(addr, port, s.port));
+
+        if (it != channels_.end()) {
+            channel_t* channel = it->second;
+
+            {
+                autoCs_t wcs(wheel_cs_);
+                wheel_.arm(&channel->idle, NU_DEMUX_IDLE_TIMEOUT);
+            }
+
+            autoCs_t ccs(channel->cs);
+
+            // A full queue drops the datagram, as a full socket buffer would
+            if (channel->count < NU_DEMUX_QUEUE) {
+                int tail = (channel->head + channel->count) % NU_DEMUX_QUEUE;
+
+                if (size > frame_size_)
+                    size = frame_size_;
+
+                memcpy(channel->frames + tail * frame_size_, frame, size);
+                channel->sizes[tail] = uint16_t(size);
+                channel->count++;
+
+                wake(channel);
+            }
+
+            return;
+        }
+    }
+
+    // Never answer an error with an error
+    if (tftp_parse_opcode(frame, uint16_t(size)) != TFTP_ERROR)
+        tftp_send_ERROR(s.sd, addr, port, TFTP_ERROR__UNKNOWN_TRANSFER_ID);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void demux::expire_timers()
+{
+    uint64_t now = nu_coarse_ms();
+
+    // Channels are not closed while the timers are handled
+    autoCs_t acs(cs_);
+
+    {
+        autoCs_t wcs(wheel_cs_);
+        expired_.clear();
+        wheel_.advance(now, expired_);
+    }
+
+    for (wheel_timer* t : expired_) {
+        channel_t* channel = (channel_t*)t->owner;
+        autoCs_t ccs(channel->cs);
+
+        if (t->kind == DEMUX_TIMER_IDLE) {
+            channel->closed = true;
+        }
+        else if (!channel->waiting) {
+            continue; // late expiry of a receive already completed
+        }
+        else if (now < channel->deadline) {
+            // Armed while the wheel was behind the clock
+            autoCs_t wcs(wheel_cs_);
+            wheel_.arm(t, channel->deadline - now);
+            continue;
+        }
+
+        // Timeout: the session finds its queue empty
+        wake(channel);
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void* demux::receiver_thread(void* arg)
+{
+    demux* self = (demux*)arg;
+    size_t n = self->sockets_.size();
+
+    // The last descriptor wakes the receiver up to run the timers
+    vector<struct pollfd> pfds(n + 1);
+
+    for (size_t i = 0; i < n; ++i) {
+        pfds[i].fd = self->sockets_[i].sd;
+        pfds[i].events = POLLIN;
+    }
+
+    pfds[n].fd = self->wakeup_fd_;
+    pfds[n].events = POLLIN;
+
+    vector<char> buffer(DEMUX_BATCH * NU_DEMUX_FRAME_SIZE);
+    struct mmsghdr msgs[DEMUX_BATCH];
+    struct iovec iovs[DEMUX_BATCH];
+    struct sockaddr_in from[DEMUX_BATCH];
+
+    while (!self->stop_) {
+        int poll_timeout = DEMUX_POLL_TIMEOUT;
+
+        {
+            autoCs_t wcs(self->wheel_cs_);
+
+            if (self->recv_timers_ > 0)
+                poll_timeout = int(self->wheel_.tick_ms());
+        }
+
+        int nd = poll(pfds.data(), n + 1, poll_timeout);
+
+        if (nd < 0 && errno != EINTR)
+            break;
+
+        if (nd > 0 && (pfds[n].revents & POLLIN)) {
+            uint64_t count;
+            ssize_t ret = read(self->wakeup_fd_, &count, sizeof(count));
+            (void) ret;
+        }
+
+        for (size_t i = 0; nd > 0 && i < n; ++i) {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+
+            // Read in batches until the socket is empty
+            while (true) {
+                for (int j = 0; j < DEMUX_BATCH; ++j) {
+                    iovs[j].iov_base = &buffer[j * NU_DEMUX_FRAME_SIZE];
+                    iovs[j].iov_len = NU_DEMUX_FRAME_SIZE;
+
+                    memset(&msgs[j], 0, sizeof(msgs[j]));
+                    msgs[j].msg_hdr.msg_iov = &iovs[j];
+                    msgs[j].msg_hdr.msg_iovlen = 1;
+                    msgs[j].msg_hdr.msg_name = &from[j];
+                    msgs[j].msg_hdr.msg_namelen = sizeof(from[j]);
+                }
+
+                int count = recvmmsg(pfds[i].fd, msgs, DEMUX_BATCH, MSG_DONTWAIT, NULL);
+
+                if (count <= 0)
+                    break;
+
+                for (int j = 0; j < count; ++j) {
+                    self->dispatch(int(i),
+                            ntohl(from[j].sin_addr.s_addr),
+                            ntohs(from[j].sin_port),
+                            &buffer[j * NU_DEMUX_FRAME_SIZE],
+                            int(msgs[j].msg_len));
+                }
+
+                if (count < DEMUX_BATCH)
+                    break;
+            }
+        }
+
+        self->expire_timers();
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
@@ -0,0 +1,189 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_DEMUX_H__
+#define __NU_DEMUX_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuCriticalSection.h"
+#include "nuTimerWheel.h"
+#include "nuCoro.h"
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Datagrams queued for a session not yet receiving
+#define NU_DEMUX_QUEUE 8
+
+//!Largest datagram read from the shared sockets (the queue of a
+//!session keeps up to its own frame size of each)
+#define NU_DEMUX_FRAME_SIZE 1500
+
+//!SO_SNDBUF/SO_RCVBUF of the shared sockets
+#define NU_DEMUX_SOCKBUF (1 << 20)
+
+//!A channel receiving nothing for so long is reaped
+#define NU_DEMUX_IDLE_TIMEOUT 60000 // ms
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * User-space demultiplexer of the session traffic.
+     *
+     * Sessions share a small set of UDP sockets instead of owning one
+     * each. A single receiver thread reads the shared sockets and routes
+     * each datagram, by (peer address, peer port, local port), to the
+     * queue of the session it belongs to. Every session still has its
+     * own transfer identifier, as no two sessions of the same peer
+     * endpoint share a local port: datagrams of unknown transfers get an
+     * "Unknown transfer ID" error.
+     * The receiver thread also drives a timer wheel, which expires the
+     * receive timeouts of the sessions and reaps the idle channels.
+     * A session waiting for a datagram is a coroutine: the receiver
+     * posts it to its event loop once the datagram or the timeout come.
+     */
+    class demux
+    {
+        public:
+            struct channel_t;
+
+            /**
+             * @param sockets: [in] count of shared sockets
+             * @param frame_size: [in] largest datagram a session receives,
+             *                    longer ones are truncated when queued
+             */
+            demux(int sockets, int frame_size);
+            ~demux();
+
+            bool start();
+            void stop();
+
+            /**
+             * Opens the channel of a session with a peer
+             *
+             * @param peerAddr: [in] address of the peer (host byte order)
+             * @param peerPort: [in] port of the peer
+             * @param sd: [out] shared socket to send to the peer with
+             * @return channel_t*: 0 if no socket is available to the peer
+             */
+            channel_t* open(uint32_t peerAddr, uint16_t peerPort, int* sd);
+
+            /**
+             * Closes a channel, datagrams still queued are discarded
+             */
+            void close(channel_t* channel);
+
+            /**
+             * @return size_t: memory held by the channel of a session
+             */
+            size_t channel_size() const;
+
+            // co_await demux.recv(...): datagram size, 0 on timeout,
+            // -1 if the channel has been reaped
+            struct recv_awaiter {
+                demux* owner;
+                channel_t* channel;
+                char* buf;
+                int len;
+                uint64_t timeout_ms;
+                event_loop* loop;
+
+                bool await_ready() const noexcept { return false; }
+
+                bool await_suspend(std::coroutine_handle<> h) {
+                    return owner->wait(channel, timeout_ms, loop, h);
+                }
+
+                int await_resume() {
+                    return owner->take(channel, buf, len);
+                }
+            };
+
+            /**
+             * Receives the next datagram of a session
+             *
+             * @param channel: [in] channel of the session
+             * @param buf: [out] receive buffer
+             * @param len: [in] size of buf, longer datagrams are truncated
+             * @param timeout: [in] max time to wait
+             * @param loop: [in] event loop the session is resumed on
+             * @return recv_awaiter: see above
+             */
+            recv_awaiter recv(channel_t* channel, char* buf, int len, 
+                    struct timeval* timeout, event_loop* loop)
+            {
+                uint64_t timeout_ms = 
+                    uint64_t(timeout->tv_sec) * 1000 + uint64_t(timeout->tv_usec) / 1000;
+
+                return recv_awaiter { this, channel, buf, len, timeout_ms, loop };
+            }
+
+        private:
+            demux(const demux&) = delete;
+            demux& operator=(const demux&) = delete;
+
+            static uint64_t make_key(uint32_t addr, uint16_t port, uint16_t local_port) {
+                return (uint64_t(addr) << 32) | (uint32_t(port) << 16) | local_port;
+            }
+
+            void dispatch(int index, uint32_t addr, uint16_t port, 
+                    const char* frame, int size);
+
+            bool wait(channel_t* channel, uint64_t timeout_ms, 
+                    event_loop* loop, std::coroutine_handle<> h);
+            int take(channel_t* channel, char* buf, int len);
+            void wake(channel_t* channel);
+
+            void expire_timers();
+
+            static void* receiver_thread(void* arg);
+
+            struct socket_t {
+                int sd;
+                uint16_t port;
+            };
+
+            std::vector<socket_t> sockets_;
+            unsigned next_ = 0;
+            int frame_size_;
+
+            critical_section cs_ { "demux" };
+            std::unordered_map<uint64_t, channel_t*> channels_;
+
+            critical_section wheel_cs_ { "demux_wheel" };
+            timer_wheel wheel_;
+            std::vector<wheel_timer*> expired_;
+            int recv_timers_ = 0; //!< sessions waiting for a datagram
+            int wakeup_fd_ = -1;  //!< wakes the receiver up to run the timers
+
+            pthread_t receiver_;
+            bool started_ = false;
+            std::atomic<bool> stop_ { false };
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_DEMUX_H__ */
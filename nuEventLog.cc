@@ -0,0 +1,245 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuEventLog.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Events written by a single fwrite
+#define EVENT_LOG_BATCH 512
+
+
+/* -------------------------------------------------------------------------- */
+
+static uint64_t event_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+const char* event_type_name(unsigned type)
+{
+    static const char* names[EVENT_TYPE_COUNT] = {
+        "?",
+        "request",
+        "session_start",
+        "session_end",
+        "data_sent",
+        "data_received",
+        "ack_sent",
+        "ack_received",
+        "retransmit",
+        "timeout",
+        "error"
+    };
+
+    return type < EVENT_TYPE_COUNT ? names[type] : "?";
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+event_log::event_log(const char* path, uint64_t file_size, int files) :
+    path_(path),
+    file_size_(file_size),
+    files_(files > 0 ? files : 1)
+{
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+event_log::~event_log()
+{
+    stop();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool event_log::start()
+{
+    if (!open_file())
+        return false;
+
+    stop_ = false;
+
+    if (pthread_create(&writer_, NULL, writer_thread, this) != 0) {
+        fclose(file_);
+        file_ = 0;
+
+        return false;
+    }
+
+    running_ = true;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void event_log::stop()
+{
+    if (!running_)
+        return;
+
+    stop_ = true;
+    pthread_join(writer_, NULL);
+    running_ = false;
+
+    if (file_)
+        fclose(file_);
+
+    file_ = 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void event_log::log(
+        unsigned type,
+        uint32_t session,
+        uint32_t addr,
+        uint16_t port,
+        uint32_t arg1,
+        uint64_t arg2)
+{
+    event_t e;
+    e.ts_ns = event_clock_ns(CLOCK_MONOTONIC);
+    e.session = session;
+    e.type = uint16_t(type);
+    e.port = port;
+    e.addr = addr;
+    e.arg1 = arg1;
+    e.arg2 = arg2;
+
+    if (!ring_.push(e))
+        ++dropped_; // never wait for the writer
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool event_log::open_file()
+{
+    file_ = fopen(path_.c_str(), "wb");
+
+    if (!file_)
+        return false;
+
+    event_log_header_t header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, NU_EVENT_LOG_MAGIC, sizeof(header.magic));
+    header.version = NU_EVENT_LOG_VERSION;
+    header.record_size = sizeof(event_t);
+    header.mono_ns = event_clock_ns(CLOCK_MONOTONIC);
+    header.real_ns = event_clock_ns(CLOCK_REALTIME);
+
+    written_ = fwrite(&header, sizeof(header), 1, file_) * sizeof(header);
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void event_log::rotate()
+{
+    fclose(file_);
+    file_ = 0;
+
+    // PATH.n-1 is dropped, PATH.i becomes PATH.i+1, PATH becomes PATH.1
+    for (int i = files_ - 1; i > 0; --i) {
+        string from = i > 1 ? path_ + "." + to_string(i - 1) : path_;
+        string to = path_ + "." + to_string(i);
+
+        rename(from.c_str(), to.c_str());
+    }
+
+    // If it fails, the next drain tries again
+    open_file();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+size_t event_log::drain()
+{
+    event_t batch[EVENT_LOG_BATCH];
+    size_t total = 0;
+    size_t count;
+
+    do {
+        count = 0;
+
+        while (count < EVENT_LOG_BATCH && ring_.pop(&batch[count]))
+            ++count;
+
+        // No file, since a rotation failed to open the new one
+        if (count && !file_ && !open_file()) {
+            dropped_ += count;
+        }
+        else if (count) {
+            written_ += fwrite(batch, sizeof(event_t), count, file_) * sizeof(event_t);
+
+            if (written_ >= file_size_)
+                rotate();
+        }
+
+        total += count;
+    }
+    while (count == EVENT_LOG_BATCH);
+
+    if (total && file_)
+        fflush(file_);
+
+    return total;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void* event_log::writer_thread(void* arg)
+{
+    event_log* self = (event_log*)arg;
+
+    while (!self->stop_) {
+        if (!self->drain())
+            usleep(NU_EVENT_LOG_PERIOD * 1000);
+    }
+
+    self->drain();
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
@@ -0,0 +1,163 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_EVENT_LOG_H__
+#define __NU_EVENT_LOG_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuRing.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Format of the event log files (version 1 had the datagram size in
+//!a DATA sent, and 0 at the end of a session completed)
+#define NU_EVENT_LOG_MAGIC "NUEVLOG"
+#define NU_EVENT_LOG_VERSION 2
+
+//!Events waiting for the writer thread
+#define NU_EVENT_LOG_RING_SIZE 16384
+
+//!Period of the writer thread, when there is nothing left to write
+#define NU_EVENT_LOG_PERIOD 10 //!< ms
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    //! Events of the log, and the meaning of their arguments
+    enum event_type_t {
+        EVENT_REQUEST = 1,   //!< arg1 = opcode (no session yet)
+        EVENT_SESSION_START, //!< arg1 = opcode
+        EVENT_SESSION_END,   //!< arg1 = error code (-1 = success), arg2 = ms
+        EVENT_DATA_SENT,     //!< arg1 = block, arg2 = bytes of file data
+        EVENT_DATA_RECEIVED, //!< arg1 = block, arg2 = bytes of file data
+        EVENT_ACK_SENT,      //!< arg1 = block
+        EVENT_ACK_RECEIVED,  //!< arg1 = block
+        EVENT_RETRANSMIT,    //!< arg1 = block (DATA or ACK sent again)
+        EVENT_TIMEOUT,       //!< arg1 = block waited for
+        EVENT_ERROR,         //!< arg1 = error code
+        EVENT_TYPE_COUNT
+    };
+
+
+    //! Record of the log (host byte order)
+    struct event_t {
+        uint64_t ts_ns;   //!< CLOCK_MONOTONIC
+        uint32_t session; //!< 0 = none
+        uint16_t type;
+        uint16_t port;    //!< of the client
+        uint32_t addr;    //!< of the client
+        uint32_t arg1;
+        uint64_t arg2;
+    };
+
+    static_assert(sizeof(event_t) == 32, "event_t is 32 bytes on disk");
+
+
+    //! Head of each file of the log
+    struct event_log_header_t {
+        char magic[8];        //!< NU_EVENT_LOG_MAGIC
+        uint32_t version;     //!< NU_EVENT_LOG_VERSION
+        uint32_t record_size; //!< sizeof(event_t)
+        uint64_t mono_ns;     //!< CLOCK_MONOTONIC and CLOCK_REALTIME
+        uint64_t real_ns;     //!< at the same instant
+    };
+
+    static_assert(sizeof(event_log_header_t) == 32, "event_log_header_t is 32 bytes on disk");
+
+
+    //! Name of an event type ("?" if unknown)
+    const char* event_type_name(unsigned type);
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * Binary log of the events of the sessions.
+     *
+     * Any thread may log an event: it is queued in a lock-free ring
+     * (dropped if the ring is full) and written by a background thread,
+     * in batches. When a file reaches its max size it is renamed as
+     * PATH.1 (PATH.1 as PATH.2 and so on, up to the count of files kept)
+     * and a new one is started.
+     */
+    class event_log
+    {
+        public:
+            /**
+             * @param path: [in] file of the log
+             * @param file_size: [in] max bytes of a file
+             * @param files: [in] count of files kept, the current one included
+             */
+            event_log(const char* path, uint64_t file_size, int files);
+            ~event_log();
+
+            /**
+             * Opens the log and starts the writer thread
+             * @return bool: false if the log is not available
+             */
+            bool start();
+
+            /**
+             * Writes the events left and stops the writer thread
+             */
+            void stop();
+
+            /**
+             * Queues an event (any thread, never blocks)
+             */
+            void log(unsigned type, uint32_t session, uint32_t addr, uint16_t port,
+                    uint32_t arg1, uint64_t arg2);
+
+            //! Events lost: ring full, or log file not available
+            unsigned long dropped() const { return dropped_; }
+
+        private:
+            event_log(const event_log&) = delete;
+            event_log& operator=(const event_log&) = delete;
+
+            static void* writer_thread(void* arg);
+
+            bool open_file();
+            void rotate();
+            size_t drain();
+
+            std::string path_;
+            uint64_t file_size_;
+            int files_;
+
+            mpsc_ring<event_t> ring_ { NU_EVENT_LOG_RING_SIZE };
+            std::atomic<unsigned long> dropped_ { 0 };
+
+            FILE* file_ = 0;
+            uint64_t written_ = 0; //!< bytes of the current file
+            pthread_t writer_;
+            bool running_ = false;
+            std::atomic<bool> stop_ { false };
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_EVENT_LOG_H__ */
@@ -0,0 +1,165 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_FAIR_QUEUE_H__
+#define __NU_FAIR_QUEUE_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include <coroutine>
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <queue>
+#include <vector>
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Resolution of the virtual time (a byte of a flow of weight 1)
+#define NU_FAIR_QUEUE_SCALE 1024
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Weighted fair queueing of the sends of the coroutines sharing an
+     * event loop (self-clocked fair queueing).
+     *
+     * Each send gets a virtual finish tag: the later of the virtual time
+     * and the tag of the previous send of its flow, plus its size scaled
+     * down by the weight of the flow. At each iteration of the loop, a
+     * batch of sends, up to a budget of bytes, goes out in the order of
+     * their tags: a flow sending a lot (a client on a fast link) falls
+     * behind the flows sending seldom, and a flow of weight w gets w
+     * times the bandwidth of a flow of weight 1 when they compete.
+     * While the budget of the batch lasts and nobody is waiting, a send
+     * goes out at once, without suspending.
+     * Not thread safe: it belongs to the thread of its event loop.
+     */
+    class fair_queue
+    {
+        public:
+            struct flow_t {
+                unsigned weight = 1;
+                uint64_t finish = 0; //!< tag of the last send
+            };
+
+            // co_await queue.turn(&flow, bytes): resumed when the
+            // send may go out
+            struct turn_awaiter {
+                fair_queue* queue;
+                flow_t* flow;
+                size_t bytes;
+
+                bool await_ready() { return queue->pass(flow, bytes); }
+
+                void await_suspend(std::coroutine_handle<> h) {
+                    queue->enqueue(flow, bytes, h);
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            /**
+             * @param batch_bytes: [in] bytes sent by each batch
+             */
+            explicit fair_queue(size_t batch_bytes) :
+                batch_(batch_bytes),
+                budget_(batch_bytes)
+            {}
+
+            turn_awaiter turn(flow_t* flow, size_t bytes) {
+                return turn_awaiter { this, flow, bytes };
+            }
+
+            bool pending() const { return !waiting_.empty(); }
+
+            /**
+             * Starts a new batch: resumes the sends waiting, in the order
+             * of their tags, as long as the budget lasts (one at least)
+             */
+            void run_batch() {
+                budget_ = batch_;
+
+                while (!waiting_.empty()) {
+                    entry_t e = waiting_.top();
+
+                    if (e.bytes > budget_ && budget_ < batch_)
+                        break;
+
+                    waiting_.pop();
+
+                    vtime_ = e.finish;
+                    budget_ = e.bytes < budget_ ? budget_ - e.bytes : 0;
+
+                    e.handle.resume();
+                }
+            }
+
+        private:
+            fair_queue(const fair_queue&) = delete;
+            fair_queue& operator=(const fair_queue&) = delete;
+
+            struct entry_t {
+                uint64_t finish;
+                uint64_t seq;   //!< FIFO among equal tags
+                size_t bytes;
+                std::coroutine_handle<> handle;
+
+                bool operator>(const entry_t& other) const {
+                    return finish != other.finish ?
+                        finish > other.finish : seq > other.seq;
+                }
+            };
+
+            uint64_t tag(flow_t* flow, size_t bytes) {
+                uint64_t start = flow->finish > vtime_ ? flow->finish : vtime_;
+                unsigned weight = flow->weight ? flow->weight : 1;
+
+                flow->finish = start + bytes * NU_FAIR_QUEUE_SCALE / weight;
+
+                return flow->finish;
+            }
+
+            bool pass(flow_t* flow, size_t bytes) {
+                if (!waiting_.empty() || bytes > budget_)
+                    return false;
+
+                vtime_ = tag(flow, bytes);
+                budget_ -= bytes;
+
+                return true;
+            }
+
+            void enqueue(flow_t* flow, size_t bytes, std::coroutine_handle<> h) {
+                waiting_.push(entry_t { tag(flow, bytes), seq_++, bytes, h });
+            }
+
+            size_t batch_;
+            size_t budget_;
+            uint64_t vtime_ = 0;
+            uint64_t seq_ = 0;
+
+            std::priority_queue<entry_t, std::vector<entry_t>,
+                std::greater<entry_t>> waiting_;
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_FAIR_QUEUE_H__ */
@@ -0,0 +1,519 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuFileCache.h"
+#include "nuTrace.h"
+
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+#define PATH_SEPARATOR_CHAR '/'
+
+#define FILE_CACHE_WATCH_MASK \
+    (IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO | \
+     IN_MOVE_SELF | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB)
+
+//!Poll period of the watcher thread (used to check the stop flag)
+#define FILE_CACHE_POLL_MS 500
+
+//!Events arriving within this window are coalesced in a single rescan
+#define FILE_CACHE_DEBOUNCE_MS 20
+#define FILE_CACHE_DEBOUNCE_ROUNDS 50
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+file_cache::file_cache(const char* root) : root_(root ? root : "")
+{
+    readers_[0] = 0;
+    readers_[1] = 0;
+
+    // Strip trailing separators, keep "/" as is
+    while (root_.size() > 1 && root_[root_.size() - 1] == PATH_SEPARATOR_CHAR)
+        root_.erase(root_.size() - 1);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+file_cache::~file_cache()
+{
+    stop();
+    publish(nullptr);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+uint32_t file_cache::hash(const char* s, size_t len)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void file_cache::scan_dir(const string& rel)
+{
+    string dir_path = rel.empty() ? root_ : root_ + PATH_SEPARATOR_CHAR + rel;
+    struct stat st;
+
+    // Symbolic links to directories are followed, but a directory
+    // already scanned is not scanned again (loops)
+    if (stat(dir_path.c_str(), &st) != 0 ||
+            !dir_ids_.insert(make_pair(st.st_dev, st.st_ino)).second)
+    {
+        return;
+    }
+
+    dir_t d;
+    d.dev = st.st_dev;
+    d.ino = st.st_ino;
+    d.wd = inotify_fd_ >= 0 ?
+        inotify_add_watch(inotify_fd_, dir_path.c_str(), FILE_CACHE_WATCH_MASK) : -1;
+
+    if (d.wd < 0) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                "file_cache: cannot watch %s errno=%d", dir_path.c_str(), errno);
+    }
+    else {
+        watches_[d.wd] = rel;
+    }
+
+    dirs_[rel] = d;
+
+    DIR* dir = opendir(dir_path.c_str());
+
+    if (!dir)
+        return;
+
+    struct dirent* de;
+
+    while ((de = readdir(dir)) != nullptr) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        string name = rel.empty() ? string(de->d_name) :
+            rel + PATH_SEPARATOR_CHAR + de->d_name;
+
+        string path = root_ + PATH_SEPARATOR_CHAR + name;
+
+        if (stat(path.c_str(), &st) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            scan_dir(name);
+            continue;
+        }
+
+        if (!S_ISREG(st.st_mode))
+            continue;
+
+        file_meta_set(&files_[name], st);
+    }
+
+    closedir(dir);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Forgets a directory, its files and its subdirectories
+void file_cache::remove_dir(const string& rel)
+{
+    string prefix = rel + PATH_SEPARATOR_CHAR;
+
+    auto f = files_.lower_bound(prefix);
+
+    while (f != files_.end() && f->first.compare(0, prefix.size(), prefix) == 0)
+        f = files_.erase(f);
+
+    auto d = dirs_.find(rel);
+
+    while (d != dirs_.end()) {
+        if (d->second.wd >= 0) {
+            inotify_rm_watch(inotify_fd_, d->second.wd); // may be gone already
+            watches_.erase(d->second.wd);
+        }
+
+        dir_ids_.erase(make_pair(d->second.dev, d->second.ino));
+        dirs_.erase(d);
+
+        d = dirs_.lower_bound(prefix);
+
+        if (d != dirs_.end() && d->first.compare(0, prefix.size(), prefix) != 0)
+            d = dirs_.end();
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Drops the state of the watcher and scans the whole tree again
+void file_cache::rescan()
+{
+    for (const auto& w : watches_)
+        inotify_rm_watch(inotify_fd_, w.first);
+
+    files_.clear();
+    dirs_.clear();
+    watches_.clear();
+    dir_ids_.clear();
+
+    scan_dir(string());
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Gets the names of the entries changed from a buffer of inotify events.
+// Returns false if the kernel queue overflowed (events were lost)
+bool file_cache::collect(const char* buf, size_t len, set<string>* changed)
+{
+    const char* p = buf;
+
+    while (p + sizeof(struct inotify_event) <= buf + len) {
+        const struct inotify_event* ev = (const struct inotify_event*)p;
+        p += sizeof(struct inotify_event) + ev->len;
+
+        if (ev->mask & IN_Q_OVERFLOW)
+            return false;
+
+        auto w = watches_.find(ev->wd);
+
+        if (w == watches_.end())
+            continue;
+
+        if (ev->mask & IN_IGNORED) {
+            auto d = dirs_.find(w->second); // the directory is gone
+
+            if (d != dirs_.end() && d->second.wd == ev->wd)
+                d->second.wd = -1;
+
+            watches_.erase(w);
+            continue;
+        }
+
+        // Events of a directory itself are reported by its parent too
+        if (!ev->len || !ev->name[0])
+            continue;
+
+        changed->insert(w->second.empty() ? string(ev->name) :
+                w->second + PATH_SEPARATOR_CHAR + ev->name);
+    }
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Stats the entries changed and updates the tree
+void file_cache::apply(const set<string>& changed)
+{
+    vector<pair<string, struct stat>> found;
+
+    // Entries gone or replaced first: a directory moved within the tree
+    // must be forgotten under its old name before it is scanned again
+    for (const string& name : changed) {
+        string path = root_ + PATH_SEPARATOR_CHAR + name;
+        struct stat st;
+        bool exists = stat(path.c_str(), &st) == 0;
+
+        if (!exists || !S_ISREG(st.st_mode))
+            files_.erase(name);
+
+        auto d = dirs_.find(name);
+
+        if (d != dirs_.end() && (!exists || !S_ISDIR(st.st_mode) ||
+                    d->second.dev != st.st_dev || d->second.ino != st.st_ino))
+        {
+            remove_dir(name);
+        }
+
+        if (exists)
+            found.push_back(make_pair(name, st));
+    }
+
+    for (const auto& f : found) {
+        const struct stat& st = f.second;
+
+        if (S_ISDIR(st.st_mode)) {
+            if (!dirs_.count(f.first))
+                scan_dir(f.first);
+        }
+        else if (S_ISREG(st.st_mode)) {
+            file_meta_set(&files_[f.first], st);
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+file_cache::snapshot_t* file_cache::build() const
+{
+    snapshot_t* s = new snapshot_t;
+
+    s->entries.reserve(files_.size());
+
+    for (const auto& f : files_) {
+        entry_t e;
+        e.name = f.first;
+        e.path = root_ + PATH_SEPARATOR_CHAR + f.first;
+        e.meta = f.second;
+
+        s->entries.push_back(e);
+    }
+
+    // Build the open addressing index (load factor <= 0.5)
+    uint32_t n_slots = 16;
+
+    while (n_slots < s->entries.size() * 2)
+        n_slots <<= 1;
+
+    s->slots.assign(n_slots, -1);
+    s->mask = n_slots - 1;
+
+    for (size_t i = 0; i < s->entries.size(); ++i) {
+        const string& name = s->entries[i].name;
+        uint32_t slot = hash(name.c_str(), name.size()) & s->mask;
+
+        while (s->slots[slot] >= 0)
+            slot = (slot + 1) & s->mask;
+
+        s->slots[slot] = int32_t(i);
+    }
+
+    return s;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void file_cache::publish(snapshot_t* s)
+{
+    const snapshot_t* old = current_.exchange(s);
+
+    if (!old)
+        return;
+
+    // Wait for a grace period: flip the epoch twice, each time waiting
+    // for the readers registered in the previous epoch to leave
+    for (int phase = 0; phase < 2; ++phase) {
+        unsigned e = epoch_.fetch_add(1) & 1;
+
+        while (readers_[e].load() != 0)
+            sched_yield();
+    }
+
+    delete old;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+file_cache::lookup_result_t file_cache::lookup(
+        const char* name,
+        file_meta_t* meta,
+        char* path,
+        size_t path_size) const
+{
+    // Names are relative to the root
+    while (*name == PATH_SEPARATOR_CHAR)
+        ++name;
+
+    size_t len = strlen(name);
+
+    unsigned e = epoch_.load() & 1;
+    readers_[e].fetch_add(1);
+
+    const snapshot_t* s = stale_.load() ? nullptr : current_.load();
+    lookup_result_t result = LOOKUP_UNAVAILABLE;
+
+    if (s) {
+        result = LOOKUP_MISS;
+
+        uint32_t slot = hash(name, len) & s->mask;
+
+        while (s->slots[slot] >= 0) {
+            const entry_t& entry = s->entries[s->slots[slot]];
+
+            if (entry.name.size() == len && memcmp(entry.name.c_str(), name, len) == 0) {
+                if (entry.path.size() < path_size) {
+                    *meta = entry.meta;
+                    memcpy(path, entry.path.c_str(), entry.path.size() + 1);
+                    result = LOOKUP_HIT;
+                }
+                break;
+            }
+
+            slot = (slot + 1) & s->mask;
+        }
+    }
+
+    readers_[e].fetch_sub(1);
+
+    return result;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool file_cache::start()
+{
+    struct stat st;
+
+    if (root_.empty() || stat(root_.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (inotify_fd_ < 0) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                "file_cache: inotify_init1 failed errno=%d", errno);
+
+        return false;
+    }
+
+    rescan();
+    publish(build());
+
+    stop_ = false;
+
+    if (pthread_create(&watcher_, NULL, watcher_thread, this) != 0) {
+        close(inotify_fd_);
+        inotify_fd_ = -1;
+        publish(nullptr);
+
+        return false;
+    }
+
+    watcher_started_ = true;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void file_cache::stop()
+{
+    if (watcher_started_) {
+        stop_ = true;
+        pthread_join(watcher_, NULL);
+        watcher_started_ = false;
+    }
+
+    if (inotify_fd_ >= 0) {
+        close(inotify_fd_);
+        inotify_fd_ = -1;
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void file_cache::invalidate()
+{
+    stale_ = true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void* file_cache::watcher_thread(void* arg)
+{
+    file_cache* self = (file_cache*)arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    struct pollfd pfd;
+    pfd.fd = self->inotify_fd_;
+    pfd.events = POLLIN;
+
+    while (!self->stop_) {
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, FILE_CACHE_POLL_MS) <= 0) {
+            // Invalidated by a lookup: rescan anyway
+            if (self->stale_.exchange(false)) {
+                self->rescan();
+                self->publish(self->build());
+            }
+
+            continue;
+        }
+
+        // Drain the queue, coalescing bursts of events (e.g. a file copy)
+        set<string> changed;
+        bool complete = true;
+        int rounds = 0;
+        ssize_t len;
+
+        do {
+            while ((len = read(self->inotify_fd_, buf, sizeof(buf))) > 0)
+                complete = self->collect(buf, size_t(len), &changed) && complete;
+
+            pfd.revents = 0;
+        }
+        while (++rounds < FILE_CACHE_DEBOUNCE_ROUNDS &&
+                poll(&pfd, 1, FILE_CACHE_DEBOUNCE_MS) > 0);
+
+        // Events lost, or a lookup found the snapshot out of date
+        if (self->stale_.exchange(false) || !complete) {
+            self->rescan();
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+                    "file_cache: %s rescanned", self->root_.c_str());
+        }
+        else {
+            self->apply(changed);
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+                    "file_cache: %s, %i entries changed",
+                    self->root_.c_str(), int(changed.size()));
+        }
+
+        self->publish(self->build());
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
+
@@ -0,0 +1,195 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_FILE_CACHE_H__
+#define __NU_FILE_CACHE_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Metadata of a regular file found under the root of the cache.
+     * Times are kept to the nanosecond: a file rewritten within the
+     * same second still gets a different identity
+     */
+    typedef struct _file_meta_t {
+        off_t size;
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+        struct timespec ctime;
+    }
+    file_meta_t;
+
+
+    /**
+     * Fills the metadata of a file from its stat
+     */
+    inline void file_meta_set(file_meta_t* meta, const struct stat& st)
+    {
+        meta->size = st.st_size;
+        meta->dev = st.st_dev;
+        meta->ino = st.st_ino;
+        meta->mtime = st.st_mtim;
+        meta->ctime = st.st_ctim;
+    }
+
+
+    /**
+     * @return bool: true if both describe the same version of a file
+     */
+    inline bool file_meta_equal(const file_meta_t& a, const file_meta_t& b)
+    {
+        return a.ino == b.ino && a.dev == b.dev && a.size == b.size &&
+            a.mtime.tv_sec == b.mtime.tv_sec &&
+            a.mtime.tv_nsec == b.mtime.tv_nsec &&
+            a.ctime.tv_sec == b.ctime.tv_sec &&
+            a.ctime.tv_nsec == b.ctime.tv_nsec;
+    }
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * Directory-tree metadata and path-resolution cache.
+     *
+     * The whole tree under root is scanned once; then a watcher thread
+     * applies the changes inotify reports, stating just the entries
+     * they name (a new directory is scanned), and publishes an
+     * immutable snapshot of the tree by swapping a pointer.
+     * Readers never take a lock: they register in the current epoch,
+     * load the snapshot and leave. The writer retires an old snapshot
+     * only after both epochs have drained (RCU-style grace period).
+     */
+    class file_cache
+    {
+        public:
+            enum lookup_result_t {
+                LOOKUP_UNAVAILABLE, //!< cache not running, caller must stat
+                LOOKUP_MISS,        //!< not in the snapshot (may be newer)
+                LOOKUP_HIT
+            };
+
+            explicit file_cache(const char* root);
+            ~file_cache();
+
+            /**
+             * Scans the tree and starts the inotify watcher
+             * @return bool: false if the cache cannot be used
+             */
+            bool start();
+            void stop();
+
+            /**
+             * Resolves a file name relative to the root
+             *
+             * @param name: [in] file name as requested by the client
+             * @param meta: [out] metadata of the file (valid on LOOKUP_HIT)
+             * @param path: [out] full path of the file (valid on LOOKUP_HIT)
+             * @param path_size: [in] size of the path buffer
+             * @return lookup_result_t
+             */
+            lookup_result_t lookup(
+                    const char* name,
+                    file_meta_t* meta,
+                    char* path,
+                    size_t path_size) const;
+
+            /**
+             * Drops the snapshot, found out of date by a caller (a file
+             * changed before inotify reported it): lookups return
+             * LOOKUP_UNAVAILABLE until the tree is scanned again
+             */
+            void invalidate();
+
+            const char* root() const throw() {
+                return root_.c_str();
+            }
+
+        private:
+            struct entry_t {
+                std::string name;   // relative to root, no leading separator
+                std::string path;   // root + separator + name
+                file_meta_t meta;
+            };
+
+            struct snapshot_t {
+                std::vector<entry_t> entries;
+                std::vector<int32_t> slots; // open addressing, -1 = empty
+                uint32_t mask = 0;
+            };
+
+            //! Directories scanned, by device and inode
+            typedef std::set<std::pair<dev_t, ino_t>> dir_set_t;
+
+            struct dir_t {
+                int wd;     // -1 if not watched
+                dev_t dev;
+                ino_t ino;
+            };
+
+            file_cache(const file_cache&) = delete;
+            file_cache& operator=(const file_cache&) = delete;
+
+            static uint32_t hash(const char* s, size_t len);
+            void rescan();
+            void scan_dir(const std::string& rel);
+            void remove_dir(const std::string& rel);
+            bool collect(const char* buf, size_t len, std::set<std::string>* changed);
+            void apply(const std::set<std::string>& changed);
+            snapshot_t* build() const;
+            void publish(snapshot_t* s);
+            static void* watcher_thread(void* arg);
+
+            std::string root_;
+            int inotify_fd_ = -1;
+            pthread_t watcher_;
+            bool watcher_started_ = false;
+            std::atomic<bool> stop_ { false };
+            std::atomic<bool> stale_ { false };
+
+            // The tree as known by the watcher thread (names relative
+            // to root, "" is root itself)
+            std::map<std::string, file_meta_t> files_;
+            std::map<std::string, dir_t> dirs_;
+            std::map<int, std::string> watches_; // wd -> directory
+            dir_set_t dir_ids_;
+
+            std::atomic<const snapshot_t*> current_ { nullptr };
+            std::atomic<unsigned> epoch_ { 0 };
+            mutable std::atomic<unsigned long> readers_[2];
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_FILE_CACHE_H__ */
@@ -0,0 +1,158 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_HISTOGRAM_H__
+#define __NU_HISTOGRAM_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <atomic>
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Buckets per power of two: values are kept within 1/32 (~3%)
+#define NU_HISTOGRAM_SUB_BITS 5
+
+//!Values recorded are up to 2^NU_HISTOGRAM_MAX_BITS - 1 (larger ones
+//!are clamped): in us, more than an hour
+#define NU_HISTOGRAM_MAX_BITS 32
+
+#define NU_HISTOGRAM_BUCKETS \
+    ((NU_HISTOGRAM_MAX_BITS - NU_HISTOGRAM_SUB_BITS + 1) << NU_HISTOGRAM_SUB_BITS)
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    //! Counts of a histogram, merged from its shards
+    struct histogram_snapshot
+    {
+        uint64_t counts[NU_HISTOGRAM_BUCKETS] = {};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        /**
+         * @param q: [in] quantile, between 0 and 1
+         * @return uint64_t: the highest value of the bucket of the
+         *         quantile (0 if nothing was recorded)
+         */
+        uint64_t percentile(double q) const;
+    };
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * Log-linear histogram (HDR-like) of the values recorded by a thread.
+     *
+     * Values below 2^(NU_HISTOGRAM_SUB_BITS+1) have a bucket each, each
+     * power of two above them is split in 2^NU_HISTOGRAM_SUB_BITS buckets,
+     * so the relative error is the same across the whole range.
+     * The storage is fixed: recording is a couple of relaxed atomic
+     * additions, with no lock and no allocation.
+     */
+    class alignas(64) histogram
+    {
+        public:
+            histogram() {
+                for (int i = 0; i < NU_HISTOGRAM_BUCKETS; ++i)
+                    counts_[i].store(0, std::memory_order_relaxed);
+            }
+
+            void record(uint64_t value) {
+                counts_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+                sum_.fetch_add(value, std::memory_order_relaxed);
+            }
+
+            //! Adds the counts to a snapshot
+            void merge(histogram_snapshot* snapshot) const {
+                for (int i = 0; i < NU_HISTOGRAM_BUCKETS; ++i) {
+                    uint64_t n = counts_[i].load(std::memory_order_relaxed);
+                    snapshot->counts[i] += n;
+                    snapshot->count += n;
+                }
+
+                snapshot->sum += sum_.load(std::memory_order_relaxed);
+            }
+
+            static int bucket_of(uint64_t value) {
+                const uint64_t sub = uint64_t(1) << NU_HISTOGRAM_SUB_BITS;
+
+                if (value >= (uint64_t(1) << NU_HISTOGRAM_MAX_BITS))
+                    return NU_HISTOGRAM_BUCKETS - 1;
+
+                if (value < (sub << 1))
+                    return int(value);
+
+                int shift = 63 - __builtin_clzll(value) - NU_HISTOGRAM_SUB_BITS;
+
+                return int(((shift + 1) << NU_HISTOGRAM_SUB_BITS) +
+                        ((value >> shift) - sub));
+            }
+
+            //! Highest value of a bucket
+            static uint64_t bucket_value(int bucket) {
+                const int sub = 1 << NU_HISTOGRAM_SUB_BITS;
+
+                if (bucket < (sub << 1))
+                    return uint64_t(bucket);
+
+                int shift = (bucket >> NU_HISTOGRAM_SUB_BITS) - 1;
+                uint64_t low = uint64_t(sub + (bucket & (sub - 1))) << shift;
+
+                return low + (uint64_t(1) << shift) - 1;
+            }
+
+        private:
+            histogram(const histogram&) = delete;
+            histogram& operator=(const histogram&) = delete;
+
+            std::atomic<uint64_t> counts_[NU_HISTOGRAM_BUCKETS];
+            std::atomic<uint64_t> sum_ { 0 };
+    };
+
+
+/* -------------------------------------------------------------------------- */
+
+    inline uint64_t histogram_snapshot::percentile(double q) const
+    {
+        if (!count)
+            return 0;
+
+        // Rank of the value, from 1
+        uint64_t rank = uint64_t(q * double(count) + 0.5);
+
+        if (rank < 1)
+            rank = 1;
+
+        uint64_t seen = 0;
+
+        for (int i = 0; i < NU_HISTOGRAM_BUCKETS; ++i) {
+            seen += counts[i];
+
+            if (seen >= rank)
+                return histogram::bucket_value(i);
+        }
+
+        return histogram::bucket_value(NU_HISTOGRAM_BUCKETS - 1);
+    }
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_HISTOGRAM_H__ */
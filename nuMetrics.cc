@@ -0,0 +1,333 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuMetrics.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Size of the request read (and ignored) by the endpoint
+#define METRICS_REQUEST_SIZE 1024
+
+//!Max wait for the request of a scraper
+#define METRICS_REQUEST_TIMEOUT 1000 //!< ms
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+metrics::metrics(int shards) :
+    shards_count_(shards > 0 ? shards : 1)
+{
+    shards_ = new shard_t[shards_count_];
+
+    for (int s = 0; s < shards_count_; ++s) {
+        for (int i = 0; i < NU_METRICS_MAX; ++i)
+            shards_[s].values[i].store(0, memory_order_relaxed);
+    }
+
+    metrics_.reserve(NU_METRICS_MAX);
+    histograms_.reserve(NU_METRICS_MAX);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+metrics::~metrics()
+{
+    for (histogram_t& h : histograms_)
+        delete [] h.shards;
+
+    delete [] shards_;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int metrics::add_metric(
+        const char* family,
+        const char* labels,
+        const char* help,
+        type_t type)
+{
+    if (metrics_.size() >= NU_METRICS_MAX)
+        return -1;
+
+    metric_t m;
+    m.family = family;
+    m.labels = labels ? labels : "";
+    m.help = help;
+    m.type = type;
+
+    metrics_.push_back(m);
+
+    return int(metrics_.size() - 1);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int metrics::add_histogram(
+        const char* family,
+        const char* labels,
+        const char* help)
+{
+    if (histograms_.size() >= NU_METRICS_MAX)
+        return -1;
+
+    histogram_t h;
+    h.desc.family = family;
+    h.desc.labels = labels ? labels : "";
+    h.desc.help = help;
+    h.desc.type = GAUGE;
+    h.shards = new histogram[shards_count_];
+
+    histograms_.push_back(h);
+
+    return int(histograms_.size() - 1);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void metrics::snapshot(int id, histogram_snapshot* snapshot) const
+{
+    for (int s = 0; s < shards_count_; ++s)
+        histograms_[id].shards[s].merge(snapshot);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int64_t metrics::value(int id) const
+{
+    int64_t sum = 0;
+
+    for (int s = 0; s < shards_count_; ++s)
+        sum += shards_[s].values[id].load(memory_order_relaxed);
+
+    return sum;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+string metrics::exposition() const
+{
+    string text;
+    char value[32];
+
+    for (size_t i = 0; i < metrics_.size(); ++i) {
+        const metric_t& m = metrics_[i];
+
+        // The metrics of a family are registered one after the other
+        if (i == 0 || metrics_[i - 1].family != m.family) {
+            text += "# HELP " + m.family + " " + m.help + "\n";
+            text += "# TYPE " + m.family +
+                (m.type == COUNTER ? " counter\n" : " gauge\n");
+        }
+
+        text += m.family;
+
+        if (!m.labels.empty())
+            text += "{" + m.labels + "}";
+
+        snprintf(value, sizeof(value), " %lld\n", (long long)this->value(int(i)));
+        text += value;
+    }
+
+    static const struct { const char* label; double q; } quantiles[] = {
+        { "0.5", 0.5 }, { "0.99", 0.99 }, { "0.999", 0.999 }
+    };
+
+    histogram_snapshot* merged = new histogram_snapshot;
+
+    for (size_t i = 0; i < histograms_.size(); ++i) {
+        const metric_t& m = histograms_[i].desc;
+        string labels = m.labels.empty() ? "" : m.labels + ",";
+        string suffix = m.labels.empty() ? "" : "{" + m.labels + "}";
+
+        if (i == 0 || histograms_[i - 1].desc.family != m.family) {
+            text += "# HELP " + m.family + " " + m.help + "\n";
+            text += "# TYPE " + m.family + " summary\n";
+        }
+
+        *merged = {};
+        snapshot(int(i), merged);
+
+        for (const auto& q : quantiles) {
+            if (merged->count)
+                snprintf(value, sizeof(value), " %.6f\n", merged->percentile(q.q) / 1e6);
+            else
+                snprintf(value, sizeof(value), " NaN\n");
+
+            text += m.family + "{" + labels + "quantile=\"" + q.label + "\"}" + value;
+        }
+
+        snprintf(value, sizeof(value), " %.6f\n", merged->sum / 1e6);
+        text += m.family + "_sum" + suffix + value;
+
+        snprintf(value, sizeof(value), " %llu\n", (unsigned long long)merged->count);
+        text += m.family + "_count" + suffix + value;
+    }
+
+    delete merged;
+
+    for (const auto& c : collectors_)
+        c.first(text, c.second);
+
+    return text;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+metrics_endpoint::metrics_endpoint(const metrics* registry, unsigned short port) :
+    registry_(registry),
+    port_(port)
+{
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+metrics_endpoint::~metrics_endpoint()
+{
+    stop();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool metrics_endpoint::start()
+{
+    sd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (sd_ < 0)
+        return false;
+
+    int on = 1;
+    setsockopt(sd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (::bind(sd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(sd_, 8) != 0 ||
+            pthread_create(&server_, NULL, server_thread, this) != 0)
+    {
+        close(sd_);
+        sd_ = -1;
+
+        return false;
+    }
+
+    running_ = true;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void metrics_endpoint::stop()
+{
+    if (!running_)
+        return;
+
+    stop_ = true;
+    pthread_join(server_, NULL);
+    running_ = false;
+
+    close(sd_);
+    sd_ = -1;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Answers a scraper, whatever it asked for
+void metrics_endpoint::serve(int sd)
+{
+    char request[METRICS_REQUEST_SIZE];
+    struct pollfd pfd = { sd, POLLIN, 0 };
+
+    if (poll(&pfd, 1, METRICS_REQUEST_TIMEOUT) <= 0 ||
+            recv(sd, request, sizeof(request), 0) <= 0)
+    {
+        return;
+    }
+
+    string body = registry_->exposition();
+    string response =
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + to_string(body.size()) + "\r\n"
+        "Connection: close\r\n"
+        "\r\n" + body;
+
+    size_t sent = 0;
+
+    while (sent < response.size()) {
+        ssize_t n = send(sd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+
+        if (n <= 0)
+            break;
+
+        sent += size_t(n);
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void* metrics_endpoint::server_thread(void* arg)
+{
+    metrics_endpoint* self = (metrics_endpoint*)arg;
+
+    while (!self->stop_) {
+        struct pollfd pfd = { self->sd_, POLLIN, 0 };
+
+        if (poll(&pfd, 1, NU_METRICS_POLL_PERIOD) <= 0)
+            continue;
+
+        int sd = accept4(self->sd_, NULL, NULL, SOCK_CLOEXEC);
+
+        if (sd < 0)
+            continue;
+
+        self->serve(sd);
+        close(sd);
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
@@ -0,0 +1,189 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_METRICS_H__
+#define __NU_METRICS_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuHistogram.h"
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Max count of metrics of a registry
+#define NU_METRICS_MAX 64
+
+//!Poll period of the endpoint thread (used to check the stop flag)
+#define NU_METRICS_POLL_PERIOD 200 //!< ms
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Registry of counters, gauges and latency histograms.
+     *
+     * Each metric has a value per shard (a thread updating it, such as
+     * a session worker), on a cache line of its own, so updates are
+     * plain relaxed atomic additions which no other writer contends.
+     * The shards are summed on read.
+     * Metrics are registered once, before being updated.
+     */
+    class metrics
+    {
+        public:
+            enum type_t {
+                COUNTER,
+                GAUGE
+            };
+
+            //! Appends to the exposition metrics kept elsewhere
+            typedef void (*collector_t)(std::string& text, void* arg);
+
+            /**
+             * @param shards: [in] count of the threads updating the metrics
+             */
+            explicit metrics(int shards);
+            ~metrics();
+
+            /**
+             * Registers a metric
+             * @param family: [in] name of the metric
+             * @param labels: [in] "name=\"value\",..." (0 = none): the
+             *                metrics of a family differ by their labels
+             * @param help: [in] description of the family
+             * @return int: id of the metric, -1 if the registry is full
+             */
+            int add_metric(const char* family, const char* labels,
+                    const char* help, type_t type);
+
+            /**
+             * Registers a histogram of durations, exported as a summary
+             * (p50, p99, p999, sum and count) in seconds
+             * @param family, labels, help: [in] as add_metric
+             * @return int: id of the histogram, -1 if the registry is full
+             */
+            int add_histogram(const char* family, const char* labels,
+                    const char* help);
+
+            /**
+             * Adds a collector, called on each exposition (after the
+             * metrics of the registry)
+             */
+            void add_collector(collector_t collector, void* arg) {
+                collectors_.push_back(std::make_pair(collector, arg));
+            }
+
+            int shards() const { return shards_count_; }
+
+            void add(int shard, int id, int64_t delta) {
+                shards_[shard].values[id].fetch_add(delta, std::memory_order_relaxed);
+            }
+
+            void set(int shard, int id, int64_t value) {
+                shards_[shard].values[id].store(value, std::memory_order_relaxed);
+            }
+
+            //! Records a duration (us) in a histogram
+            void record(int shard, int id, uint64_t us) {
+                histograms_[id].shards[shard].record(us);
+            }
+
+            //! Sum of the shards
+            int64_t value(int id) const;
+
+            //! Merge of the shards
+            void snapshot(int id, histogram_snapshot* snapshot) const;
+
+            /**
+             * @return std::string: the metrics in the Prometheus text format
+             */
+            std::string exposition() const;
+
+        private:
+            metrics(const metrics&) = delete;
+            metrics& operator=(const metrics&) = delete;
+
+            struct metric_t {
+                std::string family;
+                std::string labels;
+                std::string help;
+                type_t type;
+            };
+
+            struct alignas(64) shard_t {
+                std::atomic<int64_t> values[NU_METRICS_MAX];
+            };
+
+            struct histogram_t {
+                metric_t desc;
+                histogram* shards;
+            };
+
+            int shards_count_;
+            shard_t* shards_;
+            std::vector<metric_t> metrics_;
+            std::vector<histogram_t> histograms_;
+            std::vector<std::pair<collector_t, void*>> collectors_;
+    };
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * HTTP endpoint serving the exposition of a registry on the loopback
+     * interface (any path), for a Prometheus server to scrape
+     */
+    class metrics_endpoint
+    {
+        public:
+            metrics_endpoint(const metrics* registry, unsigned short port);
+            ~metrics_endpoint();
+
+            /**
+             * Binds the port and starts the thread serving it
+             * @return bool: false if the endpoint is not available
+             */
+            bool start();
+            void stop();
+
+        private:
+            metrics_endpoint(const metrics_endpoint&) = delete;
+            metrics_endpoint& operator=(const metrics_endpoint&) = delete;
+
+            static void* server_thread(void* arg);
+            void serve(int sd);
+
+            const metrics* registry_;
+            unsigned short port_;
+            int sd_ = -1;
+            pthread_t server_;
+            bool running_ = false;
+            std::atomic<bool> stop_ { false };
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_METRICS_H__ */
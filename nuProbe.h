@@ -0,0 +1,57 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_PROBE_H__
+#define __NU_PROBE_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+// Static (USDT) probes of the provider "nutftp", for bpftrace or perf:
+//
+//   bpftrace -e 'usdt:./nutftpserver:nutftp:data_send { ... }'
+//
+// A probe is a nop until a tracer attaches to it, and its arguments
+// are only read then. NU_PROBES is defined by the build if <sys/sdt.h>
+// is available (cmake -DNU_PROBES=OFF removes them anyway): else the
+// probes are compiled out.
+
+#if defined(NU_PROBES) && NU_PROBES
+
+#include <sys/sdt.h>
+
+#define NU_PROBE1(name, a1) \
+    DTRACE_PROBE1(nutftp, name, a1)
+#define NU_PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(nutftp, name, a1, a2)
+#define NU_PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(nutftp, name, a1, a2, a3)
+#define NU_PROBE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(nutftp, name, a1, a2, a3, a4)
+
+#else
+
+// The arguments are still used, so that no variable is left unused
+#define NU_PROBE1(name, a1) \
+    do { (void)(a1); } while (0)
+#define NU_PROBE2(name, a1, a2) \
+    do { (void)(a1); (void)(a2); } while (0)
+#define NU_PROBE3(name, a1, a2, a3) \
+    do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#define NU_PROBE4(name, a1, a2, a3, a4) \
+    do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } while (0)
+
+#endif
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_PROBE_H__ */
@@ -0,0 +1,224 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_RING_H__
+#define __NU_RING_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Bounded lock-free multi-producer/single-consumer ring.
+     *
+     * Each cell carries a sequence number telling whether it is free for
+     * the producer of a given position or ready for the consumer, so
+     * producers only contend on a CAS of the head, and the consumer
+     * takes no atomic read-modify-write at all. Nothing is allocated
+     * once the ring is built: push fails when the ring is full.
+     */
+    template<typename T>
+    class mpsc_ring
+    {
+        public:
+            /**
+             * @param capacity: [in] rounded up to a power of 2
+             */
+            explicit mpsc_ring(size_t capacity) {
+                size_t size = 1;
+
+                while (size < capacity)
+                    size <<= 1;
+
+                mask_ = size - 1;
+                cells_ = new cell_t[size];
+
+                for (size_t i = 0; i < size; ++i)
+                    cells_[i].seq.store(i, std::memory_order_relaxed);
+            }
+
+            ~mpsc_ring() {
+                delete [] cells_;
+            }
+
+            /**
+             * Enqueues an item (any thread)
+             * @return bool: false if the ring is full
+             */
+            bool push(const T& item) {
+                size_t pos = head_.load(std::memory_order_relaxed);
+                cell_t* cell;
+
+                while (true) {
+                    cell = &cells_[pos & mask_];
+                    size_t seq = cell->seq.load(std::memory_order_acquire);
+                    intptr_t diff = intptr_t(seq) - intptr_t(pos);
+
+                    if (diff == 0) {
+                        if (head_.compare_exchange_weak(pos, pos + 1, 
+                                    std::memory_order_relaxed))
+                        {
+                            break;
+                        }
+                    }
+                    else if (diff < 0) {
+                        return false; // full
+                    }
+                    else {
+                        pos = head_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                cell->item = item;
+                cell->seq.store(pos + 1, std::memory_order_release);
+
+                return true;
+            }
+
+            /**
+             * Dequeues an item (the consumer thread only)
+             * @return bool: false if the ring is empty
+             */
+            bool pop(T* item) {
+                cell_t* cell = &cells_[tail_ & mask_];
+
+                if (cell->seq.load(std::memory_order_acquire) != tail_ + 1)
+                    return false;
+
+                *item = cell->item;
+                cell->seq.store(tail_ + mask_ + 1, std::memory_order_release);
+                ++tail_;
+
+                return true;
+            }
+
+            size_t capacity() const { return mask_ + 1; }
+
+        private:
+            mpsc_ring(const mpsc_ring&) = delete;
+            mpsc_ring& operator=(const mpsc_ring&) = delete;
+
+            struct cell_t {
+                std::atomic<size_t> seq;
+                T item;
+            };
+
+            cell_t* cells_;
+            size_t mask_;
+
+            alignas(64) std::atomic<size_t> head_ { 0 }; //!< producers
+            alignas(64) size_t tail_ = 0;                //!< consumer
+    };
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * Bounded lock-free single-producer/single-consumer ring.
+     *
+     * Items are written and read in place: the producer claims the next
+     * free cell and publishes it once filled, the consumer reads the
+     * oldest cell and releases it. Each side owns its index and just
+     * reads the one of the other side, so neither side takes an atomic
+     * read-modify-write. Nothing is allocated once the ring is built.
+     */
+    template<typename T>
+    class spsc_ring
+    {
+        public:
+            /**
+             * @param capacity: [in] rounded up to a power of 2
+             */
+            explicit spsc_ring(size_t capacity) {
+                size_t size = 1;
+
+                while (size < capacity)
+                    size <<= 1;
+
+                mask_ = size - 1;
+                cells_ = new T[size];
+            }
+
+            ~spsc_ring() {
+                delete [] cells_;
+            }
+
+            /**
+             * Next cell to fill (the producer thread only)
+             * @return T*: 0 if the ring is full
+             */
+            T* claim() {
+                size_t head = head_.load(std::memory_order_relaxed);
+
+                if (head - tail_.load(std::memory_order_acquire) > mask_)
+                    return 0;
+
+                return &cells_[head & mask_];
+            }
+
+            //! Makes the cell claimed visible to the consumer
+            void publish() {
+                head_.store(head_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+            }
+
+            /**
+             * Oldest cell published (the consumer thread only)
+             * @return T*: 0 if the ring is empty
+             */
+            T* front() {
+                size_t tail = tail_.load(std::memory_order_relaxed);
+
+                if (tail == head_.load(std::memory_order_acquire))
+                    return 0;
+
+                return &cells_[tail & mask_];
+            }
+
+            //! Gives the front cell back to the producer
+            void pop() {
+                tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+            }
+
+            bool empty() const {
+                return tail_.load(std::memory_order_acquire) ==
+                    head_.load(std::memory_order_acquire);
+            }
+
+            size_t capacity() const { return mask_ + 1; }
+
+        private:
+            spsc_ring(const spsc_ring&) = delete;
+            spsc_ring& operator=(const spsc_ring&) = delete;
+
+            T* cells_;
+            size_t mask_;
+
+            alignas(64) std::atomic<size_t> head_ { 0 }; //!< producer
+            alignas(64) std::atomic<size_t> tail_ { 0 }; //!< consumer
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_RING_H__ */
@@ -0,0 +1,94 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_SEQLOCK_H__
+#define __NU_SEQLOCK_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include <string.h>
+#include <sched.h>
+#include <atomic>
+#include <type_traits>
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Data written by a single thread and read by any other one, with
+     * no lock: the writer makes the sequence number odd while writing,
+     * readers copy the data and retry if the sequence number changed
+     * meanwhile (or was odd). Writing costs two stores, and readers
+     * never delay the writer.
+     */
+    template<typename T>
+    class alignas(64) seqlock
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                "seqlock data is copied as bytes");
+
+        public:
+            seqlock() {
+                memset(&data_, 0, sizeof(data_));
+            }
+
+            //! The data, as last written (writer thread only)
+            const T& data() const { return data_; }
+
+            //! Starts a write (writer thread only)
+            T* begin_write() {
+                seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+
+                return &data_;
+            }
+
+            void end_write() {
+                seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+            }
+
+            //! Copies a consistent version of the data (any thread)
+            void read(T* copy) const {
+                while (true) {
+                    unsigned seq = seq_.load(std::memory_order_acquire);
+
+                    if (!(seq & 1)) {
+                        memcpy((void*)copy, (const void*)&data_, sizeof(T));
+                        std::atomic_thread_fence(std::memory_order_acquire);
+
+                        if (seq_.load(std::memory_order_relaxed) == seq)
+                            return;
+                    }
+
+                    sched_yield();
+                }
+            }
+
+        private:
+            seqlock(const seqlock&) = delete;
+            seqlock& operator=(const seqlock&) = delete;
+
+            std::atomic<unsigned> seq_ { 0 };
+            T data_;
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_SEQLOCK_H__ */
@@ -0,0 +1,280 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuSockPool.h"
+#include "nuSockTool.h"
+
+#include <netinet/in.h>
+#include <errno.h>
+#include <time.h>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+//!Period of the replenisher thread when nobody wakes it up
+#define SOCK_POOL_REFILL_PERIOD 1 // secs
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+/* -------------------------------------------------------------------------- */
+
+sock_pool::sock_pool(int size, int sndbuf, int rcvbuf) :
+    size_(size > 0 ? size : 0),
+    sndbuf_(sndbuf),
+    rcvbuf_(rcvbuf)
+{
+    pthread_cond_init(&cond_, NULL);
+    free_.reserve(size_);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+sock_pool::~sock_pool()
+{
+    stop();
+
+    for (auto& e : free_)
+        nu_free_sock(e.sd);
+
+    pthread_cond_destroy(&cond_);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int sock_pool::create(unsigned short* port)
+{
+    int sd = nu_create();
+
+    if (sd < 0)
+        return -1;
+
+    if (sndbuf_ > 0)
+        setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &sndbuf_, sizeof(sndbuf_));
+
+    if (rcvbuf_ > 0)
+        setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf_, sizeof(rcvbuf_));
+
+    *port = 0;
+
+    if (!nu_bind_and_getprt(sd, port)) {
+        nu_free_sock(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Discards datagrams queued while the socket was not connected
+void sock_pool::drain(int sd)
+{
+    char buf[1];
+
+    while (recv(sd, buf, sizeof(buf), MSG_DONTWAIT) >= 0)
+        ;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool sock_pool::start()
+{
+    {
+        autoCs_t acs(cs_);
+
+        while (int(free_.size()) < size_) {
+            entry_t e;
+            e.sd = create(&e.port);
+
+            if (e.sd < 0)
+                break;
+
+            free_.push_back(e);
+        }
+    }
+
+    stop_ = false;
+
+    if (pthread_create(&replenisher_, NULL, replenisher_thread, this) != 0)
+        return false;
+
+    started_ = true;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void sock_pool::stop()
+{
+    if (!started_)
+        return;
+
+    {
+        autoCs_t acs(cs_);
+        stop_ = true;
+        pthread_cond_signal(&cond_);
+    }
+
+    pthread_join(replenisher_, NULL);
+    started_ = false;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int sock_pool::checkout(unsigned short* port)
+{
+    entry_t e;
+    e.sd = -1;
+
+    {
+        autoCs_t acs(cs_);
+
+        if (!free_.empty()) {
+            e = free_.back();
+            free_.pop_back();
+        }
+
+        // Wake up the replenisher when half of the pool is gone
+        if (int(free_.size()) < size_ / 2)
+            pthread_cond_signal(&cond_);
+    }
+
+    // Pool exhausted: pay for a new socket
+    if (e.sd < 0)
+        return create(port);
+
+    // Unconnected sessions filter the peers themselves, connected ones
+    // drain again once connected
+    drain(e.sd);
+    *port = e.port;
+
+    return e.sd;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool sock_pool::connect(int sd, uint32_t addr, unsigned short port)
+{
+    if (!nu_connect(sd, addr, port))
+        return false;
+
+    drain(sd);
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void sock_pool::checkin(int sd, bool reuse)
+{
+    if (sd < 0)
+        return;
+
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    unsigned short port = 0;
+
+    if (reuse && getsockname(sd, (struct sockaddr*)&sin, &len) == 0)
+        port = ntohs(sin.sin_port);
+
+    if (port) {
+        struct sockaddr unspec;
+        memset(&unspec, 0, sizeof(unspec));
+        unspec.sa_family = AF_UNSPEC;
+
+        // Dissolve the association with the last peer
+        reuse = ::connect(sd, &unspec, sizeof(unspec)) == 0;
+
+        // A socket bound by the system (port 0) is unbound as well:
+        // bind it again to its port, from then on it stays bound
+        len = sizeof(sin);
+
+        if (reuse && getsockname(sd, (struct sockaddr*)&sin, &len) == 0 &&
+                sin.sin_port == 0)
+        {
+            reuse = nu_bind_port(sd, port) != 0;
+        }
+
+        if (reuse) {
+            autoCs_t acs(cs_);
+
+            if (int(free_.size()) < size_) {
+                entry_t e;
+                e.sd = sd;
+                e.port = port;
+                free_.push_back(e);
+
+                return;
+            }
+        }
+    }
+
+    nu_free_sock(sd);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void* sock_pool::replenisher_thread(void* arg)
+{
+    sock_pool* self = (sock_pool*)arg;
+
+    autoCs_t acs(self->cs_);
+
+    while (!self->stop_) {
+        while (!self->stop_ && int(self->free_.size()) < self->size_) {
+            entry_t e;
+
+            // Sockets are created out of the lock
+            self->cs_.leave();
+            e.sd = self->create(&e.port);
+            self->cs_.enter();
+
+            if (e.sd < 0)
+                break;
+
+            if (int(self->free_.size()) < self->size_)
+                self->free_.push_back(e);
+            else
+                nu_free_sock(e.sd);
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SOCK_POOL_REFILL_PERIOD;
+
+        if (!self->stop_)
+            self->cs_.wait(&self->cond_, &deadline);
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}
+
@@ -0,0 +1,110 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_SOCK_POOL_H__
+#define __NU_SOCK_POOL_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuCriticalSection.h"
+
+#include <stdint.h>
+#include <vector>
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Pool of pre-created UDP sockets, bound to ephemeral ports and with
+     * tuned buffers, ready to be handed to a new session.
+     *
+     * A background thread keeps the pool filled. Sockets given back are
+     * disconnected, drained and reused, so that neither socket() nor
+     * bind() nor close() are on the path of a request.
+     */
+    class sock_pool
+    {
+        public:
+            /**
+             * @param size: [in] count of sockets kept ready
+             * @param sndbuf: [in] SO_SNDBUF of the sockets (0 = system default)
+             * @param rcvbuf: [in] SO_RCVBUF of the sockets (0 = system default)
+             */
+            sock_pool(int size, int sndbuf, int rcvbuf);
+            ~sock_pool();
+
+            bool start();
+            void stop();
+
+            /**
+             * Gets a bound socket. If the pool is empty a new one is created
+             *
+             * @param port: [out] port the socket is bound to
+             * @return int: socket descriptor, -1 on error
+             */
+            int checkout(unsigned short* port);
+
+            /**
+             * Gives back a socket obtained by checkout
+             *
+             * @param sd: [in] socket descriptor
+             * @param reuse: [in] false if the socket options were changed
+             *               (e.g. multicast), then the socket is closed
+             */
+            void checkin(int sd, bool reuse = true);
+
+            /**
+             * Connects a socket obtained by checkout to its peer, then
+             * discards what was queued before (e.g. late datagrams of the
+             * last session on the port): from then on, only datagrams of
+             * the peer are queued
+             *
+             * @param addr, port: [in] peer (host byte order)
+             * @return bool: false if the socket cannot be connected
+             */
+            static bool connect(int sd, uint32_t addr, unsigned short port);
+
+        private:
+            struct entry_t {
+                int sd;
+                unsigned short port;
+            };
+
+            sock_pool(const sock_pool&) = delete;
+            sock_pool& operator=(const sock_pool&) = delete;
+
+            int create(unsigned short* port);
+            static void drain(int sd);
+            static void* replenisher_thread(void* arg);
+
+            int size_;
+            int sndbuf_;
+            int rcvbuf_;
+
+            critical_section cs_ { "sock_pool" };
+            pthread_cond_t cond_;
+            std::vector<entry_t> free_;
+
+            pthread_t replenisher_;
+            bool started_ = false;
+            bool stop_ = false;
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_SOCK_POOL_H__ */
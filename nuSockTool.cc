@@ -43,6 +43,9 @@ int nu_sendto(int sd,
 {
     struct sockaddr_in remote_host = {0};
 
+    if (destIp == 0 && port == 0) // connected socket
+        return send(sd, buf, len, flags);
+
     remote_host.sin_addr.s_addr = htonl(destIp);
     remote_host.sin_family = AF_INET;
     remote_host.sin_port = htons(port);
@@ -56,6 +59,34 @@ int nu_sendto(int sd,
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+int nu_sendmsg(int sd,
+        const struct iovec* iov,
+        int iovcnt,
+        int flags,
+        unsigned long destIp,
+        unsigned short port)
+{
+    struct sockaddr_in remote_host {};
+    struct msghdr msg {};
+
+    remote_host.sin_addr.s_addr = htonl(destIp);
+    remote_host.sin_family = AF_INET;
+    remote_host.sin_port = htons(port);
+
+    if (destIp != 0 || port != 0) { // else connected socket
+        msg.msg_name = &remote_host;
+        msg.msg_namelen = sizeof(remote_host);
+    }
+
+    msg.msg_iov = (struct iovec*) iov;
+    msg.msg_iovlen = iovcnt;
+
+    return sendmsg(sd, &msg, flags);
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 int nu_recvfrom(
@@ -134,6 +165,22 @@ int nu_recvfrom_timeout(
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+int nu_connect(int sd, unsigned long destIp, unsigned short port)
+{
+    struct sockaddr_in remote_host;
+
+    memset(&remote_host, 0, sizeof(remote_host));
+
+    remote_host.sin_addr.s_addr = htonl(destIp);
+    remote_host.sin_family = AF_INET;
+    remote_host.sin_port = htons(port);
+
+    return connect(sd, (struct sockaddr *) &remote_host, sizeof(remote_host)) == 0;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 int nu_bind_and_getprt(
@@ -172,4 +219,20 @@ int nu_bind_port(int sd, unsigned short port)
 
 /* -------------------------------------------------------------------------- */
 
+int nu_set_multicast(int sd, unsigned long ifAddr, int ttl, int loop)
+{
+    struct in_addr iface;
+    unsigned char mttl = (unsigned char) ttl;
+    unsigned char mloop = loop ? 1 : 0;
+
+    iface.s_addr = htonl(ifAddr);
+
+    return
+        setsockopt(sd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) == 0 &&
+        setsockopt(sd, IPPROTO_IP, IP_MULTICAST_TTL, &mttl, sizeof(mttl)) == 0 &&
+        setsockopt(sd, IPPROTO_IP, IP_MULTICAST_LOOP, &mloop, sizeof(mloop)) == 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
 
@@ -17,6 +17,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -80,6 +81,8 @@ int nu_bind_and_getprt(int sd, unsigned short* port_ptr);
  * @param flags: [in] indicator specifying the way in which the call is made
  * @param destIp: [in] address of the remote host
  * @param port: [in] port of the remote host
+ *                   (if both destIp and port are zero, the datagram is sent
+ *                   to the peer of a connected socket)
  *
  * @return int: If no error occurs, nu_sendto returns the total number of bytes sent. 
  *              Otherwise, -1 is returned
@@ -93,6 +96,31 @@ int nu_sendto(
         unsigned short port);
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Send a datagram gathered from several buffers to a remote host
+ *
+ * @param sd: [in] socket descriptor
+ * @param iov: [in] array of buffers composing the datagram
+ * @param iovcnt: [in] count of the buffers
+ * @param flags: [in] indicator specifying the way in which the call is made
+ * @param destIp: [in] address of the remote host
+ * @param port: [in] port of the remote host
+ *                   (both zero for the peer of a connected socket)
+ *
+ * @return int: If no error occurs, nu_sendmsg returns the total number of bytes sent. 
+ *              Otherwise, -1 is returned
+ */
+int nu_sendmsg(
+        int sd,
+        const struct iovec* iov,
+        int iovcnt,
+        int flags,
+        unsigned long destIp,
+        unsigned short port);
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -145,4 +173,35 @@ int nu_recvfrom_timeout(
         struct timeval* timeout );
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Connects a datagram socket to a remote host: datagrams coming from
+ * any other host are then discarded by the kernel, and no route lookup
+ * is needed for sending
+ *
+ * @param sd: [in] socket descriptor
+ * @param destIp: [in] address of the remote host
+ * @param port: [in] port of the remote host
+ *
+ * @return int: If no error occurs, returns TRUE. Otherwise, it returns FALSE
+ */
+int nu_connect(int sd, unsigned long destIp, unsigned short port);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Sets up a socket for sending multicast datagrams
+ *
+ * @param sd: [in] socket descriptor
+ * @param ifAddr: [in] address of the outgoing interface (0 = default route)
+ * @param ttl: [in] time to live of the datagrams
+ * @param loop: [in] if non-zero, datagrams are looped back to local listeners
+ *
+ * @return int: If no error occurs, returns TRUE. Otherwise, it returns FALSE
+ */
+int nu_set_multicast(int sd, unsigned long ifAddr, int ttl, int loop);
+
+
 #endif // __NUSOCKTOOL_H__
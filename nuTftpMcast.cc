@@ -0,0 +1,258 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuTftpMcast.h"
+#include "nuCriticalSection.h"
+
+
+/* -------------------------------------------------------------------------- */
+
+static nu::critical_section tftp_mcast_cs = "tftp_mcast_groups";
+
+static tftp_mcast_group_t tftp_mcast_groups[TFTP_MCAST_MAX_GROUPS];
+
+
+/* -------------------------------------------------------------------------- */
+
+// Names are compared without the leading separators, as the files
+// are resolved relative to the root directory
+static const char* tftp_mcast_strip(const char* filename)
+{
+    while (*filename == '/')
+        ++filename;
+
+    return filename;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static tftp_mcast_client_t* tftp_mcast_find(
+        tftp_mcast_group_t* group,
+        uint32_t client_addr,
+        uint16_t client_port)
+{
+    for (int i = 0; i < TFTP_MCAST_MAX_CLIENTS; ++i) {
+        tftp_mcast_client_t* c = &group->clients[i];
+
+        if (c->state != TFTP_MCAST_FREE &&
+                c->addr == client_addr &&
+                c->port == client_port)
+        {
+            return c;
+        }
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+tftp_mcast_group_t* tftp_mcast_open(
+        const void* owner,
+        const char* filename,
+        uint32_t addr,
+        uint16_t port,
+        uint32_t client_addr,
+        uint16_t client_port)
+{
+    nu::autoCs_t acs = tftp_mcast_cs;
+
+    for (int i = 0; i < TFTP_MCAST_MAX_GROUPS; ++i) {
+        tftp_mcast_group_t* group = &tftp_mcast_groups[i];
+
+        if (group->used)
+            continue;
+
+        memset(group, 0, sizeof(tftp_mcast_group_t));
+
+        group->used = true;
+        group->owner = owner;
+        strncpy(group->filename, tftp_mcast_strip(filename), TFTP_MAX_FILENAME_SIZE - 1);
+        group->addr = addr + uint32_t(i);
+        group->port = port;
+
+        group->clients[0].addr = client_addr;
+        group->clients[0].port = client_port;
+        group->clients[0].state = TFTP_MCAST_MASTER;
+
+        return group;
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool tftp_mcast_join(
+        const void* owner,
+        const char* filename,
+        uint32_t client_addr,
+        uint16_t client_port)
+{
+    nu::autoCs_t acs = tftp_mcast_cs;
+
+    filename = tftp_mcast_strip(filename);
+
+    for (int i = 0; i < TFTP_MCAST_MAX_GROUPS; ++i) {
+        tftp_mcast_group_t* group = &tftp_mcast_groups[i];
+
+        if (!group->used || group->owner != owner ||
+                strcmp(group->filename, filename) != 0)
+        {
+            continue;
+        }
+
+        tftp_mcast_client_t* c = tftp_mcast_find(group, client_addr, client_port);
+
+        if (c) {
+            switch (c->state) {
+                case TFTP_MCAST_JOINING:
+                    return true; // retransmitted request, OACK not sent yet
+
+                case TFTP_MCAST_WAITING:
+                    c->state = TFTP_MCAST_JOINING; // the OACK got lost
+                    return true;
+
+                case TFTP_MCAST_DONE:
+                    c->state = TFTP_MCAST_JOINING; // the file again
+                    return true;
+
+                default:
+                    // The master asking again (e.g. restarted): a
+                    // session of its own serves it
+                    return false;
+            }
+        }
+
+        for (int j = 0; j < TFTP_MCAST_MAX_CLIENTS; ++j) {
+            c = &group->clients[j];
+
+            if (c->state == TFTP_MCAST_FREE) {
+                c->addr = client_addr;
+                c->port = client_port;
+                c->state = TFTP_MCAST_JOINING;
+
+                return true;
+            }
+        }
+
+        return false; // group full
+    }
+
+    return false;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool tftp_mcast_next_joining(
+        tftp_mcast_group_t* group,
+        uint32_t* client_addr,
+        uint16_t* client_port)
+{
+    nu::autoCs_t acs = tftp_mcast_cs;
+
+    for (int i = 0; i < TFTP_MCAST_MAX_CLIENTS; ++i) {
+        tftp_mcast_client_t* c = &group->clients[i];
+
+        if (c->state == TFTP_MCAST_JOINING) {
+            c->state = TFTP_MCAST_WAITING;
+            *client_addr = c->addr;
+            *client_port = c->port;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool tftp_mcast_next_master(
+        tftp_mcast_group_t* group,
+        uint32_t* client_addr,
+        uint16_t* client_port)
+{
+    nu::autoCs_t acs = tftp_mcast_cs;
+
+    for (int i = 0; i < TFTP_MCAST_MAX_CLIENTS; ++i) {
+        tftp_mcast_client_t* c = &group->clients[i];
+
+        if (c->state == TFTP_MCAST_JOINING || c->state == TFTP_MCAST_WAITING) {
+            c->state = TFTP_MCAST_MASTER;
+            *client_addr = c->addr;
+            *client_port = c->port;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void tftp_mcast_client_done(
+        tftp_mcast_group_t* group,
+        uint32_t client_addr,
+        uint16_t client_port)
+{
+    nu::autoCs_t acs = tftp_mcast_cs;
+
+    tftp_mcast_client_t* c = tftp_mcast_find(group, client_addr, client_port);
+
+    if (c)
+        c->state = TFTP_MCAST_DONE;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool tftp_mcast_is_member(
+        tftp_mcast_group_t* group,
+        uint32_t client_addr,
+        uint16_t client_port)
+{
+    nu::autoCs_t acs = tftp_mcast_cs;
+
+    return tftp_mcast_find(group, client_addr, client_port) != 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool tftp_mcast_close(tftp_mcast_group_t* group, bool force)
+{
+    nu::autoCs_t acs = tftp_mcast_cs;
+
+    if (!force) {
+        for (int i = 0; i < TFTP_MCAST_MAX_CLIENTS; ++i) {
+            tftp_mcast_client_state_t state = group->clients[i].state;
+
+            if (state == TFTP_MCAST_JOINING || state == TFTP_MCAST_WAITING)
+                return false;
+        }
+    }
+
+    group->used = false;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
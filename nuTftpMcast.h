@@ -0,0 +1,168 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_TFTP_MCAST_H__
+#define __NU_TFTP_MCAST_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include "nuTftpUtil.h"
+
+
+/* -------------------------------------------------------------------------- */
+
+/*
+   Multicast TFTP (RFC 2090)
+
+   The first client asking for a file with the "multicast" option opens
+   a group and becomes its master client. Every other client asking for
+   the same file while the group is open joins it: the session serving
+   the group sends it an OACK and, from then on, the client listens to
+   the blocks sent to the multicast address.
+   Only the master client acknowledges the blocks. When it is done (or it
+   stops answering), the session elects another client as master, and
+   that client ACKs the last block it received in sequence: the
+   transmission restarts from there, so late joiners catch up.
+*/
+
+
+/* -------------------------------------------------------------------------- */
+
+#define TFTP_MCAST_MAX_GROUPS  16
+#define TFTP_MCAST_MAX_CLIENTS 64
+
+typedef enum _tftp_mcast_client_state_t {
+    TFTP_MCAST_FREE,
+    TFTP_MCAST_JOINING,  //!< OACK to be sent
+    TFTP_MCAST_WAITING,  //!< listening to the group, not master
+    TFTP_MCAST_MASTER,
+    TFTP_MCAST_DONE      //!< completed (or dropped)
+} tftp_mcast_client_state_t;
+
+typedef struct _tftp_mcast_client_t {
+    uint32_t addr;
+    uint16_t port;
+    tftp_mcast_client_state_t state;
+}
+tftp_mcast_client_t;
+
+typedef struct _tftp_mcast_group_t {
+    const void* owner;   //!< server the group belongs to
+    bool used;
+    char filename[TFTP_MAX_FILENAME_SIZE];
+    uint32_t addr;       //!< multicast address (host byte order)
+    uint16_t port;
+    tftp_mcast_client_t clients[TFTP_MCAST_MAX_CLIENTS];
+}
+tftp_mcast_group_t;
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Opens a new group for a file, the client becomes the master
+ *
+ * @param owner: [in] server opening the group
+ * @param filename: [in] file requested
+ * @param addr: [in] multicast address of the first group (host byte order)
+ * @param port: [in] multicast port
+ * @param client_addr: [in] address of the master client
+ * @param client_port: [in] port of the master client
+ * @return tftp_mcast_group_t*: 0 if no group is available.
+ *         The actual address of the group is base address + group index
+ */
+tftp_mcast_group_t* tftp_mcast_open(
+        const void* owner,
+        const char* filename,
+        uint32_t addr,
+        uint16_t port,
+        uint32_t client_addr,
+        uint16_t client_port);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Adds a client to the group open for a file
+ * A client already in the group is scheduled for a new OACK (one which
+ * completed the file joins again), unless it is the master
+ *
+ * @return bool: false if no group is open for the file (or it is full,
+ *               or the client is its master): the request is to be
+ *               served by a session of its own
+ */
+bool tftp_mcast_join(
+        const void* owner,
+        const char* filename,
+        uint32_t client_addr,
+        uint16_t client_port);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Gets the next client waiting for its OACK (it is moved to WAITING)
+ * @return bool: false if there are no joining clients
+ */
+bool tftp_mcast_next_joining(
+        tftp_mcast_group_t* group,
+        uint32_t* client_addr,
+        uint16_t* client_port);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Picks the next master client among the joining/waiting ones
+ * @return bool: false if there is no candidate
+ */
+bool tftp_mcast_next_master(
+        tftp_mcast_group_t* group,
+        uint32_t* client_addr,
+        uint16_t* client_port);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Marks a client as completed (or dropped)
+ */
+void tftp_mcast_client_done(
+        tftp_mcast_group_t* group,
+        uint32_t client_addr,
+        uint16_t client_port);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Returns true if the client is a member of the group
+ */
+bool tftp_mcast_is_member(
+        tftp_mcast_group_t* group,
+        uint32_t client_addr,
+        uint16_t client_port);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Closes a group
+ * @return bool: false if the group still has clients to serve
+ *               (it is not closed in such case)
+ */
+bool tftp_mcast_close(tftp_mcast_group_t* group, bool force);
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_TFTP_MCAST_H__ */
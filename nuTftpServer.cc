@@ -17,14 +17,37 @@ using namespace std;
 
 #include "nuTftpServer.h"
 #include "nuCriticalSection.h"
+#include "nuFileCache.h"
+#include "nuBlockPool.h"
+#include "nuTftpMcast.h"
+#include "nuSockPool.h"
+#include "nuDemux.h"
+#include "nuArena.h"
+#include "nuRing.h"
+#include "nuCoro.h"
+#include "nuAdmission.h"
+#include "nuTokenBucket.h"
+#include "nuEventLog.h"
+#include "nuMetrics.h"
+#include "nuAccessLog.h"
+#include "nuSeqlock.h"
+#include "nuProbe.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
 #include <signal.h>
 #include <errno.h>
 #include <stdint.h>
+#include <poll.h>
+#include <atomic>
 
 
 /* -------------------------------------------------------------------------- */
 
-#define MAX_FRAME_SIZE 1500
+//!Size of the packet buffers of the sessions: the largest packet 
+//!a session receives is a DATA (516 bytes), a request fits as well
+#define TFTP_FRAME_SIZE 576
+
+#define TFTP_SESSION_TABLE_SIZE (TFTP_MAX_CONNECTION << 1)
 
 #define PATH_SEPARATOR_CHAR '/'
 
@@ -53,8 +76,11 @@ extern const char tftp_error_codes[8][64];
 /* -------------------------------------------------------------------------- */
 
 // Active connections list management functions
+// Held for a few loads and stores by the listener and the workers:
+// contenders spin rather than sleep
 static
-nu::critical_section active_connection_list_cs = "active_connection_list";
+nu::critical_section active_connection_list_cs(
+        "active_connection_list", nu::critical_section::MU_ADAPTIVE);
 
 static void active_connection_list__delete(int index);
 static void active_connection_list__invalidate();
@@ -65,6 +91,28 @@ static void active_connection_list__show();
 /* -------------------------------------------------------------------------- */
 // TFTPD IPC's functions
 
+struct tftp_worker_t;
+
+// A rule giving a weight to the transfers of a client subnet
+// or to the transfers of a file class (by extension)
+typedef struct _tftp_weight_rule_t
+{
+    uint32_t addr;
+    uint32_t mask;
+    char ext[16]; //!< empty for a subnet rule
+    unsigned weight;
+}
+tftp_weight_rule_t;
+
+// The egress rate limit of a client subnet
+typedef struct _tftp_rate_rule_t
+{
+    uint32_t addr;
+    uint32_t mask;
+    uint64_t rate;
+}
+tftp_rate_rule_t;
+
 // tftp_start_server function creates and
 // passes an instance of the following structure to
 // the tftp_server thread
@@ -82,6 +130,27 @@ typedef struct _IPC_thread_param
     bool stop_cmd_issued;
     int last_err_code;
     int tid;
+    nu::file_cache* r_cache; //!< metadata cache of r_path (0 if unavailable)
+    nu::block_pool* block_pool; //!< blocks shared by the RRQ sessions
+    nu::sock_pool* sock_pool; //!< pre-bound sockets for new sessions
+    nu::demux* demux; //!< sockets shared by the sessions (0 if disabled)
+    nu::buffer_arena* arena; //!< packet buffers of the sessions
+    nu::admission_queue* admission; //!< slots of the sessions, requests waiting
+    tftp_worker_t* workers; //!< workers running the sessions
+    int worker_count;
+    unsigned next_worker; //!< where the listener starts looking for a worker
+    unsigned rejected_requests; //!< requests refused or dropped
+    tftp_weight_rule_t weight_rules[TFTP_SCHED_MAX_RULES];
+    int weight_rule_count;
+    tftp_rate_rule_t rate_rules[TFTP_SCHED_MAX_RULES];
+    int rate_rule_count;
+    nu::token_bucket* rate_buckets; //!< the server one, then one per rule
+    nu::event_log* events; //!< binary log of the events (0 if disabled)
+    uint32_t last_session_id; //!< (listener thread)
+    nu::metrics* metrics; //!< shard 0: listener, shard i+1: worker i
+    nu::metrics_endpoint* metrics_endpoint; //!< (0 if disabled)
+    nu::access_log* access; //!< a record per transfer (0 if disabled)
+    tftp_server_options_t options;
 
 }
 IPC_thread_param;
@@ -97,28 +166,156 @@ static void tftpd_free_ipc(IPC_thread_param* ipc);
 
 // Thread functions prototypes
 void* tftp_server(TFTP_THREAD_PARAM_T arg);
-void* tftp_RRQ_session_thread(TFTP_THREAD_PARAM_T arg);
-void* tftp_WRQ_session_thread(TFTP_THREAD_PARAM_T arg);
 
+// State of a session published by its worker for tftp_get_sessions
+// (info.session_id is 0 while the slot is free)
+typedef struct _tftp_session_status_t
+{
+    tftp_session_info_t info; //!< but age_ms and idle_ms
+    uint64_t started_ms;
+    uint64_t active_ms;
+}
+tftp_session_status_t;
+
+typedef nu::seqlock<tftp_session_status_t> tftp_session_slot_t;
+
+// Kept compact: paths are read from the server, and the packet buffer
+// comes from the arena of the server
 typedef struct _tftp_session_param
 {
-    char r_path[PATH_MAX];
-    char w_path[PATH_MAX];
     uint32_t fromAddr = 0;
     uint16_t fromPort = 0;
-    char frame[MAX_FRAME_SIZE];
     uint16_t frame_size = 0;
+    char* frame = 0; //!< the request, then the packets received
 
     IPC_thread_param* server_ipc = 0;
     int session_index = 0;
     bool used = false;
+
+    uint32_t session_id = 0;  //!< of the events logged
+    int err_code = TFTP_ERROR__SUCCESS; //!< error ending the session
+    uint64_t started_ms = 0;
+
+    // Latencies (us)
+    uint64_t received_us = 0; //!< the request, 0 once the first DATA is sent
+    uint64_t started_us = 0;
+    uint64_t sent_us = 0;     //!< the last packet answered, 0 if sent again
+    uint64_t bytes = 0;       //!< of the file, transferred so far
+
+    uint32_t retransmits = 0;
+    uint32_t timeouts = 0;
+    uint32_t srtt_us = 0;
+
+    tftp_session_slot_t* slot = 0; //!< its state, in its worker
 }
 tftp_session_param;
 
+// Sessions are coroutines, suspended on the event loop of their worker
+// while waiting for a packet
+nu::task<> tftp_RRQ_session(tftp_session_param* session_param, nu::event_loop* loop);
+nu::task<> tftp_WRQ_session(tftp_session_param* session_param, nu::event_loop* loop);
+
+
+/* -------------------------------------------------------------------------- */
+
+// A request handed by the listener to a worker
+typedef struct _tftp_session_desc_t
+{
+    tftp_session_param* param; //!< 0 stops the worker
+    tftp_opcode_t opcode;
+}
+tftp_session_desc_t;
+
+// Session workers: each one runs the requests queued in its ring on its 
+// event loop, up to options.worker_sessions at a time
+struct tftp_worker_t
+{
+    nu::mpsc_ring<tftp_session_desc_t> ring { TFTP_WORKER_QUEUE_SIZE };
+    nu::event_loop loop;           //!< notified for each request queued
+    nu::fair_queue sends { TFTP_SCHED_BATCH }; //!< DATA of the sessions
+    std::atomic<int> load { 0 };   //!< requests queued or running
+    tftp_session_slot_t* slots = 0; //!< one per session run at a time
+    IPC_thread_param* ipc = 0;
+    unsigned long tid = 0;
+
+    ~tftp_worker_t() { delete [] slots; }
+};
+
+static void* tftp_worker_thread(void* arg);
+static bool tftp_start_workers(IPC_thread_param* ipc);
+static void tftp_stop_workers(IPC_thread_param* ipc);
+static bool tftp_dispatch(IPC_thread_param* ipc, const tftp_session_desc_t& desc);
+
+static bool tftp_start_session(IPC_thread_param* ipc, uint32_t fromAddr, uint16_t fromPort,
+        tftp_opcode_t opcode, const char* request, int request_size, uint64_t received_us);
+static void tftp_admit_request(IPC_thread_param* ipc, uint32_t fromAddr, uint16_t fromPort,
+        tftp_opcode_t opcode, const char* request, int request_size);
+static void tftp_admit_queued(IPC_thread_param* ipc);
+
+static int tftp_parse_weights(const char* rules, tftp_weight_rule_t* table, int size);
+static unsigned tftp_get_weight(IPC_thread_param* ipc, uint32_t addr, const char* filename);
+
+static bool tftp_parse_subnet(const std::string& subnet, uint32_t* addr, uint32_t* mask);
+static bool tftp_parse_rate(const std::string& value, uint64_t* rate);
+static int tftp_parse_rates(const char* rules, tftp_rate_rule_t* table, int size);
+static void tftp_start_rate_limits(IPC_thread_param* ipc);
+
+// Rate limits a session is subject to
+struct tftp_pacing_t {
+    nu::token_bucket* server;
+    nu::token_bucket* subnet;
+};
+
+static void tftp_get_pacing(IPC_thread_param* ipc, uint32_t addr, tftp_pacing_t* pacing);
+static uint64_t tftp_pace(const tftp_pacing_t* pacing, size_t bytes);
+
+static void tftp_event(tftp_session_param* session_param, unsigned type,
+        uint32_t arg1, uint64_t arg2);
+static void tftp_session_failed(tftp_session_param* session_param, int err_code);
+static void tftp_session_end(tftp_session_param* session_param, tftp_opcode_t opcode,
+        const char* filename);
+static void tftp_session_publish(tftp_session_param* session_param, unsigned type, 
+        uint32_t arg1);
+static void tftp_session_file(tftp_session_param* session_param, const char* filename,
+        uint64_t size);
+static size_t tftp_session_frames_size();
+
+// Metrics of the server, registered in this order
+enum tftp_metric_t {
+    TFTP_METRIC_RRQ,
+    TFTP_METRIC_WRQ,
+    TFTP_METRIC_REJECTED,
+    TFTP_METRIC_BYTES_SENT,
+    TFTP_METRIC_BYTES_RECEIVED,
+    TFTP_METRIC_RETRANSMITS,
+    TFTP_METRIC_TIMEOUTS,
+    TFTP_METRIC_ERRORS, //!< one per error code
+    TFTP_METRIC_CACHE_HITS = TFTP_METRIC_ERRORS + 8,
+    TFTP_METRIC_CACHE_MISSES,
+    TFTP_METRIC_SESSIONS_ACTIVE,
+    TFTP_METRIC_QUEUE_DEPTH,
+    TFTP_METRIC_COUNT
+};
+
+// Latency histograms of the server, registered in this order
+enum tftp_histogram_t {
+    TFTP_HISTOGRAM_ADMISSION_WAIT,
+    TFTP_HISTOGRAM_FIRST_DATA,
+    TFTP_HISTOGRAM_BLOCK_RTT,
+    TFTP_HISTOGRAM_TRANSFER, //!< one per class of file size
+    TFTP_HISTOGRAM_COUNT = TFTP_HISTOGRAM_TRANSFER + 4
+};
+
+static void tftp_start_metrics(IPC_thread_param* ipc);
+static void tftp_metric_add(IPC_thread_param* ipc, int id, int64_t delta);
+static void tftp_metric_set(IPC_thread_param* ipc, int id, int64_t value);
+static void tftp_metric_record(IPC_thread_param* ipc, int id, uint64_t from_us, uint64_t to_us);
+static void tftp_time_event(tftp_session_param* session_param, unsigned type);
+
 
 /* -------------------------------------------------------------------------- */
 
-tftp_session_param tftp_session_param_table[TFTP_MAX_CONNECTION << 1];
+tftp_session_param tftp_session_param_table[TFTP_SESSION_TABLE_SIZE];
 
 
 /* -------------------------------------------------------------------------- */
@@ -159,13 +356,22 @@ int t_start(
         unsigned long& tid,
         void* thread_proc,
         unsigned long targs[],
-        bool detach = true)
+        bool detach = true,
+        size_t stack_size = 0)
 {
     // Create and start the thread
     pthread_t my_tid;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+
+    if (stack_size)
+        pthread_attr_setstacksize(&attr, stack_size);
 
     int result = 
-        pthread_create(&my_tid, NULL, (void*(*)(void*)) thread_proc, (void*)targs[0]);
+        pthread_create(&my_tid, &attr, (void*(*)(void*)) thread_proc, (void*)targs[0]);
+
+    pthread_attr_destroy(&attr);
 
     if (result != 0) 
     {
@@ -188,6 +394,32 @@ int t_start(
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+void tftp_get_default_options(tftp_server_options_t* options)
+{
+    memset(options, 0, sizeof(tftp_server_options_t));
+
+    options->multicast = false;
+    strncpy(options->mcast_addr, TFTP_MCAST_ADDR, sizeof(options->mcast_addr) - 1);
+    options->mcast_port = TFTP_MCAST_PORT;
+    strncpy(options->mcast_if, "0.0.0.0", sizeof(options->mcast_if) - 1);
+    options->mcast_ttl = TFTP_MCAST_TTL;
+    options->sock_pool_size = TFTP_SOCK_POOL_SIZE;
+    options->sock_sndbuf = TFTP_SOCK_SNDBUF;
+    options->sock_rcvbuf = TFTP_SOCK_RCVBUF;
+    options->demux_sockets = 0;
+    options->strict_tid = false;
+    options->hugepages = false;
+    options->worker_sessions = TFTP_WORKER_SESSIONS;
+    options->admission_queue = TFTP_ADMISSION_QUEUE_SIZE;
+    options->admission_budget = TFTP_ADMISSION_BUDGET;
+    options->event_log_size = TFTP_EVENT_LOG_SIZE;
+    options->metrics_port = 0;
+    options->lock_stats = false;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 TFTPD_HANDLE tftp_start_server(
@@ -197,6 +429,22 @@ TFTPD_HANDLE tftp_start_server(
         const char* w_path,
         unsigned short port_of_service,
         int traceLevel)
+{
+    return tftp_start_server_ex(task_prio, max_sessions, r_path, w_path, 
+            port_of_service, traceLevel, 0);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+TFTPD_HANDLE tftp_start_server_ex(
+        int task_prio,
+        int max_sessions,
+        const char* r_path,
+        const char* w_path,
+        unsigned short port_of_service,
+        int traceLevel,
+        const tftp_server_options_t* options)
 {
     unsigned long targs[4] = { 0 };
     unsigned long tid = 0;
@@ -235,8 +483,117 @@ TFTPD_HANDLE tftp_start_server(
     ipc->port_of_service = port_of_service;
     ipc->last_err_code = TFTP_ERROR__SUCCESS;
 
-    targs[0] = (unsigned long)ipc;
-    err_code = t_start(/*in/out*/ tid, (void*)tftp_server, targs, false);
+    if (options)
+        ipc->options = *options;
+    else
+        tftp_get_default_options(&ipc->options);
+
+    ipc->weight_rule_count = tftp_parse_weights(ipc->options.sched_weights,
+            ipc->weight_rules, TFTP_SCHED_MAX_RULES);
+
+    tftp_start_rate_limits(ipc);
+
+    // Metadata cache of r_path: if it cannot be started, sessions
+    // fall back to resolve the files by themselves
+    ipc->r_cache = new nu::file_cache(r_path);
+
+    if (!ipc->r_cache->start()) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                "tftp_start_server: metadata cache of %s disabled", r_path);
+
+        delete ipc->r_cache;
+        ipc->r_cache = 0;
+    }
+
+    ipc->block_pool = new nu::block_pool();
+
+    // One packet buffer per session
+    ipc->arena = new nu::buffer_arena(
+            TFTP_FRAME_SIZE, TFTP_SESSION_TABLE_SIZE, ipc->options.hugepages);
+
+    // Sockets of the sessions are created and bound in background
+    ipc->sock_pool = new nu::sock_pool(
+            ipc->options.sock_pool_size,
+            ipc->options.sock_sndbuf,
+            ipc->options.sock_rcvbuf);
+
+    if (!ipc->sock_pool->start()) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                "tftp_start_server: socket pool not replenished");
+    }
+
+    // In demux mode the sessions share a few sockets, the traffic is
+    // routed to each of them in user space
+    if (ipc->options.demux_sockets > 0) {
+        ipc->demux = new nu::demux(ipc->options.demux_sockets, TFTP_FRAME_SIZE);
+
+        if (!ipc->demux->start()) {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_start_server: demux mode disabled");
+
+            delete ipc->demux;
+            ipc->demux = 0;
+        }
+    }
+
+    // Events of the sessions, for the post-mortem analysis
+    if (ipc->options.event_log[0]) {
+        ipc->events = new nu::event_log(ipc->options.event_log,
+                uint64_t(ipc->options.event_log_size) << 20,
+                TFTP_EVENT_LOG_FILES);
+
+        if (!ipc->events->start()) {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_start_server: event log %s not available",
+                    ipc->options.event_log);
+
+            delete ipc->events;
+            ipc->events = 0;
+        }
+    }
+
+    // A record per transfer
+    if (ipc->options.access_log[0]) {
+        ipc->access = new nu::access_log(ipc->options.access_log);
+
+        if (!ipc->access->start()) {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_start_server: access log %s not available",
+                    ipc->options.access_log);
+
+            delete ipc->access;
+            ipc->access = 0;
+        }
+    }
+
+    // Requests beyond max_sessions wait for a slot in the admission queue
+    ipc->admission = new nu::admission_queue(max_sessions,
+            ipc->options.admission_queue,
+            TFTP_FRAME_SIZE,
+            ipc->options.admission_budget);
+
+    // Sessions are run by a fixed pool of workers, one per session
+    // allowed to run concurrently
+    if (!ipc->admission->valid()) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "tftp_start_server: admission queue not available");
+
+        err_code = EAGAIN;
+    }
+    else if (!tftp_start_workers(ipc)) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "tftp_start_server: no session worker started");
+
+        err_code = EAGAIN;
+    }
+    else {
+        // Before the listener: no session runs yet
+        tftp_start_metrics(ipc);
+
+        targs[0] = (unsigned long)ipc;
+        err_code = t_start(/*in/out*/ tid, (void*)tftp_server, targs, false);
+    }
+
     ipc->tid = tid;
 
     if (err_code != CALL_SUCCESS) {
@@ -245,6 +602,18 @@ TFTPD_HANDLE tftp_start_server(
                 int(err_code), int(__LINE__), errno);
 
         nu_free_sock(tftpd);
+        tftp_stop_workers(ipc);
+        delete ipc->r_cache;
+        delete ipc->block_pool;
+        delete ipc->sock_pool;
+        delete ipc->demux;
+        delete ipc->arena;
+        delete ipc->admission;
+        delete [] ipc->rate_buckets;
+        delete ipc->events;
+        delete ipc->metrics_endpoint;
+        delete ipc->metrics;
+        delete ipc->access;
         tftpd_free_ipc(ipc);
 
         return 0; // error, no ipc
@@ -263,6 +632,7 @@ void tftp_stop_server(TFTPD_HANDLE handle)
     // Force tftp server to exit by while loop
     ipc->stop_cmd_issued = true;
     close(ipc->tftpd);
+    ipc->admission->notify();
 }
 
 
@@ -302,20 +672,90 @@ int tftp_get_last_server_error_code(TFTPD_HANDLE handle)
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+unsigned int tftp_get_rejected_requests_count(TFTPD_HANDLE handle)
+{
+    IPC_thread_param* ipc = (IPC_thread_param*)handle;
+    return ipc->rejected_requests;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+size_t tftp_get_session_footprint(TFTPD_HANDLE handle)
+{
+    IPC_thread_param* ipc = (IPC_thread_param*)handle;
+    size_t bytes = sizeof(tftp_session_param) + sizeof(tftp_session_slot_t) +
+        ipc->arena->buffer_size() + tftp_session_frames_size();
+
+    //In demux mode its datagrams are queued in its channel
+    if (ipc->demux)
+        bytes += ipc->demux->channel_size();
+
+    return bytes;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int tftp_get_sessions(TFTPD_HANDLE handle, tftp_session_info_t* sessions, int max)
+{
+    IPC_thread_param* ipc = (IPC_thread_param*)handle;
+    tftp_session_status_t status;
+    uint64_t now = nu_coarse_ms();
+    int count = 0;
+
+    for (int w = 0; w < ipc->worker_count; ++w) {
+        tftp_worker_t* worker = &ipc->workers[w];
+
+        for (int i = 0; i < ipc->options.worker_sessions && count < max; ++i) {
+            worker->slots[i].read(&status);
+
+            if (!status.info.session_id)
+                continue;
+
+            sessions[count] = status.info;
+            sessions[count].age_ms = uint32_t(now - status.started_ms);
+            sessions[count].idle_ms = now > status.active_ms ? 
+                uint32_t(now - status.active_ms) : 0;
+
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int tftp_get_metrics(TFTPD_HANDLE handle, char* buf, int size)
+{
+    IPC_thread_param* ipc = (IPC_thread_param*)handle;
+    string text = ipc->metrics ? ipc->metrics->exposition() : string();
+
+    if (size > 0) {
+        int len = int(text.size()) < size ? int(text.size()) : size - 1;
+        memcpy(buf, text.data(), len);
+        buf[len] = 0;
+    }
+
+    return int(text.size());
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 void* tftp_server(TFTP_THREAD_PARAM_T arg)
 {
     IPC_thread_param* ipc;
     int recv_size = 0;
-    char buf[TFTP_MAX_BUFFER_SIZE];
+    char buf[TFTP_FRAME_SIZE];
     uint32_t fromAddr;
     uint16_t fromPort;
-    tftp_session_param* session_param;
+    tftp_request_view_t request;
     tftp_opcode_t opcode;
-    unsigned long targs[4] = { 0 };
-    unsigned long tid = 0;
-    unsigned long err_code;
     int index = 0;
 
     ipc = (IPC_thread_param*)arg;
@@ -337,9 +777,36 @@ void* tftp_server(TFTP_THREAD_PARAM_T arg)
                 "tftp_server bind failed");
     }
     else while (true) {
+        //While requests are waiting, wake up now and then to refuse
+        //those waiting beyond the latency budget
+        struct pollfd pfds[2];
+        pfds[0].fd = ipc->tftpd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = ipc->admission->wakeup_fd();
+        pfds[1].events = POLLIN;
+
+        int nd = poll(pfds, 2, 
+                ipc->admission->empty() ? -1 : TFTP_ADMISSION_SWEEP_PERIOD);
+
+        if (ipc->stop_cmd_issued || (nd < 0 && errno != EINTR)) {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                    "tftp_server poll fails: disconnetting...");
+
+            break; // disconnect
+        }
+
+        if (nd > 0 && (pfds[1].revents & POLLIN))
+            ipc->admission->clear_wakeup();
+
+        //Slots freed up go to the requests waiting first
+        tftp_admit_queued(ipc);
+
+        if (nd <= 0 || !(pfds[0].revents & POLLIN))
+            continue;
+
         recv_size = nu_recvfrom(ipc->tftpd,
                 buf,
-                TFTP_MAX_BUFFER_SIZE,
+                TFTP_FRAME_SIZE,
                 0,   // flags
                 &fromAddr,
                 &fromPort);
@@ -352,6 +819,23 @@ void* tftp_server(TFTP_THREAD_PARAM_T arg)
         }
 
 
+        opcode = tftp_parse_opcode(buf, recv_size);
+
+        // A multicast request of a file already being sent joins the
+        // group of the session sending it (RFC 2090): the client may be
+        // the one which opened it, if it completed the file already
+        if (opcode == TFTP_RRQ && ipc->options.multicast &&
+                tftp_view_RQ_packet(&request, buf, recv_size) &&
+                (request.options & TFTP_OPTION_MULTICAST) &&
+                tftp_mcast_join(ipc, request.filename.data(), fromAddr, fromPort))
+        {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+                    "tftp_server: %x-%i joins multicast %s", 
+                    fromAddr, fromPort, request.filename.data());
+
+            continue;
+        }
+
         if ((index = active_connection_list__search_for(fromAddr, fromPort)) >= 0) {
             //Port already present
             NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
@@ -365,45 +849,8 @@ void* tftp_server(TFTP_THREAD_PARAM_T arg)
             continue;
         }
 
-        opcode = tftp_parse_opcode(buf, recv_size);
-
         if ((opcode == TFTP_RRQ) || (opcode == TFTP_WRQ)) {
-            index = active_connection_list__insert(fromAddr, fromPort);
-
-            if (index < 0 || ipc->opened_sessions >= ipc->max_sessions) {
-                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                        "tftp_server request ignore, max worker count reached (%i)",
-                        ipc->opened_sessions);
-
-                continue;
-            }
-
-            session_param = release_session_param();
-            memset(session_param, 0, sizeof(tftp_session_param));
-            session_param->fromAddr = fromAddr;
-            session_param->fromPort = fromPort;
-            strcpy(session_param->w_path, ipc->w_path);
-            strcpy(session_param->r_path, ipc->r_path);
-            memcpy(session_param->frame, buf, recv_size);
-            session_param->frame_size = recv_size;
-            targs[0] = (unsigned long)session_param;
-            session_param->server_ipc = ipc;
-            session_param->session_index = index;
-
-            err_code = t_start(tid,
-                    (void*)(opcode == TFTP_RRQ ?
-                        tftp_RRQ_session_thread :
-                        tftp_WRQ_session_thread),
-                    targs);
-
-            if (err_code != CALL_SUCCESS) {
-                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                        "tftp_server::t_start = 0x%x line=%i", err_code, __LINE__);
-
-                free_session(session_param);
-
-                active_connection_list__delete(index);
-            }
+            tftp_admit_request(ipc, fromAddr, fromPort, opcode, buf, recv_size);
         }
     }
 
@@ -416,6 +863,28 @@ void* tftp_server(TFTP_THREAD_PARAM_T arg)
     nu_free_sock(ipc->tftpd);
     ipc->tftpd = 0;
     ipc->tftp_server_running = false;
+    tftp_stop_workers(ipc);
+    delete ipc->r_cache;
+    delete ipc->block_pool;
+    delete ipc->sock_pool;
+    delete ipc->demux;
+    delete ipc->arena;
+    delete ipc->admission;
+    delete [] ipc->rate_buckets;
+
+    if (ipc->events) {
+        ipc->events->stop();
+
+        if (ipc->events->dropped()) {
+            NU_TRACE_INF("[TFTP]", "event_log: %lu events dropped", 
+                    ipc->events->dropped());
+        }
+    }
+
+    delete ipc->events;
+    delete ipc->metrics_endpoint;
+    delete ipc->metrics;
+    delete ipc->access;
     tftpd_free_ipc(ipc);
 
     exit(0);
@@ -426,515 +895,2186 @@ void* tftp_server(TFTP_THREAD_PARAM_T arg)
 
 /* -------------------------------------------------------------------------- */
 
-void* tftp_RRQ_session_thread(TFTP_THREAD_PARAM_T arg)
+// Gets the socket of a new session: in demux mode a shared socket and
+// the channel delivering the datagrams of the client, else (or if the
+// session needs a socket of its own) a socket from the pool
+static int tftp_session_open(
+        tftp_session_param* session_param,
+        bool dedicated,
+        nu::demux::channel_t** channel)
 {
-    tftp_request_t tftp_request;
-    tftp_data_t tftp_data;
-    tftp_ack_t tftp_ack;
-
-    int reading_sector_size = 0;
-    int tftpd_session = -1;
-    uint16_t last_ack_block = 0;
-    FILE* file = 0;
-    char file_path[PATH_MAX + 1] = { 0 };
-    int sector_size = 0;
-    char frame[MAX_FRAME_SIZE] = { 0 };
-    uint16_t block_index = 0;
+    IPC_thread_param* ipc = session_param->server_ipc;
+    uint16_t bindPort = 0;
+    int sd = -1;
 
-    //Get session parameters
-    tftp_session_param* session_param = (tftp_session_param*)arg;
+    *channel = 0;
 
-    try {
+    if (ipc->demux && !dedicated) {
+        *channel = ipc->demux->open(
+                session_param->fromAddr, session_param->fromPort, &sd);
 
-        //Increment the session number
-        session_param->server_ipc->opened_sessions++;
+        if (*channel)
+            return sd;
+    }
 
-        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
-                "tftp_RRQ_session_thread+ (sessions = %i)",
-                session_param->server_ipc->opened_sessions);
+    return ipc->sock_pool->checkout(&bindPort);
+}
 
-        //Create a new socket for this task
-        tftpd_session = nu_create();
 
-        //Obtain an unused port number and bind it to the socket
-        uint16_t bindPort = 0;
-        nu_bind_and_getprt(tftpd_session, &bindPort);
+/* -------------------------------------------------------------------------- */
 
-        //Parse the RRQ packet
-        if (tftp_parse_RQ_packet(
-                    &tftp_request, 
-                    session_param->frame, 
-                    session_param->frame_size)) 
-        {
-            //We are able to transmit only binary files
-            if (tftp_request.fmode != OCTET && tftp_request.fmode != NETASCII) {
-                tftp_send_ERROR(tftpd_session,
-                        session_param->fromAddr,
-                        session_param->fromPort,
-                        TFTP_ERROR__ILLEGAL_OPERATION);
+static void tftp_session_close(
+        tftp_session_param* session_param,
+        int sd,
+        nu::demux::channel_t* channel,
+        bool reuse)
+{
+    if (channel)
+        session_param->server_ipc->demux->close(channel);
+    else
+        session_param->server_ipc->sock_pool->checkin(sd, reuse);
+}
 
-                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                        "%s TFTP_ERROR__ILLEGAL_OPERATION errno=%d", file_path, errno);
 
-                session_param->server_ipc->last_err_code = TFTP_ERROR__ILLEGAL_OPERATION;
+/* -------------------------------------------------------------------------- */
 
-                throw 0;
-            }
+// Receives the next packet of a session, from its demux channel (the
+// timeout is run by the timer wheel of the demux), from its connected 
+// socket or from a peer of its socket. A packet of another peer is
+// ignored (answered with an UNKNOWN_TRANSFER_ID error, if foreign is
+// set) and the wait goes on. The session is suspended on its event 
+// loop meanwhile
+static nu::task<int> tftp_session_recv(
+        tftp_session_param* session_param,
+        nu::event_loop* loop,
+        int sd,
+        nu::demux::channel_t* channel,
+        bool connected,
+        char* frame,
+        uint32_t* fromAddr,
+        uint16_t* fromPort,
+        struct timeval* timeout,
+        bool foreign = false)
+{
+    if (channel) {
+        int size = co_await session_param->server_ipc->demux->recv(channel,
+                frame, TFTP_FRAME_SIZE,
+                timeout, loop);
 
-            //Compose complete path of the file requested
-            strncpy(file_path, session_param->r_path, PATH_MAX);
-            int path_len = strlen(file_path);
+        co_return size;
+    }
 
-            char separator[2] = { PATH_SEPARATOR_CHAR };
-            if (path_len > 0 && file_path[path_len] != PATH_SEPARATOR_CHAR)
-                strcat(file_path, separator);
+    uint64_t deadline_us = nu_clock_us() +
+        uint64_t(timeout->tv_sec) * 1000000 + uint64_t(timeout->tv_usec);
 
-            strcat(file_path, tftp_request.filename);
+    while (true) {
+        uint32_t addr = 0;
+        uint16_t port = 0;
+        int size = connected ?
+            int(recv(sd, frame, TFTP_FRAME_SIZE, MSG_DONTWAIT)) :
+            nu_recvfrom(sd, frame, TFTP_FRAME_SIZE, MSG_DONTWAIT, &addr, &port);
 
-            //Try to open the file
-            file = fopen(file_path, "rb");
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            uint64_t now_us = nu_clock_us();
 
-            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
-                    "tftp_RRQ_session_thread: (uploading %s)", file_path);
+            if (now_us >= deadline_us)
+                co_return 0; // timeout
 
-            if (!file) {
-                tftp_send_ERROR(tftpd_session,
-                        session_param->fromAddr,
-                        session_param->fromPort,
-                        TFTP_ERROR__FILE_NOT_FOUND);
+            bool readable = co_await loop->readable(sd, 
+                    (deadline_us - now_us + 999) / 1000);
 
-                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                        "%s TFTP_ERROR__FILE_NOT_FOUND errno=%d", file_path, errno);
+            if (!readable)
+                co_return 0; // timeout
 
-                session_param->server_ipc->last_err_code = TFTP_ERROR__FILE_NOT_FOUND;
+            size = connected ?
+                int(recv(sd, frame, TFTP_FRAME_SIZE, MSG_DONTWAIT)) :
+                nu_recvfrom(sd, frame, TFTP_FRAME_SIZE, MSG_DONTWAIT, &addr, &port);
 
-                throw 0;
-            }
+            if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                co_return 0;
+        }
 
-            //Calculate the size of the file
-            int file_size = 0;
+        if (size <= 0 || connected || (addr == 0 && port == 0))
+            co_return size;
 
-            if (fseek(file, 0L, SEEK_END) == 0) { // is it OK ?  
-                //Yes, calculate the size of the file
-                file_size = ftell(file);
-            }
+        if ((addr != *fromAddr && *fromAddr != 0) ||  // 0->ANY_ADDR
+                (port != *fromPort && *fromPort != 0))    // 0->ANY_PORT
+        {
+            //Sent from somewhere else: the transfer is not disturbed
+            if (foreign)
+                tftp_send_ERROR(sd, addr, port, TFTP_ERROR__UNKNOWN_TRANSFER_ID);
 
-            if (file_size < 0) {
-                tftp_send_ERROR(tftpd_session,
-                        session_param->fromAddr,
-                        session_param->fromPort,
-                        TFTP_ERROR__ACCESS_VIOLATION);
+            continue;
+        }
 
-                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                        "%s TFTP_ERROR__ACCESS_VIOLATION errno=%d", file_path, errno);
+        *fromAddr = addr;
+        *fromPort = port;
 
-                session_param->server_ipc->last_err_code = TFTP_ERROR__ACCESS_VIOLATION;
+        co_return size;
+    }
+}
 
-                throw 0;
-            }
 
-            fseek(file, 0, SEEK_SET);
+/* -------------------------------------------------------------------------- */
 
-            //Calculate the count of the blocks to transmit
-            int block_tot = (file_size / TFTP_MAX_BUFFER_SIZE) + 1;
+// Multicast (RFC 2090) session helpers
 
-            //Transmit each block
-            for (int i = 0; i < block_tot; ++i) {
-                // Read a block within the file
-                int last_position = ftell(file);
+// An ACK n of a master client means that blocks 1..n were received,
+// so n is the index of the next block to send. The 16 bits block number
+// is resolved as the nearest index not beyond the current position
+static uint32_t tftp_mcast_resolve_block(uint16_t ack_block, uint32_t position)
+{
+    uint32_t back = (position - ack_block) & 0xFFFF;
+    return back <= position ? position - back : ack_block;
+}
 
-                reading_sector_size = i < (block_tot - 1) ?
-                    TFTP_MAX_BUFFER_SIZE :
-                    file_size % TFTP_MAX_BUFFER_SIZE;
 
-                if (reading_sector_size) {
-                    if (fread(tftp_data.buffer, reading_sector_size, 1, file)) {
-                        sector_size = ftell(file) - last_position;
-                    }
-                    else {
-                        tftp_send_ERROR(tftpd_session,
-                                session_param->fromAddr,
-                                session_param->fromPort,
-                                TFTP_ERROR__ACCESS_VIOLATION);
+/* -------------------------------------------------------------------------- */
 
-                        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                                "%s TFTP_ERROR__ACCESS_VIOLATION 2 errno=%d", file_path, errno);
+static bool tftp_mcast_send_OACK(
+        int sd,
+        tftp_mcast_group_t* group,
+        uint32_t toAddr,
+        uint16_t toPort,
+        bool master)
+{
+    char address[INET_ADDRSTRLEN] = { 0 };
+    char value[64] = { 0 };
+    struct in_addr in;
 
-                        session_param->server_ipc->last_err_code = TFTP_ERROR__ACCESS_VIOLATION;
+    in.s_addr = htonl(group->addr);
+    inet_ntop(AF_INET, &in, address, sizeof(address));
 
-                        throw 0;
-                    }
-                }
-                else {
-                    sector_size = 0; // the size of the file is divisble for TFTP_MAX_BUFFER_SIZE
-                }
+    snprintf(value, sizeof(value), "%s,%u,%i", 
+            address, unsigned(group->port), master ? 1 : 0);
 
-                // Format a tfpt_data packet
-                sector_size = tftp_format_DATA_packet(&tftp_data, ++block_index, 0, sector_size);
+    const char* names[] = { "multicast" };
+    const char* values[] = { value };
 
-                bool packet_acknowledged = false;
-                bool wait_for_valid_ack = false;
+    return tftp_send_OACK(sd, toAddr, toPort, names, values, 1);
+}
 
-                //For a max number of the attemps, try to send the block
-                for (int attempt = 0; attempt < TFTP_RECV_ATTEMPTS; ++attempt) {
-                    // Send the packet
-                    if (!wait_for_valid_ack) {
-                        if (!tftp_send_DATA(tftpd_session,
-                                    session_param->fromAddr,
-                                    session_param->fromPort,
-                                    &tftp_data,
-                                    sector_size))
-                        {
-                            throw 0;
-                        }
-                    }
 
-                    //Wait for an ack message
-                    struct timeval timeout = {0};
-                    timeout.tv_usec = 0;
-                    timeout.tv_sec = TFTP_RECV_TIMEOUT;
+/* -------------------------------------------------------------------------- */
 
-                    int ack_size = nu_recvfrom_timeout(tftpd_session,
-                            frame, MAX_FRAME_SIZE, 0,
-                            &session_param->fromAddr,
-                            &session_param->fromPort,
-                            &timeout);
+static void tftp_mcast_serve_joins(int sd, tftp_mcast_group_t* group)
+{
+    uint32_t addr = 0;
+    uint16_t port = 0;
 
-                    if (ack_size <= 0) {
-                        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                                "tftp_RRQ_session_thread: error or timeout");
+    while (tftp_mcast_next_joining(group, &addr, &port)) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+                "tftp_mcast: %x-%i joins group %x-%i", 
+                addr, port, group->addr, group->port);
 
-                        break;
-                    }
+        tftp_mcast_send_OACK(sd, group, addr, port, false);
+    }
+}
 
-                    //Ack was received, parse and validate it
-                    if (ack_size > 0) {
-                        if (tftp_parse_ACK_packet(&tftp_ack, frame, (uint16_t)ack_size)) {
-                            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_PED,
-                                    "tftp_RRQ_session_thread:ACK %i", tftp_ack.block);
-
-                            if (tftp_ack.block != block_index) {
-                                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                                        "tftp_RRQ_session_thread: bad block %i!=ack block %i",
-                                        block_index,
-                                        tftp_ack.block);
-
-                                // if you receive an ack of a block already acknowledged,
-                                // return to the receive fase
-                                wait_for_valid_ack = tftp_ack.block <= last_ack_block;
-                                continue;
-                            }
-
-                            last_ack_block = tftp_ack.block; // last valid acknowledged packet
-                            packet_acknowledged = true;
-                            break; // no error, break "attempt" loop
-                        }
-                        else {
-                            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                                    "tftp_RRQ_session_thread: ACK sending fails");
 
-                        }
-                    }
-                    else if (ack_size == 0) {
-                        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                                "tftp_RRQ_session_thread: no ACK, last block = %i",
-                                tftp_ack.block);
-                        break; /// TEMP
-                    }
-                    else {
-                        break; // error in the communication
-                    }
-                } // end of "for loop"
+/* -------------------------------------------------------------------------- */
 
-                if (!packet_acknowledged) {
-                    tftp_send_ERROR(tftpd_session,
-                            session_param->fromAddr,
-                            session_param->fromPort,
-                            TFTP_ERROR__NOT_DEFINED);
+// Makes a client the master, and gets from its ACK the next block to send
+static nu::task<bool> tftp_mcast_promote(
+        tftp_session_param* session_param,
+        nu::event_loop* loop,
+        int sd,
+        tftp_mcast_group_t* group,
+        uint32_t addr,
+        uint16_t port,
+        uint32_t* next,
+        char* frame)
+{
+    tftp_ack_t tftp_ack;
 
-                    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                            "%s !packet_acknowledged TFTP_ERROR__NOT_DEFINED errno=%d", 
-                            file_path, errno);
+    for (int attempt = 0; attempt < TFTP_RECV_ATTEMPTS; ++attempt) {
+        if (!tftp_mcast_send_OACK(sd, group, addr, port, true))
+            co_return false;
 
-                    session_param->server_ipc->last_err_code = TFTP_ERROR__NOT_DEFINED;
+        struct timeval timeout = {};
+        timeout.tv_usec = 0;
+        timeout.tv_sec = TFTP_RECV_TIMEOUT;
 
-                    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR, "RRQ operation stopped");
+        uint32_t fromAddr = addr;
+        uint16_t fromPort = port;
 
-                    throw 0;
-                }
+        int ack_size = co_await tftp_session_recv(session_param, loop,
+                sd, 0, false, frame,
+                &fromAddr,
+                &fromPort,
+                &timeout);
 
-            }
+        if (ack_size < 0)
+            co_return false;
 
-        }
-        else {
-            throw 0;
+        if (ack_size > 0 && tftp_parse_ACK_packet(&tftp_ack, frame, (uint16_t)ack_size)) {
+            *next = tftp_mcast_resolve_block(tftp_ack.block, *next);
+            co_return true;
         }
     }
-    catch (int) {
-    }
-
-    //Free all allocated resources
-    active_connection_list__show();
-    active_connection_list__delete(session_param->session_index);
-    active_connection_list__show();
-    nu_free_sock(tftpd_session);
-    session_param->server_ipc->opened_sessions--;
-
-    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
-            "tftp_RRQ_session_thread- (sessions = %i)",
-            session_param->server_ipc->opened_sessions);
-
-    free_session(session_param);
 
-    if (file) 
-        fclose(file);
-
-    return 0;
+    co_return false;
 }
 
 
 /* -------------------------------------------------------------------------- */
 
-void* tftp_WRQ_session_thread(TFTP_THREAD_PARAM_T arg)
+// Elects the next master client of the group.
+// Returns false, closing the group, if all the clients have been served
+static nu::task<bool> tftp_mcast_elect_master(
+        tftp_session_param* session_param,
+        nu::event_loop* loop,
+        int sd,
+        tftp_mcast_group_t* group,
+        uint32_t* addr,
+        uint16_t* port,
+        uint32_t* next,
+        char* frame)
 {
-    tftp_request_t tftp_request;
-    tftp_data_t tftp_data;
-
-    int data_size = 0;
-    int tftpd_session = -1;
-    char file_path[PATH_MAX + 1] = { 0 };
-    char frame[MAX_FRAME_SIZE] = { 0 };
-    bool packet_received = false;
-    bool operation_completed = false;
-    int attempt = 0;
+    while (true) {
+        tftp_mcast_serve_joins(sd, group);
 
-    //Get session parameters
-    tftp_session_param* session_param = (tftp_session_param*)arg;
-    FILE * file = nullptr;
+        if (!tftp_mcast_next_master(group, addr, port)) {
+            if (tftp_mcast_close(group, false))
+                co_return false;
 
-    try {
-        //Increment the session number
-        session_param->server_ipc->opened_sessions++;
+            continue; // someone joined meanwhile
+        }
 
         NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
-                "tftp_WRQ_session_thread+ (sessions = %i)",
-                session_param->server_ipc->opened_sessions);
-
-        //Obtain an unused port number and bind it to the socket
-        tftpd_session = nu_create();
-        uint16_t bindPort = 0;
-        nu_bind_and_getprt(tftpd_session, &bindPort);
-
-        //Parse the WRQ packet
-        if (tftp_parse_RQ_packet(&tftp_request,
-                    session_param->frame,
-                    session_param->frame_size))
-        {
-            //We are able to receive only binary files
-            if (tftp_request.fmode != OCTET && tftp_request.fmode != NETASCII) {
-                tftp_send_ERROR(tftpd_session,
-                        session_param->fromAddr,
-                        session_param->fromPort,
-                        TFTP_ERROR__ILLEGAL_OPERATION);
+                "tftp_mcast: %x-%i is master of group %x-%i", 
+                *addr, *port, group->addr, group->port);
 
-                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                        "%s TFTP_ERROR__ILLEGAL_OPERATION errno=%d", 
-                        file_path, errno);
+        bool promoted = co_await tftp_mcast_promote(session_param, loop,
+                sd, group, *addr, *port, next, frame);
 
-                session_param->server_ipc->last_err_code = 
-                    TFTP_ERROR__ILLEGAL_OPERATION;
+        if (promoted)
+            co_return true;
 
-                throw 0;
-            }
+        tftp_mcast_client_done(group, *addr, *port);
+    }
+}
 
-            //Compose complete path of the file requested
-            strncpy(file_path, session_param->w_path, PATH_MAX);
-            int path_len = strlen(file_path);
 
-            char separator[2] = { PATH_SEPARATOR_CHAR };
-            if (path_len > 0 && file_path[path_len] != PATH_SEPARATOR_CHAR) 
-                strcat(file_path, separator);
+/* -------------------------------------------------------------------------- */
 
-            strcat(file_path, tftp_request.filename);
+// Resources of a session, released once its transfer ended
+typedef struct _tftp_transfer_t
+{
+    int sd = -1;
+    nu::demux::channel_t* channel = 0;
+    FILE* file = 0;
+    const nu::block_pool::block_t* block = 0; //!< RRQ: the one being sent
+    tftp_mcast_group_t* group = 0;            //!< RRQ: still open, if any
+    bool multicast_socket = false;
+    char* file_path = 0; //!< allocated once known, not in the frame
+    char filename[NU_ACCESS_LOG_FILENAME_SIZE] = { 0 };
+}
+tftp_transfer_t;
 
-            //Try to open the file, if file exists, over-write it
-            file = fopen(file_path, "w+b");
 
+/* -------------------------------------------------------------------------- */
+
+// Composes the path of a file requested, under root.
+// Returns a string to be freed with delete[]
+static char* tftp_compose_path(const char* root, const char* filename)
+{
+    size_t root_len = strlen(root);
+    char* path = new char[root_len + strlen(filename) + 2];
+
+    strcpy(path, root);
+
+    if (root_len > 0 && path[root_len - 1] != PATH_SEPARATOR_CHAR) {
+        path[root_len++] = PATH_SEPARATOR_CHAR;
+        path[root_len] = 0;
+    }
+
+    strcpy(path + root_len, filename);
+
+    return path;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Resolves a file requested through the metadata cache.
+// Returns its path (to be freed with delete[]) on LOOKUP_HIT, else 0
+static char* tftp_lookup_path(
+        nu::file_cache* cache,
+        const char* filename,
+        nu::file_meta_t* meta,
+        nu::file_cache::lookup_result_t* cached)
+{
+    char path[PATH_MAX + 1];
+
+    *cached = cache->lookup(filename, meta, path, sizeof(path));
+
+    if (*cached != nu::file_cache::LOOKUP_HIT)
+        return 0;
+
+    char* copy = new char[strlen(path) + 1];
+    strcpy(copy, path);
+
+    return copy;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Sends the file requested.
+// Returns TFTP_ERROR__SUCCESS, or the error ending the session
+static nu::task<int> tftp_RRQ_transfer(
+        tftp_session_param* session_param,
+        nu::event_loop* loop,
+        tftp_transfer_t* transfer)
+{
+    tftp_request_view_t tftp_request;
+    tftp_ack_t tftp_ack;
+
+    int& tftpd_session = transfer->sd;
+    uint16_t last_ack_block = 0;
+    FILE*& file = transfer->file;
+    const nu::block_pool::block_t*& block = transfer->block;
+    tftp_mcast_group_t*& group = transfer->group;
+    nu::demux::channel_t*& channel = transfer->channel;
+    char*& file_path = transfer->file_path;
+    char (&filename)[NU_ACCESS_LOG_FILENAME_SIZE] = transfer->filename;
+    uint16_t block_index = 0;
+
+    //The request is not needed any more once the file is open and
+    //the group (if any) is joined: its buffer receives the ACKs
+    char* frame = session_param->frame;
+
+    //Parse the RRQ packet
+    bool parsed = tftp_view_RQ_packet(
+            &tftp_request, 
+            session_param->frame, 
+            session_param->frame_size);
+
+    //Get a socket bound to an unused port for this task
+    //(a multicast session sets options of its own socket)
+    tftpd_session = tftp_session_open(session_param,
+            parsed && (tftp_request.options & TFTP_OPTION_MULTICAST) &&
+            session_param->server_ipc->options.multicast,
+            &channel);
+
+    //No socket to answer from (out of descriptors)
+    if (tftpd_session < 0) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "tftp_RRQ_session: no socket errno=%d", errno);
+
+        co_return TFTP_ERROR__NOT_DEFINED;
+    }
+
+    if (!parsed)
+        co_return TFTP_ERROR__ILLEGAL_OPERATION;
+
+    strncpy(filename, tftp_request.filename.data(), sizeof(filename) - 1);
+    tftp_session_file(session_param, filename, 0);
+
+    //We are able to transmit only binary files
+    if (tftp_request.fmode != OCTET && tftp_request.fmode != NETASCII) {
+        tftp_send_ERROR(tftpd_session,
+                session_param->fromAddr,
+                session_param->fromPort,
+                TFTP_ERROR__ILLEGAL_OPERATION);
+
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "%s TFTP_ERROR__ILLEGAL_OPERATION errno=%d", filename, errno);
+
+        co_return TFTP_ERROR__ILLEGAL_OPERATION;
+    }
+
+    //Resolve the file through the metadata cache, if any. A file it
+    //does not know may still exist (just created, not rescanned yet):
+    //it is looked for on the filesystem anyway
+    nu::file_meta_t file_meta;
+    nu::file_cache::lookup_result_t cached = 
+        nu::file_cache::LOOKUP_UNAVAILABLE;
+
+    if (session_param->server_ipc->r_cache) {
+        file_path = tftp_lookup_path(session_param->server_ipc->r_cache,
+                tftp_request.filename.data(), &file_meta, &cached);
+
+        //A file not found (MISS) or a snapshot not available count as misses
+        if (cached == nu::file_cache::LOOKUP_HIT) {
+            NU_PROBE2(cache_hit, session_param->session_id, filename);
+            tftp_metric_add(session_param->server_ipc, TFTP_METRIC_CACHE_HITS, 1);
+        }
+        else {
+            NU_PROBE2(cache_miss, session_param->session_id, filename);
+            tftp_metric_add(session_param->server_ipc, TFTP_METRIC_CACHE_MISSES, 1);
+        }
+    }
+
+    //Compose complete path of the file requested
+    if (!file_path) {
+        file_path = tftp_compose_path(
+                session_param->server_ipc->r_path, tftp_request.filename.data());
+    }
+
+    //Try to open the file
+    file = fopen(file_path, "rb");
+
+    NU_PROBE3(file_open, session_param->session_id, file_path, file != 0);
+
+    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+            "tftp_RRQ_session: (uploading %s)", file_path);
+
+    if (!file) {
+        tftp_send_ERROR(tftpd_session,
+                session_param->fromAddr,
+                session_param->fromPort,
+                TFTP_ERROR__FILE_NOT_FOUND);
+
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "%s TFTP_ERROR__FILE_NOT_FOUND errno=%d", file_path, errno);
+
+        co_return TFTP_ERROR__FILE_NOT_FOUND;
+    }
+
+    //Share of the bandwidth of the worker, when the sessions compete
+    nu::fair_queue::flow_t flow;
+    flow.weight = tftp_get_weight(session_param->server_ipc,
+            session_param->fromAddr, tftp_request.filename.data());
+
+    tftp_pacing_t pacing;
+    tftp_get_pacing(session_param->server_ipc,
+            session_param->fromAddr, &pacing);
+
+    //Calculate the size of the file: the one opened, which the
+    //cache may not have caught up with yet (replaced or truncated)
+    int file_size = -1;
+    struct stat st;
+
+    if (fstat(fileno(file), &st) == 0) { // is it OK ?
+        nu::file_meta_t opened;
+        nu::file_meta_set(&opened, st);
+
+        if (cached == nu::file_cache::LOOKUP_HIT &&
+                !nu::file_meta_equal(file_meta, opened))
+        {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+                    "tftp_RRQ_session: %s changed, cache out of date", file_path);
+
+            session_param->server_ipc->r_cache->invalidate();
+        }
+
+        //Yes, get the size and the identity of the file
+        file_meta = opened;
+
+        file_size = int(st.st_size);
+    }
+
+    if (file_size < 0) {
+        tftp_send_ERROR(tftpd_session,
+                session_param->fromAddr,
+                session_param->fromPort,
+                TFTP_ERROR__ACCESS_VIOLATION);
+
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "%s TFTP_ERROR__ACCESS_VIOLATION errno=%d", file_path, errno);
+
+        co_return TFTP_ERROR__ACCESS_VIOLATION;
+    }
+
+    tftp_session_file(session_param, filename, uint64_t(file_size));
+
+    //Calculate the count of the blocks to transmit
+    uint32_t block_tot = (file_size / TFTP_MAX_BUFFER_SIZE) + 1;
+
+    //Destination of DATA packets and client driving the ACKs:
+    //both are the requesting client, unless the transfer is multicast
+    uint32_t dataAddr = session_param->fromAddr;
+    uint16_t dataPort = session_param->fromPort;
+    uint32_t masterAddr = session_param->fromAddr;
+    uint16_t masterPort = session_param->fromPort;
+
+    //Index of the next block to transmit
+    uint32_t next = 0;
+
+    if ((tftp_request.options & TFTP_OPTION_MULTICAST) &&
+            session_param->server_ipc->options.multicast)
+    {
+        const tftp_server_options_t& options = 
+            session_param->server_ipc->options;
+
+        //If no group is available, the option is just ignored
+        group = tftp_mcast_open(session_param->server_ipc,
+                tftp_request.filename.data(),
+                ntohl(inet_addr(options.mcast_addr)),
+                options.mcast_port,
+                masterAddr,
+                masterPort);
+
+        if (group) {
+            transfer->multicast_socket = true;
+
+            nu_set_multicast(tftpd_session,
+                    ntohl(inet_addr(options.mcast_if)),
+                    options.mcast_ttl,
+                    1);
+
+            dataAddr = group->addr;
+            dataPort = group->port;
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+                    "tftp_RRQ_session: multicast group %x-%i",
+                    dataAddr, dataPort);
+
+            //The requesting client is the first master
+            bool promoted = co_await tftp_mcast_promote(session_param, loop,
+                    tftpd_session, group, 
+                    masterAddr, masterPort, &next, frame);
+
+            if (!promoted) {
+                promoted = co_await tftp_mcast_elect_master(session_param, loop,
+                        tftpd_session, group,
+                        &masterAddr, &masterPort, &next, frame);
+            }
+
+            if (!promoted)
+                next = block_tot; // nobody is listening
+        }
+    }
+
+    //A unicast session talks to one client only: connect the socket,
+    //so that the kernel drops datagrams coming from other hosts, 
+    //and sending needs neither a route lookup nor an address.
+    //Their senders get an ICMP port unreachable then, rather than
+    //the error packet of RFC 1350 (--strict-tid: not connected)
+    bool connected = !group && !channel &&
+        !session_param->server_ipc->options.strict_tid &&
+        nu::sock_pool::connect(tftpd_session, masterAddr, masterPort);
+
+    if (connected) {
+        dataAddr = 0;
+        dataPort = 0;
+    }
+
+    //Transmit each block
+    while (true) {
+        if (next >= block_tot) {
+            if (!group)
+                break; // transfer completed
+
+            //The master client got the whole file: hand over
+            //the transfer to another client of the group, if any
+            tftp_mcast_client_done(group, masterAddr, masterPort);
+
+            bool elected = co_await tftp_mcast_elect_master(session_param, loop,
+                    tftpd_session, group,
+                    &masterAddr, &masterPort, &next, frame);
+
+            if (!elected) {
+                group = 0; // closed, all clients served
+                break;
+            }
+
+            continue;
+        }
+
+        // Get the block from the pool shared with the other sessions
+        // (it is read from the file only if nobody did it before)
+        if (block)
+            session_param->server_ipc->block_pool->release(block);
+
+        block = session_param->server_ipc->block_pool->acquire(
+                fileno(file), file_meta, next);
+
+        if (!block) {
+            tftp_send_ERROR(tftpd_session,
+                    masterAddr,
+                    masterPort,
+                    TFTP_ERROR__ACCESS_VIOLATION);
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                    "%s TFTP_ERROR__ACCESS_VIOLATION 2 errno=%d", file_path, errno);
+
+            co_return TFTP_ERROR__ACCESS_VIOLATION;
+        }
+
+        block_index = uint16_t(next + 1);
+
+        bool packet_acknowledged = false;
+        bool wait_for_valid_ack = false;
+        bool repositioned = false;
+
+        //For a max number of the attemps, try to send the block
+        for (int attempt = 0; attempt < TFTP_RECV_ATTEMPTS; ++attempt) {
+            // Clients joining the group get their OACK
+            if (group)
+                tftp_mcast_serve_joins(tftpd_session, group);
+
+            // Send the packet, within the rate limits, in its turn
+            if (!wait_for_valid_ack) {
+                size_t bytes = TFTP_HEADER_SIZE + nu::block_pool::size(block);
+                uint64_t wait_us = tftp_pace(&pacing, bytes);
+
+                if (wait_us)
+                    co_await loop->sleep((wait_us + 999) / 1000);
+
+                co_await loop->sends()->turn(&flow, bytes);
+
+                tftp_event(session_param,
+                        attempt ? nu::EVENT_RETRANSMIT : nu::EVENT_DATA_SENT,
+                        block_index, nu::block_pool::size(block));
+
+                if (!tftp_send_DATA_payload(tftpd_session,
+                            dataAddr,
+                            dataPort,
+                            block_index,
+                            nu::block_pool::data(block),
+                            nu::block_pool::size(block)))
+                {
+                    co_return TFTP_ERROR__NOT_DEFINED;
+                }
+            }
+
+            //Wait for an ack message (in a multicast group the
+            //members other than the master are handled below)
+            struct timeval timeout = {};
+            timeout.tv_usec = 0;
+            timeout.tv_sec = TFTP_RECV_TIMEOUT;
+
+            uint32_t ackAddr = group ? 0 : masterAddr;
+            uint16_t ackPort = group ? 0 : masterPort;
+
+            int ack_size = co_await tftp_session_recv(session_param, loop,
+                    tftpd_session, channel, connected, frame,
+                    &ackAddr, &ackPort, &timeout, !group);
+
+            if (ack_size == 0) {
+                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                        "tftp_RRQ_session: timeout, block %i sent again",
+                        block_index);
+
+                tftp_event(session_param, nu::EVENT_TIMEOUT, block_index, 0);
+
+                wait_for_valid_ack = false; // retransmit
+                continue;
+            }
+
+            if (ack_size < 0) {
+                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                        "tftp_RRQ_session: receive error");
+
+                break;
+            }
+
+            if (group && (ackAddr != masterAddr || ackPort != masterPort)) {
+                if (!tftp_mcast_is_member(group, ackAddr, ackPort)) {
+                    tftp_send_ERROR(tftpd_session,
+                            ackAddr,
+                            ackPort,
+                            TFTP_ERROR__UNKNOWN_TRANSFER_ID);
+                }
+
+                wait_for_valid_ack = true;
+                continue;
+            }
+
+            //Ack was received, parse and validate it
+            if (tftp_parse_ACK_packet(&tftp_ack, frame, (uint16_t)ack_size)) {
+                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_PED,
+                        "tftp_RRQ_session:ACK %i", tftp_ack.block);
+
+                if (tftp_ack.block != block_index) {
+                    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                            "tftp_RRQ_session: bad block %i!=ack block %i",
+                            block_index,
+                            tftp_ack.block);
+
+                    // A master client missing some blocks
+                    // restarts the transmission from there,
+                    // one which joined late may have got
+                    // the following ones already
+                    if (group) {
+                        uint32_t acked = 
+                            tftp_mcast_resolve_block(tftp_ack.block, next);
+
+                        if (acked < next ||
+                                (acked > next && acked <= block_tot))
+                        {
+                            next = acked;
+                            repositioned = true;
+                            break;
+                        }
+                    }
+
+                    // if you receive an ack of a block already acknowledged,
+                    // return to the receive fase
+                    wait_for_valid_ack = group ? 
+                        true : tftp_ack.block <= last_ack_block;
+                    continue;
+                }
+
+                last_ack_block = tftp_ack.block; // last valid acknowledged packet
+                tftp_event(session_param, nu::EVENT_ACK_RECEIVED, block_index, 0);
+                packet_acknowledged = true;
+                break; // no error, break "attempt" loop
+            }
+            else {
+                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                        "tftp_RRQ_session: ACK sending fails");
+
+            }
+        } // end of "for loop"
+
+        if (repositioned)
+            continue;
+
+        if (!packet_acknowledged && group) {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_RRQ_session: master %x-%i dropped",
+                    masterAddr, masterPort);
+
+            //The master client is not answering: drop it, 
+            //the transfer goes on with another client
+            tftp_mcast_client_done(group, masterAddr, masterPort);
+
+            bool elected = co_await tftp_mcast_elect_master(session_param, loop,
+                    tftpd_session, group,
+                    &masterAddr, &masterPort, &next, frame);
+
+            if (!elected) {
+                group = 0; // closed, no clients left
+                break;
+            }
+
+            continue;
+        }
+
+        if (!packet_acknowledged) {
+            tftp_send_ERROR(tftpd_session,
+                    session_param->fromAddr,
+                    session_param->fromPort,
+                    TFTP_ERROR__NOT_DEFINED);
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "%s !packet_acknowledged TFTP_ERROR__NOT_DEFINED errno=%d", 
+                    file_path, errno);
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR, "RRQ operation stopped");
+
+            co_return TFTP_ERROR__NOT_DEFINED;
+        }
+
+        ++next;
+    }
+
+    co_return TFTP_ERROR__SUCCESS;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+nu::task<> tftp_RRQ_session(tftp_session_param* session_param, nu::event_loop* loop)
+{
+    tftp_transfer_t transfer;
+
+    //Increment the session number
+    session_param->server_ipc->opened_sessions++;
+
+    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+            "tftp_RRQ_session+ (sessions = %i)",
+            session_param->server_ipc->opened_sessions);
+
+    int err_code = co_await tftp_RRQ_transfer(session_param, loop, &transfer);
+
+    if (err_code != TFTP_ERROR__SUCCESS)
+        tftp_session_failed(session_param, err_code);
+
+    //Free all allocated resources
+    active_connection_list__show();
+    active_connection_list__delete(session_param->session_index);
+    active_connection_list__show();
+
+    //Multicast options make the socket unsuitable for other sessions
+    tftp_session_close(session_param, transfer.sd, transfer.channel, 
+            !transfer.multicast_socket);
+    session_param->server_ipc->opened_sessions--;
+
+    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+            "tftp_RRQ_session- (sessions = %i)",
+            session_param->server_ipc->opened_sessions);
+
+    if (transfer.block)
+        session_param->server_ipc->block_pool->release(transfer.block);
+
+    if (transfer.group)
+        tftp_mcast_close(transfer.group, true);
+
+    tftp_session_end(session_param, TFTP_RRQ, transfer.filename);
+
+    session_param->server_ipc->arena->free(session_param->frame);
+    free_session(session_param);
+
+    if (transfer.file) 
+        fclose(transfer.file);
+
+    delete[] transfer.file_path;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Receives the file requested.
+// Returns TFTP_ERROR__SUCCESS, or the error ending the session
+static nu::task<int> tftp_WRQ_transfer(
+        tftp_session_param* session_param,
+        nu::event_loop* loop,
+        tftp_transfer_t* transfer)
+{
+    tftp_request_view_t tftp_request;
+    tftp_data_view_t tftp_data = { 0, 0, 0 };
+
+    int data_size = 0;
+    int& tftpd_session = transfer->sd;
+    char*& file_path = transfer->file_path;
+    char (&filename)[NU_ACCESS_LOG_FILENAME_SIZE] = transfer->filename;
+    bool packet_received = false;
+    bool operation_completed = false;
+    int attempt = 0;
+
+    FILE*& file = transfer->file;
+
+    //Once the file is open, the buffer of the request receives the blocks
+    char* frame = session_param->frame;
+    nu::demux::channel_t*& channel = transfer->channel;
+
+    //Get a socket bound to an unused port for this task
+    tftpd_session = tftp_session_open(session_param, false, &channel);
+
+    //No socket to answer from (out of descriptors)
+    if (tftpd_session < 0) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "tftp_WRQ_session: no socket errno=%d", errno);
+
+        co_return TFTP_ERROR__NOT_DEFINED;
+    }
+
+    //Connect the socket to the client: datagrams of other hosts 
+    //are dropped by the kernel (their senders get an ICMP port
+    //unreachable, not an error packet, unless --strict-tid), and
+    //sending needs no route lookup (a shared socket cannot be connected)
+    bool connected = !channel && 
+        !session_param->server_ipc->options.strict_tid &&
+        nu::sock_pool::connect(tftpd_session, 
+            session_param->fromAddr, 
+            session_param->fromPort);
+
+    uint32_t peerAddr = connected ? 0 : session_param->fromAddr;
+    uint16_t peerPort = connected ? 0 : session_param->fromPort;
+
+    //Parse the WRQ packet
+    if (!tftp_view_RQ_packet(&tftp_request,
+                session_param->frame,
+                session_param->frame_size))
+    {
+        co_return TFTP_ERROR__ILLEGAL_OPERATION;
+    }
+
+    strncpy(filename, tftp_request.filename.data(), sizeof(filename) - 1);
+    tftp_session_file(session_param, filename, 0);
+
+    //We are able to receive only binary files
+    if (tftp_request.fmode != OCTET && tftp_request.fmode != NETASCII) {
+        tftp_send_ERROR(tftpd_session,
+                session_param->fromAddr,
+                session_param->fromPort,
+                TFTP_ERROR__ILLEGAL_OPERATION);
+
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "%s TFTP_ERROR__ILLEGAL_OPERATION errno=%d", 
+                filename, errno);
+
+        co_return TFTP_ERROR__ILLEGAL_OPERATION;
+    }
+
+    //Compose complete path of the file requested
+    file_path = tftp_compose_path(
+            session_param->server_ipc->w_path, tftp_request.filename.data());
+
+    //Try to open the file, if file exists, over-write it
+    file = fopen(file_path, "w+b");
+
+    NU_PROBE3(file_open, session_param->session_id, file_path, file != 0);
+
+    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+            "tftp_WRQ_session: (downloading %s)", file_path);
+
+    if (!file) {
+        tftp_send_ERROR(tftpd_session,
+                session_param->fromAddr,
+                session_param->fromPort,
+                TFTP_ERROR__DISK_FULL);
+
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "%s TFTP_ERROR__DISK_FULL errno=%d", file_path, errno);
+
+        co_return TFTP_ERROR__DISK_FULL;
+    }
+
+    uint16_t block_index = 0;
+
+    //Until client send us blocks,
+    //ack them and write the content in the file
+    do {
+        packet_received = false;
+
+        for (attempt = 0; attempt < TFTP_RECV_ATTEMPTS; ++attempt) {
+            tftp_event(session_param,
+                    attempt ? nu::EVENT_RETRANSMIT : nu::EVENT_ACK_SENT,
+                    block_index, 0);
+
+            //Send ACK (the first ack must be with block number = 0)
+            if (!tftp_send_ACK(tftpd_session,
+                        peerAddr,
+                        peerPort,
+                        block_index++)) // block index is 0 for first ack
+            {
+                co_return TFTP_ERROR__NOT_DEFINED;
+            }
+
+            //Receive a block
+            struct timeval timeout = {};
+            timeout.tv_usec = 0;
+            timeout.tv_sec = TFTP_RECV_TIMEOUT;
+
+            data_size = co_await tftp_session_recv(session_param, loop,
+                    tftpd_session, channel, connected, frame,
+                    &session_param->fromAddr,
+                    &session_param->fromPort,
+                    &timeout, true);
+
+            //If OK
+            if (data_size > 0) {
+                //Parse the packet (this should be a DATA packet)
+                if (tftp_view_DATA_packet(&tftp_data, frame, uint16_t(data_size))) {
+                    //Verify if this block is that we are wating for...
+                    if (tftp_data.block != block_index) {
+                        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                                "tftp_WRQ_session: block %i!=ack block %i",
+                                block_index,
+                                tftp_data.block);
+
+                        --block_index; // acknowledge the last block again
+                        continue;
+                    }
+
+                    //data_size is the size of the block (without the header of
+                    //TFTP frame); it's possible that its value is zero, because
+                    //the size of the file was divisible by TFTP_MAX_BUFFER_SIZE
+                    data_size = tftp_data.size;
+
+                    tftp_event(session_param, nu::EVENT_DATA_RECEIVED,
+                            block_index, data_size);
+
+                    if (data_size) {
+                        //Write the block in the file
+                        if (!fwrite(tftp_data.payload, data_size, 1, file)) 
+                        {
+                            tftp_send_ERROR(
+                                    tftpd_session,
+                                    session_param->fromAddr,
+                                    session_param->fromPort,
+                                    TFTP_ERROR__DISK_FULL);
+
+                            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                                    "%s !fwrite TFTP_ERROR__DISK_FULL errno=%d", file_path, errno);
+
+                            co_return TFTP_ERROR__DISK_FULL;
+                        }
+                    } // if (data_size)...
+
+                    //Is it the last one ? (an empty block ends a file
+                    //whose size is a multiple of TFTP_MAX_BUFFER_SIZE)
+                    if (data_size < TFTP_MAX_BUFFER_SIZE) {
+                        //Ok, all bytes received, operation completed !
+                        operation_completed = true;
+
+                        //Send ACK
+                        if (!tftp_send_ACK(tftpd_session,
+                                    peerAddr,
+                                    peerPort,
+                                    block_index++)) // block index is 0 for first ack
+                        {
+                            tftp_send_ERROR(
+                                    tftpd_session,
+                                    session_param->fromAddr,
+                                    session_param->fromPort,
+                                    TFTP_ERROR__NOT_DEFINED);
+
+                            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                                    "%s !tftp_send_ACK TFTP_ERROR__NOT_DEFINED errno=%d", 
+                                    file_path, errno);
+
+                            co_return TFTP_ERROR__NOT_DEFINED;
+                        }
+                    }
+
+                    packet_received = true;
+                    break; // no error, break "attempt" loop
+
+                } // if 
+                else {
+                    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                            "tftp_WRQ_session: WARNING recv timeout");
+
+                    --block_index; // acknowledge the last block again
+                }
+            }
+            else if (data_size == 0) {
+                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                        "tftp_WRQ_session: no DATA, last block = %i sent again", 
+                        tftp_data.block);
+
+                tftp_event(session_param, nu::EVENT_TIMEOUT, block_index, 0);
+
+                --block_index; // retransmit the last ACK
+            }
+            else {
+                break; // error in the communication
+            }
+
+        } // for ...
+
+        if (!packet_received) {
+            tftp_send_ERROR(tftpd_session,
+                    session_param->fromAddr,
+                    session_param->fromPort,
+                    TFTP_ERROR__NOT_DEFINED);
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "%s !packet_received TFTP_ERROR__NOT_DEFINED errno=%d", 
+                    file_path, errno);
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                    "tftp_WRQ_session: no ACK. Transfer interrupted");
+
+            co_return TFTP_ERROR__NOT_DEFINED;
+        }
+
+    } 
+    while (!operation_completed);
+
+    //The file is complete: close it before dallying
+    if (fclose(file) != 0) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
+                "%s fclose failed errno=%d", file_path, errno);
+    }
+
+    file = nullptr;
+
+    //Dally (RFC 1350): if the final ACK gets lost, the client
+    //sends the last block again, which is acknowledged again
+    uint16_t last_block = uint16_t(block_index - 1);
+
+    for (attempt = 0; attempt < TFTP_RECV_ATTEMPTS; ++attempt) {
+        struct timeval timeout = {};
+        timeout.tv_usec = 0;
+        timeout.tv_sec = TFTP_DALLY_TIMEOUT;
+
+        data_size = co_await tftp_session_recv(session_param, loop,
+                tftpd_session, channel, connected, frame,
+                &session_param->fromAddr,
+                &session_param->fromPort,
+                &timeout, true);
+
+        if (data_size <= 0)
+            break;
+
+        if (tftp_view_DATA_packet(&tftp_data, frame, uint16_t(data_size)) &&
+                tftp_data.block == last_block)
+        {
+            tftp_send_ACK(tftpd_session, peerAddr, peerPort, last_block);
+        }
+    }
+
+    co_return TFTP_ERROR__SUCCESS;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+nu::task<> tftp_WRQ_session(tftp_session_param* session_param, nu::event_loop* loop)
+{
+    tftp_transfer_t transfer;
+
+    //Increment the session number
+    session_param->server_ipc->opened_sessions++;
+
+    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+            "tftp_WRQ_session+ (sessions = %i)",
+            session_param->server_ipc->opened_sessions);
+
+    int err_code = co_await tftp_WRQ_transfer(session_param, loop, &transfer);
+
+    if (err_code != TFTP_ERROR__SUCCESS)
+        tftp_session_failed(session_param, err_code);
+
+    //Free all allocated resources
+    active_connection_list__delete(session_param->session_index);
+    tftp_session_close(session_param, transfer.sd, transfer.channel, true);
+    session_param->server_ipc->opened_sessions--;
+
+    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
+            "tftp_WRQ_session- (sessions = %i)",
+            session_param->server_ipc->opened_sessions);
+
+    tftp_session_end(session_param, TFTP_WRQ, transfer.filename);
+
+    session_param->server_ipc->arena->free(session_param->frame);
+    free_session(session_param);
+
+    if (transfer.file) 
+        fclose(transfer.file);
+
+    delete[] transfer.file_path;
+}
+
+
+
+/* -------------------------------------------------------------------------- */
+
+// Admission of the requests
+
+// Hands a request to a worker, returns false if there are no resources
+// for it (all the resources taken are given back)
+static bool tftp_start_session(
+        IPC_thread_param* ipc,
+        uint32_t fromAddr,
+        uint16_t fromPort,
+        tftp_opcode_t opcode,
+        const char* request,
+        int request_size,
+        uint64_t received_us)
+{
+    int index = active_connection_list__insert(fromAddr, fromPort);
+
+    if (index < 0) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                "tftp_server request delayed, max connection count reached (%i)",
+                ipc->opened_sessions);
+
+        return false;
+    }
+
+    char* frame = ipc->arena->alloc();
+
+    if (!frame) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                "tftp_server request delayed, no packet buffer available");
+
+        active_connection_list__delete(index);
+        return false;
+    }
+
+    tftp_session_param* session_param = release_session_param();
+    *session_param = tftp_session_param();
+    session_param->fromAddr = fromAddr;
+    session_param->fromPort = fromPort;
+    session_param->frame = frame;
+    memcpy(session_param->frame, request, request_size);
+    session_param->frame_size = request_size;
+    session_param->server_ipc = ipc;
+    session_param->session_index = index;
+    session_param->session_id = ++ipc->last_session_id;
+    session_param->received_us = received_us;
+
+    tftp_session_desc_t desc;
+    desc.param = session_param;
+    desc.opcode = opcode;
+
+    if (!tftp_dispatch(ipc, desc)) {
+        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                "tftp_server request delayed, all worker queues full");
+
+        ipc->arena->free(frame);
+        free_session(session_param);
+
+        active_connection_list__delete(index);
+        return false;
+    }
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Starts a new request if a slot is free and nobody is waiting for one,
+// else queues it. A request which cannot wait is refused with an ERROR
+static void tftp_admit_request(
+        IPC_thread_param* ipc,
+        uint32_t fromAddr,
+        uint16_t fromPort,
+        tftp_opcode_t opcode,
+        const char* request,
+        int request_size)
+{
+    nu::admission_queue* admission = ipc->admission;
+
+    NU_PROBE3(request, fromAddr, fromPort, opcode);
+
+    if (ipc->events)
+        ipc->events->log(nu::EVENT_REQUEST, 0, fromAddr, fromPort, opcode, 0);
+
+    tftp_metric_add(ipc, opcode == TFTP_RRQ ? TFTP_METRIC_RRQ : TFTP_METRIC_WRQ, 1);
+
+    if (admission->empty() && admission->acquire()) {
+        if (tftp_start_session(ipc, fromAddr, fromPort, opcode, 
+                    request, request_size, nu_clock_us()))
+            return;
+
+        admission->cancel();
+    }
+
+    switch (admission->push(fromAddr, fromPort, request, request_size, nu_coarse_ms())) {
+        case nu::admission_queue::QUEUED:
             NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
-                    "tftp_WRQ_session_thread: (downloading %s)", file_path);
+                    "tftp_server: %x-%i queued (%i waiting)",
+                    fromAddr, fromPort, admission->size());
+            break;
+
+        case nu::admission_queue::DUPLICATE:
+            break; // retransmission of a request waiting
+
+        case nu::admission_queue::REFUSED:
+            ipc->rejected_requests++;
+            tftp_metric_add(ipc, TFTP_METRIC_REJECTED, 1);
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_server: %x-%i refused, server busy (%u)",
+                    fromAddr, fromPort, ipc->rejected_requests);
+
+            tftp_send_ERROR(ipc->tftpd, fromAddr, fromPort, TFTP_ERROR__NOT_DEFINED);
+            break;
+    }
+
+    tftp_metric_set(ipc, TFTP_METRIC_QUEUE_DEPTH, admission->size());
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Starts the requests waiting, as long as there are free slots 
+static void tftp_admit_queued(IPC_thread_param* ipc)
+{
+    nu::admission_queue* admission = ipc->admission;
+    nu::admission_queue::request_t request;
+    uint64_t now = nu_coarse_ms();
+
+    while (admission->front(&request)) {
+        //Waited too long: the client is told, rather than timing out
+        if (now - request.enqueued_ms > admission->budget_ms()) {
+            ipc->rejected_requests++;
+            tftp_metric_add(ipc, TFTP_METRIC_REJECTED, 1);
+
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_server: %x-%i refused, waited %u ms",
+                    request.addr, request.port, unsigned(now - request.enqueued_ms));
+
+            tftp_send_ERROR(ipc->tftpd, request.addr, request.port, 
+                    TFTP_ERROR__NOT_DEFINED);
+
+            admission->pop();
+            continue;
+        }
+
+        if (!admission->acquire())
+            break;
+
+        tftp_opcode_t opcode = tftp_parse_opcode(request.frame, request.size);
+
+        if (!tftp_start_session(ipc, request.addr, request.port, 
+                    opcode, request.frame, request.size, request.enqueued_ms * 1000))
+        {
+            admission->cancel();
+            break;
+        }
+
+        admission->pop();
+    }
+
+    tftp_metric_set(ipc, TFTP_METRIC_QUEUE_DEPTH, admission->size());
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Weights of the transfers
+
+// Parses rules like "10.1.0.0/16=4,.img=2", returns the count of rules
+static int tftp_parse_weights(const char* rules, tftp_weight_rule_t* table, int size)
+{
+    std::string list = rules;
+    std::stringstream ss(list);
+    std::string rule;
+    int count = 0;
+
+    while (std::getline(ss, rule, ',') && count < size) {
+        size_t eq = rule.find('=');
+        int weight = eq != std::string::npos ? atoi(rule.c_str() + eq + 1) : 0;
+
+        if (rule.empty())
+            continue;
+
+        if (weight <= 0) {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_parse_weights: bad rule '%s'", rule.c_str());
+            continue;
+        }
+
+        tftp_weight_rule_t* r = &table[count];
+        memset(r, 0, sizeof(tftp_weight_rule_t));
+        r->weight = unsigned(weight);
+
+        std::string lhs = rule.substr(0, eq);
+
+        if (lhs[0] == '.')
+            strncpy(r->ext, lhs.c_str(), sizeof(r->ext) - 1);
+        else if (!tftp_parse_subnet(lhs, &r->addr, &r->mask)) {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_parse_weights: bad subnet '%s'", lhs.c_str());
+            continue;
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// The weight of a transfer is the one of the longest subnet of the client
+// times the one of the class of the file
+static unsigned tftp_get_weight(IPC_thread_param* ipc, uint32_t addr, const char* filename)
+{
+    unsigned subnet_weight = 1;
+    unsigned class_weight = 1;
+    uint32_t best_mask = 0;
+    bool subnet_found = false;
+    size_t len = strlen(filename);
+
+    for (int i = 0; i < ipc->weight_rule_count; ++i) {
+        const tftp_weight_rule_t* r = &ipc->weight_rules[i];
+
+        if (r->ext[0]) {
+            size_t ext_len = strlen(r->ext);
+
+            if (len >= ext_len && strcasecmp(filename + len - ext_len, r->ext) == 0)
+                class_weight = r->weight;
+        }
+        else if ((addr & r->mask) == r->addr && (!subnet_found || r->mask > best_mask)) {
+            subnet_weight = r->weight;
+            best_mask = r->mask;
+            subnet_found = true;
+        }
+    }
+
+    return subnet_weight * class_weight;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Parses "A.B.C.D/BITS" (or just "A.B.C.D", a single host)
+static bool tftp_parse_subnet(const std::string& subnet, uint32_t* addr, uint32_t* mask)
+{
+    size_t slash = subnet.find('/');
+    int bits = slash != std::string::npos ? atoi(subnet.c_str() + slash + 1) : 32;
+    struct in_addr in;
+
+    if (inet_pton(AF_INET, subnet.substr(0, slash).c_str(), &in) != 1 ||
+            bits < 0 || bits > 32)
+    {
+        return false;
+    }
+
+    *mask = bits ? ~uint32_t(0) << (32 - bits) : 0;
+    *addr = ntohl(in.s_addr) & *mask;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Egress rate limits
+
+// Parses bytes/s, with an optional K, M or G suffix (x1024)
+static bool tftp_parse_rate(const std::string& value, uint64_t* rate)
+{
+    char* end = 0;
+    unsigned long long n = strtoull(value.c_str(), &end, 10);
+
+    if (end == value.c_str())
+        return false;
+
+    switch (toupper(*end)) {
+        case 'G': n <<= 10; // fall through
+        case 'M': n <<= 10; // fall through
+        case 'K': n <<= 10; ++end; break;
+        default: break;
+    }
+
+    if (*end)
+        return false;
+
+    *rate = n;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Parses rules like "10.1.0.0/16=1M,10.2.0.7=100K", returns the count of rules
+static int tftp_parse_rates(const char* rules, tftp_rate_rule_t* table, int size)
+{
+    std::string list = rules;
+    std::stringstream ss(list);
+    std::string rule;
+    int count = 0;
+
+    while (std::getline(ss, rule, ',') && count < size) {
+        if (rule.empty())
+            continue;
+
+        size_t eq = rule.find('=');
+        tftp_rate_rule_t* r = &table[count];
+
+        if (eq == std::string::npos ||
+                !tftp_parse_subnet(rule.substr(0, eq), &r->addr, &r->mask) ||
+                !tftp_parse_rate(rule.substr(eq + 1), &r->rate) ||
+                r->rate == 0)
+        {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_parse_rates: bad rule '%s'", rule.c_str());
+            continue;
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Creates the token buckets of the server and of the subnets limited
+static void tftp_start_rate_limits(IPC_thread_param* ipc)
+{
+    ipc->rate_rule_count = tftp_parse_rates(ipc->options.subnet_rates,
+            ipc->rate_rules, TFTP_SCHED_MAX_RULES);
+
+    ipc->rate_buckets = new nu::token_bucket[ipc->rate_rule_count + 1];
+
+    for (int i = 0; i <= ipc->rate_rule_count; ++i) {
+        uint64_t rate = i ? ipc->rate_rules[i - 1].rate : ipc->options.egress_rate;
+
+        // The burst covers a late wakeup of the sender (a tick or two),
+        // and at least a couple of datagrams
+        uint64_t burst = rate * TFTP_RATE_BURST / 1000;
+
+        if (burst < 2 * TFTP_FRAME_SIZE)
+            burst = 2 * TFTP_FRAME_SIZE;
+
+        ipc->rate_buckets[i].set_rate(rate, burst);
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// A client is limited by the server rate and by its longest subnet limited
+static void tftp_get_pacing(IPC_thread_param* ipc, uint32_t addr, tftp_pacing_t* pacing)
+{
+    uint32_t best_mask = 0;
+
+    pacing->server = ipc->rate_buckets[0].rate() ? &ipc->rate_buckets[0] : 0;
+    pacing->subnet = 0;
+
+    for (int i = 0; i < ipc->rate_rule_count; ++i) {
+        const tftp_rate_rule_t* r = &ipc->rate_rules[i];
+
+        if ((addr & r->mask) == r->addr && (!pacing->subnet || r->mask > best_mask)) {
+            pacing->subnet = &ipc->rate_buckets[i + 1];
+            best_mask = r->mask;
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Takes the tokens of a send, returns the us to wait before sending it
+static uint64_t tftp_pace(const tftp_pacing_t* pacing, size_t bytes)
+{
+    if (!pacing->server && !pacing->subnet)
+        return 0;
+
+    uint64_t now = nu_clock_us();
+    uint64_t wait = pacing->server ? pacing->server->reserve(bytes, now) : 0;
+
+    if (pacing->subnet) {
+        uint64_t subnet_wait = pacing->subnet->reserve(bytes, now);
+
+        if (subnet_wait > wait)
+            wait = subnet_wait;
+    }
+
+    return wait;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Event log
+
+// Accounts an event of a session: metrics, snapshot, probes and, if 
+// it is on, event log
+static void tftp_event(
+        tftp_session_param* session_param,
+        unsigned type,
+        uint32_t arg1,
+        uint64_t arg2)
+{
+    IPC_thread_param* ipc = session_param->server_ipc;
+    uint32_t session_id = session_param->session_id;
+
+    switch (type) {
+        case nu::EVENT_SESSION_START:
+            NU_PROBE4(session_start, session_id, arg1, 
+                    session_param->fromAddr, session_param->fromPort);
+            break;
+
+        case nu::EVENT_SESSION_END:
+            NU_PROBE4(session_end, session_id, arg1, arg2, session_param->bytes);
+            break;
+
+        case nu::EVENT_DATA_SENT:
+            NU_PROBE3(data_send, session_id, arg1, arg2);
+            tftp_metric_add(ipc, TFTP_METRIC_BYTES_SENT, int64_t(arg2));
+            session_param->bytes += arg2;
+            break;
+
+        case nu::EVENT_DATA_RECEIVED:
+            NU_PROBE3(data_receive, session_id, arg1, arg2);
+            tftp_metric_add(ipc, TFTP_METRIC_BYTES_RECEIVED, int64_t(arg2));
+            session_param->bytes += arg2;
+            break;
+
+        case nu::EVENT_ACK_SENT:
+            NU_PROBE2(ack_send, session_id, arg1);
+            break;
+
+        case nu::EVENT_ACK_RECEIVED:
+            NU_PROBE2(ack_receive, session_id, arg1);
+            break;
+
+        case nu::EVENT_RETRANSMIT:
+            NU_PROBE2(retransmit, session_id, arg1);
+            tftp_metric_add(ipc, TFTP_METRIC_BYTES_SENT, int64_t(arg2));
+            tftp_metric_add(ipc, TFTP_METRIC_RETRANSMITS, 1);
+            session_param->retransmits++;
+            break;
+
+        case nu::EVENT_TIMEOUT:
+            NU_PROBE2(timeout, session_id, arg1);
+            tftp_metric_add(ipc, TFTP_METRIC_TIMEOUTS, 1);
+            session_param->timeouts++;
+            break;
+
+        case nu::EVENT_ERROR:
+            NU_PROBE2(error, session_id, arg1);
+            tftp_metric_add(ipc, TFTP_METRIC_ERRORS + (arg1 < 8 ? int(arg1) : 0), 1);
+            break;
+
+        default:
+            break;
+    }
+
+    if (ipc->metrics)
+        tftp_time_event(session_param, type);
 
-            if (!file) {
-                tftp_send_ERROR(tftpd_session,
-                        session_param->fromAddr,
-                        session_param->fromPort,
-                        TFTP_ERROR__DISK_FULL);
+    if (session_param->slot)
+        tftp_session_publish(session_param, type, arg1);
 
-                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                        "%s TFTP_ERROR__DISK_FULL errno=%d", file_path, errno);
+    if (ipc->events) {
+        ipc->events->log(type, session_param->session_id,
+                session_param->fromAddr, session_param->fromPort, arg1, arg2);
+    }
+}
 
-                session_param->server_ipc->last_err_code = TFTP_ERROR__DISK_FULL;
 
-                throw 0;
-            }
+/* -------------------------------------------------------------------------- */
 
-            uint16_t block_index = 0;
-
-            //Until client send us blocks,
-            //ack them and write the content in the file
-            do {
-                packet_received = false;
-
-                for (attempt = 0; attempt < TFTP_RECV_ATTEMPTS; ++attempt) {
-                    //Send ACK (the first ack must be with block number = 0)
-                    if (!tftp_send_ACK(tftpd_session,
-                                session_param->fromAddr,
-                                session_param->fromPort,
-                                block_index++)) // block index is 0 for first ack
-                    {
-                        throw 0;
-                    }
+// Records the error ending a session
+static void tftp_session_failed(tftp_session_param* session_param, int err_code)
+{
+    session_param->server_ipc->last_err_code = err_code;
+    session_param->err_code = err_code;
 
-                    //Receive a block
-                    struct timeval timeout = {0};
-                    timeout.tv_usec = 0;
-                    timeout.tv_sec = TFTP_RECV_TIMEOUT;
-
-                    data_size = nu_recvfrom_timeout(tftpd_session,
-                            frame, MAX_FRAME_SIZE, 0,
-                            &session_param->fromAddr,
-                            &session_param->fromPort,
-                            &timeout);
-
-                    //If OK
-                    if (data_size > 0) {
-                        //Parse the packet (this should be a DATA packet)
-                        if (tftp_parse_DATA_packet(&tftp_data, frame, (uint16_t*)&data_size)) {
-                            //Verify if this block is that we are wating for...
-                            if (tftp_data.block != block_index) {
-                                NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                                        "tftp_WRQ_session_thread: block %i!=ack block %i",
-                                        block_index,
-                                        tftp_data.block);
-                                continue;
-                            }
-
-                            //data_size value is updated by tftp_parse_DATA_packet
-                            //and it should be the size of the block (without the header of
-                            //TFTP frame); it's possible that its value is zero, because
-                            //the size of the file was divisible by TFTP_MAX_BUFFER_SIZE
-                            if (data_size) {
-                                //Write the block in the file
-                                if (!fwrite(tftp_data.buffer, data_size, 1, file)) 
-                                {
-                                    tftp_send_ERROR(
-                                            tftpd_session,
-                                            session_param->fromAddr,
-                                            session_param->fromPort,
-                                            TFTP_ERROR__DISK_FULL);
-
-                                    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                                            "%s !fwrite TFTP_ERROR__DISK_FULL errno=%d", file_path, errno);
-
-                                    session_param->server_ipc->last_err_code = TFTP_ERROR__DISK_FULL;
-
-                                    throw 0;
-                                }
-
-                                //Is it the last one ?
-                                if (data_size < TFTP_MAX_BUFFER_SIZE) {
-                                    //Ok, all bytes received, operation completed !
-                                    operation_completed = true;
-
-                                    //Send ACK
-                                    if (!tftp_send_ACK(tftpd_session,
-                                                session_param->fromAddr,
-                                                session_param->fromPort,
-                                                block_index++)) // block index is 0 for first ack
-                                    {
-                                        tftp_send_ERROR(
-                                                tftpd_session,
-                                                session_param->fromAddr,
-                                                session_param->fromPort,
-                                                TFTP_ERROR__NOT_DEFINED);
-
-                                        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                                                "%s !tftp_send_ACK TFTP_ERROR__NOT_DEFINED errno=%d", 
-                                                file_path, errno);
-
-                                        session_param->server_ipc->last_err_code = TFTP_ERROR__NOT_DEFINED;
-
-                                        throw 0;
-                                    }
-                                }
-                            } // if (data_size)...
-
-                            packet_received = true;
-                            break; // no error, break "attempt" loop
-
-                        } // if 
-                        else {
-                            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                                    "tftp_WRQ_session_thread: WARNING recv timeout");
-                        }
-                    }
-                    else if (data_size == 0) {
-                        NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                                "tftp_WRQ_session_thread: no ACK, last block = %i", tftp_data.block);
+    tftp_event(session_param, nu::EVENT_ERROR, err_code, 0);
+}
 
-                        break;
-                    }
-                    else {
-                        break; // error in the communication
-                    }
 
-                } // for ...
+/* -------------------------------------------------------------------------- */
 
-                if (!packet_received) {
-                    tftp_send_ERROR(tftpd_session,
-                            session_param->fromAddr,
-                            session_param->fromPort,
-                            TFTP_ERROR__NOT_DEFINED);
+// Records the end of a session, and its transfer in the access log
+static void tftp_session_end(
+        tftp_session_param* session_param,
+        tftp_opcode_t opcode,
+        const char* filename)
+{
+    nu::access_log* access = session_param->server_ipc->access;
+
+    tftp_event(session_param, nu::EVENT_SESSION_END, session_param->err_code,
+            nu_coarse_ms() - session_param->started_ms);
+
+    if (access) {
+        nu::access_record_t record;
+        record.duration_us = nu_clock_us() - session_param->started_us;
+        record.bytes = session_param->bytes;
+        record.session = session_param->session_id;
+        record.addr = session_param->fromAddr;
+        record.port = session_param->fromPort;
+        record.opcode = opcode;
+        record.error = session_param->err_code;
+        record.retransmits = session_param->retransmits;
+        record.timeouts = session_param->timeouts;
+        strncpy(record.filename, filename, sizeof(record.filename) - 1);
+        record.filename[sizeof(record.filename) - 1] = 0;
+
+        access->log(record);
+    }
+}
 
-                    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
-                            "%s !packet_received TFTP_ERROR__NOT_DEFINED errno=%d", 
-                            file_path, errno);
 
-                    session_param->server_ipc->last_err_code = TFTP_ERROR__NOT_DEFINED;
+/* -------------------------------------------------------------------------- */
+
+// Publishes the progress of a session, on each of its events
+static void tftp_session_publish(
+        tftp_session_param* session_param,
+        unsigned type,
+        uint32_t arg1)
+{
+    tftp_session_status_t* status = session_param->slot->begin_write();
 
-                    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_ERR,
-                            "tftp_WRQ_session_thread: no ACK. Transfer interrupted");
+    if (type == nu::EVENT_ACK_RECEIVED || type == nu::EVENT_DATA_RECEIVED)
+        status->info.block = uint16_t(arg1);
+
+    status->info.bytes = session_param->bytes;
+    status->info.srtt_us = session_param->srtt_us;
+    status->info.retransmits = session_param->retransmits;
+    status->info.timeouts = session_param->timeouts;
+    status->active_ms = nu_coarse_ms();
+
+    session_param->slot->end_write();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Publishes the file of a session, once known
+static void tftp_session_file(
+        tftp_session_param* session_param,
+        const char* filename,
+        uint64_t size)
+{
+    if (!session_param->slot)
+        return;
+
+    tftp_session_status_t* status = session_param->slot->begin_write();
+
+    strncpy(status->info.filename, filename, sizeof(status->info.filename) - 1);
+    status->info.size = size;
+
+    session_param->slot->end_write();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Metrics
+
+// Shard of the metrics updated by the current thread
+static thread_local int tftp_metrics_shard = 0;
+
+static void tftp_metric_add(IPC_thread_param* ipc, int id, int64_t delta)
+{
+    if (ipc->metrics)
+        ipc->metrics->add(tftp_metrics_shard, id, delta);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void tftp_metric_set(IPC_thread_param* ipc, int id, int64_t value)
+{
+    if (ipc->metrics)
+        ipc->metrics->set(tftp_metrics_shard, id, value);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void tftp_metric_record(IPC_thread_param* ipc, int id, uint64_t from_us, uint64_t to_us)
+{
+    if (ipc->metrics)
+        ipc->metrics->record(tftp_metrics_shard, id, to_us > from_us ? to_us - from_us : 0);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Times the latencies of a session from its events: the round trip of
+// a block is timed from the DATA (WRQ: ACK) sent to its answer, unless
+// it was sent again, as the answer could be to any of the copies
+static void tftp_time_event(tftp_session_param* session_param, unsigned type)
+{
+    IPC_thread_param* ipc = session_param->server_ipc;
+
+    switch (type) {
+        case nu::EVENT_SESSION_START:
+            tftp_metric_record(ipc, TFTP_HISTOGRAM_ADMISSION_WAIT,
+                    session_param->received_us, session_param->started_us);
+            break;
+
+        case nu::EVENT_DATA_SENT:
+        case nu::EVENT_ACK_SENT:
+            session_param->sent_us = nu_clock_us();
+
+            if (type == nu::EVENT_DATA_SENT && session_param->received_us) {
+                tftp_metric_record(ipc, TFTP_HISTOGRAM_FIRST_DATA,
+                        session_param->received_us, session_param->sent_us);
+
+                session_param->received_us = 0;
+            }
+            break;
+
+        case nu::EVENT_RETRANSMIT:
+            session_param->sent_us = 0;
+            break;
+
+        case nu::EVENT_ACK_RECEIVED:
+        case nu::EVENT_DATA_RECEIVED:
+            if (session_param->sent_us) {
+                uint64_t now = nu_clock_us();
+                uint32_t rtt = uint32_t(now - session_param->sent_us);
+
+                tftp_metric_record(ipc, TFTP_HISTOGRAM_BLOCK_RTT,
+                        session_param->sent_us, now);
+
+                session_param->srtt_us = session_param->srtt_us ?
+                    (7 * session_param->srtt_us + rtt) / 8 : rtt;
+                session_param->sent_us = 0;
+            }
+            break;
+
+        case nu::EVENT_SESSION_END:
+            // Transfers completed, by class of file size
+            if (session_param->err_code == TFTP_ERROR__SUCCESS) {
+                uint64_t bytes = session_param->bytes;
+                int size_class = 
+                    bytes <= (uint64_t(64) << 10) ? 0 :
+                    bytes <= (uint64_t(1) << 20) ? 1 :
+                    bytes <= (uint64_t(16) << 20) ? 2 : 3;
+
+                tftp_metric_record(ipc, TFTP_HISTOGRAM_TRANSFER + size_class,
+                        session_param->started_us, nu_clock_us());
+            }
+            break;
+
+        default:
+            break;
+    }
+}
 
-                    throw 0;
-                }
 
-            } 
-            while (!operation_completed);
+/* -------------------------------------------------------------------------- */
+
+// Appends the contention of the locks (by name) to the metrics
+static void tftp_collect_locks(std::string& text, void*)
+{
+    static const struct {
+        const char* family;
+        const char* help;
+        const char* type;
+    }
+    families[] = {
+        { "tftp_lock_acquisitions_total", "Locks acquired", "counter" },
+        { "tftp_lock_contended_total", "Locks acquired after a wait", "counter" },
+        { "tftp_lock_wait_seconds_total", "Time waited for locks", "counter" },
+        { "tftp_lock_hold_max_seconds", "Longest time a lock was held", "gauge" },
+    };
+
+    char line[160];
+    int count = nu::lock_stats_count();
+
+    for (int f = 0; f < int(sizeof(families) / sizeof(families[0])); ++f) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n",
+                families[f].family, families[f].help,
+                families[f].family, families[f].type);
+        text += line;
+
+        for (int i = 0; i < count; ++i) {
+            const nu::lock_stats_t* stats = nu::lock_stats_at(i);
+
+            switch (f) {
+                case 0:
+                    snprintf(line, sizeof(line), "%s{lock=\"%s\"} %llu\n",
+                            families[f].family, stats->name,
+                            (unsigned long long)stats->acquisitions.load());
+                    break;
+                case 1:
+                    snprintf(line, sizeof(line), "%s{lock=\"%s\"} %llu\n",
+                            families[f].family, stats->name,
+                            (unsigned long long)stats->contended.load());
+                    break;
+                case 2:
+                    snprintf(line, sizeof(line), "%s{lock=\"%s\"} %.9f\n",
+                            families[f].family, stats->name,
+                            stats->wait_ns.load() / 1e9);
+                    break;
+                default:
+                    snprintf(line, sizeof(line), "%s{lock=\"%s\"} %.9f\n",
+                            families[f].family, stats->name,
+                            stats->max_hold_ns.load() / 1e9);
+                    break;
+            }
 
+            text += line;
         }
-        else {
-            throw 0;
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Registers the metrics (a shard for the listener, one per worker) and
+// starts their endpoint, if any
+static void tftp_start_metrics(IPC_thread_param* ipc)
+{
+    static const struct {
+        const char* family;
+        const char* labels;
+        const char* help;
+        nu::metrics::type_t type;
+    }
+    table[TFTP_METRIC_COUNT] = {
+        { "tftp_requests_total", "opcode=\"RRQ\"", 
+            "Requests received", nu::metrics::COUNTER },
+        { "tftp_requests_total", "opcode=\"WRQ\"", 
+            "Requests received", nu::metrics::COUNTER },
+        { "tftp_requests_rejected_total", 0, 
+            "Requests refused as the server was busy", nu::metrics::COUNTER },
+        { "tftp_bytes_sent_total", 0, 
+            "Bytes of file data sent, retransmissions included", nu::metrics::COUNTER },
+        { "tftp_bytes_received_total", 0, 
+            "Bytes of file data received", nu::metrics::COUNTER },
+        { "tftp_blocks_retransmitted_total", 0, 
+            "DATA or ACK sent again", nu::metrics::COUNTER },
+        { "tftp_timeouts_total", 0, 
+            "Waits for a packet of the peer timed out", nu::metrics::COUNTER },
+        { "tftp_errors_total", "code=\"0\"", "Sessions failed, by error code", nu::metrics::COUNTER },
+        { "tftp_errors_total", "code=\"1\"", "Sessions failed, by error code", nu::metrics::COUNTER },
+        { "tftp_errors_total", "code=\"2\"", "Sessions failed, by error code", nu::metrics::COUNTER },
+        { "tftp_errors_total", "code=\"3\"", "Sessions failed, by error code", nu::metrics::COUNTER },
+        { "tftp_errors_total", "code=\"4\"", "Sessions failed, by error code", nu::metrics::COUNTER },
+        { "tftp_errors_total", "code=\"5\"", "Sessions failed, by error code", nu::metrics::COUNTER },
+        { "tftp_errors_total", "code=\"6\"", "Sessions failed, by error code", nu::metrics::COUNTER },
+        { "tftp_errors_total", "code=\"7\"", "Sessions failed, by error code", nu::metrics::COUNTER },
+        { "tftp_file_cache_hits_total", 0, 
+            "Files of RRQ found in the metadata cache", nu::metrics::COUNTER },
+        { "tftp_file_cache_misses_total", 0, 
+            "Files of RRQ not found in the metadata cache", nu::metrics::COUNTER },
+        { "tftp_sessions_active", 0, 
+            "Sessions running", nu::metrics::GAUGE },
+        { "tftp_admission_queue_depth", 0, 
+            "Requests waiting for a slot", nu::metrics::GAUGE },
+    };
+
+    static const struct {
+        const char* family;
+        const char* labels;
+        const char* help;
+    }
+    histograms[TFTP_HISTOGRAM_COUNT] = {
+        { "tftp_admission_wait_seconds", 0,
+            "Time from a request to the start of its session" },
+        { "tftp_first_data_seconds", 0,
+            "Time from a RRQ to its first DATA sent" },
+        { "tftp_block_rtt_seconds", 0,
+            "Time from a DATA (WRQ: ACK) sent once to its answer" },
+        { "tftp_transfer_seconds", "file_size=\"64K\"",
+            "Duration of the transfers completed, by file size (up to)" },
+        { "tftp_transfer_seconds", "file_size=\"1M\"",
+            "Duration of the transfers completed, by file size (up to)" },
+        { "tftp_transfer_seconds", "file_size=\"16M\"",
+            "Duration of the transfers completed, by file size (up to)" },
+        { "tftp_transfer_seconds", "file_size=\"+Inf\"",
+            "Duration of the transfers completed, by file size (up to)" },
+    };
+
+    ipc->metrics = new nu::metrics(ipc->worker_count + 1);
+
+    for (int i = 0; i < TFTP_METRIC_COUNT; ++i) {
+        ipc->metrics->add_metric(table[i].family, table[i].labels, 
+                table[i].help, table[i].type);
+    }
+
+    for (int i = 0; i < TFTP_HISTOGRAM_COUNT; ++i) {
+        ipc->metrics->add_histogram(histograms[i].family, histograms[i].labels,
+                histograms[i].help);
+    }
+
+    if (ipc->options.lock_stats) {
+        nu::set_lock_stats(true);
+        ipc->metrics->add_collector(tftp_collect_locks, 0);
+    }
+
+    if (ipc->options.metrics_port) {
+        ipc->metrics_endpoint = new nu::metrics_endpoint(
+                ipc->metrics, ipc->options.metrics_port);
+
+        if (!ipc->metrics_endpoint->start()) {
+            NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_WRN,
+                    "tftp_start_metrics: port %i not available", 
+                    int(ipc->options.metrics_port));
+
+            delete ipc->metrics_endpoint;
+            ipc->metrics_endpoint = 0;
         }
     }
-    catch (int) {}
+}
 
-    //Free all allocated resources
-    active_connection_list__delete(session_param->session_index);
-    nu_free_sock(tftpd_session);
-    session_param->server_ipc->opened_sessions--;
 
-    NU_TRACE("[TFTP]", NU_TM_TFTP, NU_TL_DBG,
-            "tftp_WRQ_session_thread- (sessions = %i)",
-            session_param->server_ipc->opened_sessions);
+/* -------------------------------------------------------------------------- */
 
-    free_session(session_param);
+// Session workers
+
+static nu::task<> tftp_worker_session(tftp_worker_t* worker, tftp_session_desc_t desc)
+{
+    uint64_t started = nu_coarse_ms();
+
+    desc.param->started_ms = started;
+    desc.param->started_us = nu_clock_us();
+
+    //Its state is published in a free slot of the worker
+    tftp_session_slot_t* slot = worker->slots;
+
+    while (slot->data().info.session_id)
+        ++slot;
+
+    tftp_session_status_t* status = slot->begin_write();
+    memset(status, 0, sizeof(tftp_session_status_t));
+    status->info.session_id = desc.param->session_id;
+    status->info.peer_addr = desc.param->fromAddr;
+    status->info.peer_port = desc.param->fromPort;
+    status->info.opcode = desc.opcode;
+    status->info.rto_ms = TFTP_RECV_TIMEOUT * 1000;
+    status->started_ms = started;
+    status->active_ms = started;
+    slot->end_write();
+
+    desc.param->slot = slot;
+    tftp_event(desc.param, nu::EVENT_SESSION_START, desc.opcode, 0);
+    tftp_metric_add(worker->ipc, TFTP_METRIC_SESSIONS_ACTIVE, 1);
+
+    if (desc.opcode == TFTP_RRQ)
+        co_await tftp_RRQ_session(desc.param, &worker->loop);
+    else
+        co_await tftp_WRQ_session(desc.param, &worker->loop);
+
+    tftp_metric_add(worker->ipc, TFTP_METRIC_SESSIONS_ACTIVE, -1);
+
+    slot->begin_write()->info.session_id = 0;
+    slot->end_write();
+    worker->load--;
+
+    //The slot is free: a request waiting can be started
+    worker->ipc->admission->release(nu_coarse_ms() - started);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Bytes of the coroutine frames of a session waiting for a packet: its
+// worker coroutine, the session, its transfer and the receive awaited.
+// Coroutines are lazy: they are created, measured and destroyed unrun
+static size_t tftp_session_frames_size()
+{
+    tftp_session_param param;
+    tftp_transfer_t transfer;
+    tftp_session_desc_t desc = { &param, TFTP_RRQ };
+    struct timeval timeout = {};
+    size_t frames[2];
+
+    for (int i = 0; i < 2; ++i) {
+        size_t base = nu::detail::frame_allocator::allocated();
+
+        nu::task<> worker_session = tftp_worker_session(0, desc);
+        nu::task<> session = i == 0 ?
+            tftp_RRQ_session(&param, 0) : tftp_WRQ_session(&param, 0);
+        nu::task<int> transfer_task = i == 0 ?
+            tftp_RRQ_transfer(&param, 0, &transfer) :
+            tftp_WRQ_transfer(&param, 0, &transfer);
+        nu::task<int> recv = tftp_session_recv(&param, 0, -1, 0, false, 0, 0, 0, &timeout);
+
+        frames[i] = nu::detail::frame_allocator::allocated() - base;
+    }
+
+    return frames[0] > frames[1] ? frames[0] : frames[1];
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void* tftp_worker_thread(void* arg)
+{
+    tftp_worker_t* worker = (tftp_worker_t*)arg;
+    int max_sessions = worker->ipc->options.worker_sessions;
+    tftp_session_desc_t desc;
+    bool stopping = false;
+
+    tftp_metrics_shard = int(worker - worker->ipc->workers) + 1;
+
+    while (!stopping || worker->loop.tasks() > 0) {
+        //Requests beyond max_sessions stay queued: a full ring
+        //pushes back on the listener
+        while (!stopping && 
+                worker->loop.tasks() < max_sessions && 
+                worker->ring.pop(&desc))
+        {
+            if (!desc.param) {
+                stopping = true; // stop request
+                break;
+            }
+
+            //A single session per worker runs as a blocking thread
+            if (max_sessions > 1)
+                worker->loop.spawn(tftp_worker_session(worker, desc));
+            else
+                worker->loop.run_until(tftp_worker_session(worker, desc));
+        }
+
+        if (stopping && worker->loop.tasks() == 0)
+            break;
 
-    if (file) 
-        fclose(file);
+        worker->loop.run_once();
+    }
 
     return 0;
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+static bool tftp_start_workers(IPC_thread_param* ipc)
+{
+    int sessions = ipc->options.worker_sessions;
+
+    if (sessions < 1)
+        sessions = ipc->options.worker_sessions = 1;
+
+    int count = (ipc->max_sessions + sessions - 1) / sessions;
+
+    ipc->workers = new tftp_worker_t[count];
+    ipc->worker_count = 0;
+
+    for (int i = 0; i < count; ++i) {
+        tftp_worker_t* worker = &ipc->workers[i];
+        unsigned long targs[4] = { (unsigned long)worker };
+
+        worker->ipc = ipc;
+        worker->slots = new tftp_session_slot_t[sessions];
+        worker->loop.attach(&worker->sends);
+
+        if (!worker->loop.valid() ||
+                t_start(worker->tid, (void*)tftp_worker_thread, targs,
+                    false, TFTP_SESSION_STACK_SIZE) != CALL_SUCCESS)
+        {
+            break;
+        }
+
+        ipc->worker_count++;
+    }
+
+    return ipc->worker_count > 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Workers complete the requests already queued, then exit
+static void tftp_stop_workers(IPC_thread_param* ipc)
+{
+    tftp_session_desc_t stop;
+    stop.param = 0;
+    stop.opcode = 0;
+
+    for (int i = 0; i < ipc->worker_count; ++i) {
+        tftp_worker_t* worker = &ipc->workers[i];
+
+        while (!worker->ring.push(stop))
+            sched_yield();
+
+        worker->loop.notify();
+    }
+
+    for (int i = 0; i < ipc->worker_count; ++i)
+        pthread_join(pthread_t(ipc->workers[i].tid), NULL);
+
+    delete [] ipc->workers;
+    ipc->workers = 0;
+    ipc->worker_count = 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Queues a request to the least loaded worker (an idle one, if any).
+// Returns false if the queues of all the workers are full
+static bool tftp_dispatch(IPC_thread_param* ipc, const tftp_session_desc_t& desc)
+{
+    int count = ipc->worker_count;
+    int first = int(ipc->next_worker++ % unsigned(count));
+    int best = first;
+
+    for (int i = 0; i < count; ++i) {
+        int w = (first + i) % count;
+
+        if (ipc->workers[w].load < ipc->workers[best].load)
+            best = w;
+
+        if (ipc->workers[best].load == 0)
+            break;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        tftp_worker_t* worker = &ipc->workers[(best + i) % count];
+
+        worker->load++;
+
+        if (worker->ring.push(desc)) {
+            worker->loop.notify();
+            return true;
+        }
+
+        worker->load--;
+    }
+
+    return false;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 // Active connections list management functions
@@ -1152,6 +3292,96 @@ int trace_level_signal2(int sig)
 #define DEFAULT_W_PATH "/tmp";
 
 
+/* -------------------------------------------------------------------------- */
+
+// Parses an option in the form --name[=value], returns false if unknown
+static bool parse_option(const char* arg, tftp_server_options_t* options)
+{
+    string name = arg + 2;
+    string value;
+
+    size_t eq = name.find('=');
+
+    if (eq != string::npos) {
+        value = name.substr(eq + 1);
+        name = name.substr(0, eq);
+    }
+
+    if (name == "multicast") {
+        options->multicast = true;
+    }
+    else if (name == "mcast-addr" && !value.empty()) {
+        strncpy(options->mcast_addr, value.c_str(), sizeof(options->mcast_addr) - 1);
+    }
+    else if (name == "mcast-port" && !value.empty()) {
+        options->mcast_port = (unsigned short) atoi(value.c_str());
+    }
+    else if (name == "mcast-if" && !value.empty()) {
+        strncpy(options->mcast_if, value.c_str(), sizeof(options->mcast_if) - 1);
+    }
+    else if (name == "mcast-ttl" && !value.empty()) {
+        options->mcast_ttl = atoi(value.c_str());
+    }
+    else if (name == "sock-pool" && !value.empty()) {
+        options->sock_pool_size = atoi(value.c_str());
+    }
+    else if (name == "sock-sndbuf" && !value.empty()) {
+        options->sock_sndbuf = atoi(value.c_str());
+    }
+    else if (name == "sock-rcvbuf" && !value.empty()) {
+        options->sock_rcvbuf = atoi(value.c_str());
+    }
+    else if (name == "demux" && !value.empty()) {
+        options->demux_sockets = atoi(value.c_str());
+    }
+    else if (name == "strict-tid") {
+        options->strict_tid = true;
+    }
+    else if (name == "hugepages") {
+        options->hugepages = true;
+    }
+    else if (name == "worker-sessions" && !value.empty()) {
+        options->worker_sessions = atoi(value.c_str());
+    }
+    else if (name == "admission-queue" && !value.empty()) {
+        options->admission_queue = atoi(value.c_str());
+    }
+    else if (name == "admission-budget" && !value.empty()) {
+        options->admission_budget = atoi(value.c_str());
+    }
+    else if (name == "weights" && !value.empty()) {
+        strncpy(options->sched_weights, value.c_str(), sizeof(options->sched_weights) - 1);
+    }
+    else if (name == "rate" && !value.empty()) {
+        if (!tftp_parse_rate(value, &options->egress_rate))
+            return false;
+    }
+    else if (name == "subnet-rates" && !value.empty()) {
+        strncpy(options->subnet_rates, value.c_str(), sizeof(options->subnet_rates) - 1);
+    }
+    else if (name == "event-log" && !value.empty()) {
+        strncpy(options->event_log, value.c_str(), sizeof(options->event_log) - 1);
+    }
+    else if (name == "event-log-size" && !value.empty()) {
+        options->event_log_size = atoi(value.c_str());
+    }
+    else if (name == "access-log" && !value.empty()) {
+        strncpy(options->access_log, value.c_str(), sizeof(options->access_log) - 1);
+    }
+    else if (name == "metrics-port" && !value.empty()) {
+        options->metrics_port = (unsigned short) atoi(value.c_str());
+    }
+    else if (name == "lock-stats") {
+        options->lock_stats = true;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 int main(int argc, char* argv[])
@@ -1169,9 +3399,43 @@ int main(int argc, char* argv[])
             "nuTFTPServer 1.0 - antonino.calderone@gmail.com");
 
     NU_TRACE_INF("[TFTP]",
-            "Usage: %s [GET_DIR] [PUT_DIR] [max_concurrent_sessions] [trace_level]", 
+            "Usage: %s [options] [GET_DIR] [PUT_DIR] [max_concurrent_sessions] [trace_level]", 
             argv[0]);
 
+    NU_TRACE_INF("[TFTP]",
+            "Options: --multicast --mcast-addr=ADDR --mcast-port=PORT "
+            "--mcast-if=ADDR --mcast-ttl=TTL --sock-pool=N "
+            "--sock-sndbuf=BYTES --sock-rcvbuf=BYTES --demux=SOCKETS --strict-tid "
+            "--hugepages --worker-sessions=N --admission-queue=N "
+            "--admission-budget=MS --weights=RULES --rate=BYTES "
+            "--subnet-rates=RULES --trace-file=PATH --event-log=PATH "
+            "--event-log-size=MB --access-log=PATH --metrics-port=PORT "
+            "--lock-stats");
+
+    tftp_server_options_t options;
+    const char* trace_file = 0;
+    tftp_get_default_options(&options);
+
+    // Options can be given anywhere, the other arguments are positional
+    int n_args = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--trace-file=", 13) == 0) {
+            trace_file = argv[i] + 13;
+        }
+        else if (strncmp(argv[i], "--", 2) == 0) {
+            if (!parse_option(argv[i], &options)) {
+                NU_TRACE_INF("[TFTP]", 
+                        "WARNING: unknown option %s ignored", argv[i]);
+            }
+        }
+        else {
+            argv[n_args++] = argv[i];
+        }
+    }
+
+    argc = n_args;
+
     string r_path = DEFAULT_R_PATH;
     string w_path = DEFAULT_W_PATH;
     int max_sessions = TFTP_MAX_CONNECTION;
@@ -1209,18 +3473,80 @@ int main(int argc, char* argv[])
     else if (NU_TRACE_LEVEL > NU_TL_PED) 
         NU_TRACE_LEVEL = NU_TL_PED;
 
-    TFTPD_HANDLE handle = tftp_start_server(
+    if (NU_TRACE_LEVEL > NU_TRACE_COMPILE_LEVEL) {
+        NU_TRACE_INF("[TFTP]", "WARNING: traces beyond level %i not compiled in",
+                int(NU_TRACE_COMPILE_LEVEL));
+    }
+
+    // Sessions must not wait for the terminal: traces are written by
+    // a background thread
+    if (!nu_trace_start(trace_file)) {
+        NU_TRACE_INF("[TFTP]", "WARNING: cannot trace to %s, synchronous tracing",
+                trace_file ? trace_file : "stdout");
+    }
+
+    TFTPD_HANDLE handle = tftp_start_server_ex(
             0 /*unused*/,
             max_sessions,
             r_path.c_str(),
             w_path.c_str(),
-            69, trace_level);
+            69, trace_level,
+            &options);
 
     NU_TRACE_INF("[TFTP]", "GET_DIR=%s", r_path.c_str());
     NU_TRACE_INF("[TFTP]", "PUT_DIR=%s", w_path.c_str());
     NU_TRACE_INF("[TFTP]", "tmax_concurrent_sessions=%i", max_sessions);
     NU_TRACE_INF("[TFTP]", "trace_level=%i", NU_TRACE_LEVEL);
 
+    if (options.multicast) {
+        NU_TRACE_INF("[TFTP]", "multicast=%s:%i (if=%s, ttl=%i)", 
+                options.mcast_addr, options.mcast_port, 
+                options.mcast_if, options.mcast_ttl);
+    }
+
+    if (options.demux_sockets > 0)
+        NU_TRACE_INF("[TFTP]", "demux_sockets=%i", options.demux_sockets);
+
+    if (options.strict_tid)
+        NU_TRACE_INF("[TFTP]", "strict_tid=on");
+
+    if (options.worker_sessions > 1)
+        NU_TRACE_INF("[TFTP]", "worker_sessions=%i", options.worker_sessions);
+
+    NU_TRACE_INF("[TFTP]", "admission_queue=%i (budget=%i ms)",
+            options.admission_queue, options.admission_budget);
+
+    if (options.sched_weights[0])
+        NU_TRACE_INF("[TFTP]", "weights=%s", options.sched_weights);
+
+    if (options.egress_rate)
+        NU_TRACE_INF("[TFTP]", "rate=%llu bytes/s",
+                (unsigned long long)options.egress_rate);
+
+    if (options.subnet_rates[0])
+        NU_TRACE_INF("[TFTP]", "subnet_rates=%s", options.subnet_rates);
+
+    if (options.event_log[0]) {
+        NU_TRACE_INF("[TFTP]", "event_log=%s (%i MB x %i files)",
+                options.event_log, options.event_log_size, TFTP_EVENT_LOG_FILES);
+    }
+
+    if (options.access_log[0])
+        NU_TRACE_INF("[TFTP]", "access_log=%s", options.access_log);
+
+    if (options.metrics_port) {
+        NU_TRACE_INF("[TFTP]", "metrics=http://127.0.0.1:%i/metrics",
+                int(options.metrics_port));
+    }
+
+    if (options.lock_stats)
+        NU_TRACE_INF("[TFTP]", "lock_stats=on");
+
+    if (handle) {
+        NU_TRACE_INF("[TFTP]", "session_footprint=%u bytes per idle session",
+                unsigned(tftp_get_session_footprint(handle)));
+    }
+
     while (handle)
         sleep(1);
 
@@ -23,8 +23,29 @@
 #define TFTP_SERVER_PORT 69       //!< standard TFTP port
 #define TFTP_MAX_CONNECTION 16
 
+#define TFTP_SESSION_STACK_SIZE (64 << 10) //!< stack of a session worker
+#define TFTP_WORKER_QUEUE_SIZE 16 //!< requests queued to a session worker
+#define TFTP_WORKER_SESSIONS 1 //!< sessions run at a time by a worker
+
+//!Requests waiting for a session slot
+#define TFTP_ADMISSION_QUEUE_SIZE 256
+#define TFTP_ADMISSION_BUDGET 5000 //!< ms, max wait of a request
+#define TFTP_ADMISSION_SWEEP_PERIOD 100 //!< ms, expiry check of the requests
+
+//!Fair scheduling of the DATA sent by the sessions of a worker
+#define TFTP_SCHED_BATCH (64 << 10) //!< bytes sent by a worker per batch
+#define TFTP_SCHED_MAX_RULES 16     //!< weight or rate rules
+
+//!Egress rate limits
+#define TFTP_RATE_BURST 50 //!< ms of traffic which may be sent at once
+
+//!Binary event log
+#define TFTP_EVENT_LOG_SIZE 64   //!< MB, size of a file of the log
+#define TFTP_EVENT_LOG_FILES 4   //!< files kept (the current one included)
+
 #define TFTP_RECV_TIMEOUT 1       //!< secs
 #define TFTP_RECV_ATTEMPTS 2
+#define TFTP_DALLY_TIMEOUT 1      //!< secs, wait for a retransmitted last block
 
 //!max number of tftpd daemons that is possible to run
 //!(that's different than number of sessions!!!)
@@ -32,12 +53,96 @@
 //!service, that for default is 69, and each tftpd daemon can have
 #define TFTPD_IPC_POOL_SIZE 3 
 
+//!Multicast TFTP (RFC 2090) defaults
+#define TFTP_MCAST_ADDR "239.255.69.1" //!< address of the first group
+#define TFTP_MCAST_PORT 1758
+#define TFTP_MCAST_TTL  1
+
+//!Session sockets defaults
+#define TFTP_SOCK_POOL_SIZE TFTP_MAX_CONNECTION //!< sockets ready for new sessions
+#define TFTP_SOCK_SNDBUF 32768
+#define TFTP_SOCK_RCVBUF 32768
+
 
 /* -------------------------------------------------------------------------- */
 
 typedef void* TFTPD_HANDLE;
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Optional features of a tftpd server
+ * (use tftp_get_default_options to initialize it)
+ */
+typedef struct _tftp_server_options_t {
+    bool multicast;              //!< accept the multicast option (RFC 2090)
+    char mcast_addr[16];         //!< address of the first multicast group
+    unsigned short mcast_port;   //!< port of the multicast groups
+    char mcast_if[16];           //!< address of the interface used to send
+    int mcast_ttl;               //!< time to live of the multicast datagrams
+    int sock_pool_size;          //!< count of pre-bound session sockets
+    int sock_sndbuf;             //!< SO_SNDBUF of session sockets (0 = default)
+    int sock_rcvbuf;             //!< SO_RCVBUF of session sockets (0 = default)
+    int demux_sockets;           //!< sockets shared by the sessions (0 = one each)
+    bool strict_tid;             //!< answer the datagrams of other TIDs with
+                                 //!< an error (session sockets unconnected)
+    bool hugepages;              //!< map the packet buffers on huge pages
+    int worker_sessions;         //!< sessions interleaved by a worker 
+                                 //!< (1 = a thread per session)
+    int admission_queue;         //!< requests waiting for a slot (0 = none)
+    int admission_budget;        //!< ms a request may wait for a slot
+    char sched_weights[256];     //!< weights of the transfers, comma separated
+                                 //!< ADDR/BITS=W (client subnet) or
+                                 //!< .EXT=W (file class), 1 by default
+    uint64_t egress_rate;        //!< bytes/s sent by the server (0 = no limit)
+    char subnet_rates[256];      //!< bytes/s sent to a client subnet, comma
+                                 //!< separated ADDR/BITS=RATE (no limit else)
+    char event_log[256];         //!< binary log of the events (empty = none)
+    int event_log_size;          //!< MB of a file of the event log
+    char access_log[256];        //!< JSON lines, one per transfer (empty = none)
+    unsigned short metrics_port; //!< loopback port serving the metrics
+                                 //!< to Prometheus (0 = none)
+    bool lock_stats;             //!< record the contention of the locks,
+                                 //!< exported with the metrics
+}
+tftp_server_options_t;
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * State of a session, as returned by tftp_get_sessions
+ */
+typedef struct _tftp_session_info_t {
+    uint32_t session_id;
+    uint32_t peer_addr;          //!< host byte order
+    uint16_t peer_port;
+    uint16_t opcode;             //!< TFTP_RRQ (sending) or TFTP_WRQ (receiving)
+    char filename[256];          //!< as requested (empty until parsed)
+    uint16_t block;              //!< last block acknowledged (RRQ) or received (WRQ)
+    uint64_t bytes;              //!< of the file, transferred so far
+    uint64_t size;               //!< of the file (0 = unknown)
+    uint32_t rto_ms;             //!< wait for a packet before sending again
+    uint32_t srtt_us;            //!< smoothed round trip of a block (0 = no sample)
+    uint32_t retransmits;
+    uint32_t timeouts;
+    uint32_t age_ms;             //!< since the session started
+    uint32_t idle_ms;            //!< since the last packet sent or received
+}
+tftp_session_info_t;
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * This function fills a tftp_server_options_t with the default values
+ *
+ *  @param options: [out] options of a tftpd server
+ */
+void tftp_get_default_options(tftp_server_options_t* options);
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -64,6 +169,25 @@ TFTPD_HANDLE tftp_start_server(
         int trace_level);
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * This function starts the TFTP server enabling optional features
+ *
+ *  @param options: [in] optional features (0 means default options)
+ *  @see tftp_start_server for the other parameters
+ *  @return TFTPD_HANDLE: if function successes, returns a non-zero handle
+ */
+TFTPD_HANDLE tftp_start_server_ex(
+        int task_prio,
+        int max_sessions,
+        const char* r_path,
+        const char* w_path,
+        unsigned short port_of_service,
+        int trace_level,
+        const tftp_server_options_t* options);
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -136,6 +260,74 @@ bool tftp_stop_cmd_issued(TFTPD_HANDLE handle);
 int tftp_get_last_server_error_code(TFTPD_HANDLE handle);
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * This function returns the count of requests refused (with an ERROR)
+ * as the server was busy
+ *
+ * NOTE:                                                                      
+ *  - the handle must be a valid TFTPD_HANDLE
+ *
+ *  @param handle: [in] handle of a tftpd server
+ *  @return unsigned int: count of requests rejected
+ */
+unsigned int tftp_get_rejected_requests_count(TFTPD_HANDLE handle);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * This function returns the memory held by a session waiting for a
+ * packet: its state, its packet buffer, the frames of its coroutines and,
+ * in demux mode, the queue of its channel (the path of its file, 
+ * allocated apart, is excluded)
+ *
+ * NOTE:                                                                      
+ *  - the handle must be a valid TFTPD_HANDLE
+ *
+ *  @param handle: [in] handle of a tftpd server
+ *  @return size_t: bytes per session
+ */
+size_t tftp_get_session_footprint(TFTPD_HANDLE handle);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * This function takes a snapshot of the sessions running, without 
+ * stopping them: the state of each session is read consistently, 
+ * though not at the same instant as the one of the other sessions
+ *
+ * NOTE:                                                                      
+ *  - the handle must be a valid TFTPD_HANDLE
+ *
+ *  @param handle: [in] handle of a tftpd server
+ *  @param sessions: [out] the sessions
+ *  @param max: [in] size of sessions
+ *  @return int: count of sessions written
+ */
+int tftp_get_sessions(TFTPD_HANDLE handle, tftp_session_info_t* sessions, int max);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * This function gets the metrics of the server (requests, bytes, 
+ * retransmissions, errors, sessions running...) in the Prometheus 
+ * text format, the one served on options.metrics_port
+ *
+ * NOTE:                                                                      
+ *  - the handle must be a valid TFTPD_HANDLE
+ *
+ *  @param handle: [in] handle of a tftpd server
+ *  @param buf: [out] the text, null terminated (truncated to size)
+ *  @param size: [in] size of buf
+ *  @return int: length of the whole text
+ */
+int tftp_get_metrics(TFTPD_HANDLE handle, char* buf, int size);
+
+
 /* -------------------------------------------------------------------------- */
 
 #endif
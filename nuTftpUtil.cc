@@ -31,6 +31,64 @@ const char* tftp_file_mode[] =
 };
 
 
+/* -------------------------------------------------------------------------- */
+
+// Keywords of the requests, matched regardless of the case (RFC 1350)
+
+typedef struct _tftp_keyword_t {
+    std::string_view name;
+    uint32_t value;
+}
+tftp_keyword_t;
+
+static constexpr tftp_keyword_t tftp_mode_table[] = {
+    { "netascii", NETASCII },
+    { "octet", OCTET },
+    { "mail", MAIL }
+};
+
+static constexpr tftp_keyword_t tftp_option_table[] = {
+    { "multicast", TFTP_OPTION_MULTICAST }
+};
+
+
+/* -------------------------------------------------------------------------- */
+
+static constexpr char tftp_tolower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+template<size_t N>
+static constexpr uint32_t tftp_lookup(
+        const tftp_keyword_t (&table)[N],
+        std::string_view name,
+        uint32_t not_found)
+{
+    for (size_t i = 0; i < N; ++i) {
+        const std::string_view& keyword = table[i].name;
+
+        if (keyword.size() != name.size())
+            continue;
+
+        size_t j = 0;
+        while (j < name.size() && tftp_tolower(name[j]) == keyword[j])
+            ++j;
+
+        if (j == name.size())
+            return table[i].value;
+    }
+
+    return not_found;
+}
+
+static_assert(tftp_lookup(tftp_mode_table, "OCTET", INVALID_MODE) == OCTET,
+        "modes must be matched regardless of the case");
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -43,6 +101,7 @@ opcode  operation
   3     Data (DATA)
   4     Acknowledgment (ACK)
   5     Error (ERROR)
+  6     Option Acknowledgment (OACK, RFC 2347)
 */
 
 
@@ -123,18 +182,56 @@ tftp_opcode_t tftp_parse_opcode(const char* buffer, uint16_t size)
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+static inline uint16_t tftp_get_uint16(const char* p)
+{
+    return uint16_t((uint8_t(p[0]) << 8) | uint8_t(p[1]));
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Gets the next null terminated string of a packet, removing it
+static bool tftp_next_string(std::string_view* packet, std::string_view* str)
+{
+    size_t end = packet->find('\0');
+
+    if (end == std::string_view::npos)
+        return false;
+
+    *str = packet->substr(0, end);
+    packet->remove_prefix(end + 1);
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool tftp_next_option(
+        std::string_view* option_list,
+        std::string_view* name,
+        std::string_view* value)
+{
+    std::string_view list = *option_list;
+
+    if (!tftp_next_string(&list, name) || !tftp_next_string(&list, value))
+        return false;
+
+    *option_list = list;
+
+    return true;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 uint16_t tftp_format_ACK_packet(
         tftp_ack_t* packet,
         uint16_t block)
 {
-    memset(packet, 0, sizeof(tftp_ack_t));
-
-    packet->op_code = htons((uint16_t) TFTP_ACK);
-    packet->block = htons(block);
-
-    return sizeof(tftp_ack_t);
+    return tftp_build_ACK_packet((char*)packet, block);
 }
 
 
@@ -178,61 +275,55 @@ uint16_t tftp_format_DATA_packet(
         const char* source_data,
         uint16_t size)
 {
-    uint16_t data_size = 0;
+    uint16_t data_size = size < TFTP_MAX_BUFFER_SIZE ? size : TFTP_MAX_BUFFER_SIZE;
 
-    if (source_data)
-        memset(packet, 0, sizeof(tftp_data_t));
-
-    packet->op_code = htons((uint16_t)TFTP_DATA);
-    packet->block = htons(block);
-
-    data_size = size < TFTP_MAX_BUFFER_SIZE ? size : TFTP_MAX_BUFFER_SIZE;
+    tftp_build_DATA_header((char*)packet, block);
 
     if (source_data)
         memcpy(packet->buffer, source_data, data_size);
 
-    return sizeof(tftp_data_t) - TFTP_MAX_BUFFER_SIZE + data_size;
+    return TFTP_HEADER_SIZE + data_size;
 }
 
 
 /* -------------------------------------------------------------------------- */
 
-bool tftp_parse_DATA_packet(
-        tftp_data_t* packet,  //out
+bool tftp_view_DATA_packet(
+        tftp_data_view_t* packet,  //out
         const char* buffer,
-        uint16_t* size) //in=size of udp buffer /out=size of packet data
+        uint16_t size)
 {
-    tftp_opcode_t op_code;
-    uint16_t block;
-    int i = 0;
+    if (size < TFTP_OPCODE_SIZE + sizeof(uint16_t) || 
+            tftp_get_uint16(buffer) != TFTP_DATA)
+    {
+        return false;
+    }
 
-    // Get op-code
-    op_code = tftp_parse_opcode(buffer, *size);
+    packet->block = tftp_get_uint16(buffer + TFTP_OPCODE_SIZE);
+    packet->payload = buffer + TFTP_OPCODE_SIZE + sizeof(uint16_t);
+    packet->size = size - TFTP_OPCODE_SIZE - sizeof(uint16_t);
 
-    if (op_code != TFTP_DATA)
-        return false;
+    return true;
+}
 
-    // Invalidate packet
-    memset(packet, 0, sizeof(tftp_data_t));
 
-    if (*size < TFTP_OPCODE_SIZE)
-        return false;
+/* -------------------------------------------------------------------------- */
 
-    i += TFTP_OPCODE_SIZE;
-    *size -= TFTP_OPCODE_SIZE;
-    packet->op_code = ntohs((uint16_t)op_code);
+bool tftp_parse_DATA_packet(
+        tftp_data_t* packet,  //out
+        const char* buffer,
+        uint16_t* size) //in=size of udp buffer /out=size of packet data
+{
+    tftp_data_view_t view;
 
-    if (*size < sizeof(block))
+    if (!tftp_view_DATA_packet(&view, buffer, *size))
         return false;
 
-    // Get block
-    memcpy(&block, &buffer[i], sizeof(block));
-    packet->block = ntohs(block);
+    *size = view.size < TFTP_MAX_BUFFER_SIZE ? view.size : TFTP_MAX_BUFFER_SIZE;
 
-    i += sizeof(block);
-    *size -= sizeof(block);
-
-    memcpy(packet->buffer, &buffer[i], *size);
+    packet->op_code = TFTP_DATA;
+    packet->block = view.block;
+    memcpy(packet->buffer, view.payload, *size);
 
     return true;
 }
@@ -313,76 +404,72 @@ uint16_t tftp_format_ERROR_packet(
 
 #define SMALLEST_TFTP_REQUEST_PACKET 10
 
-bool tftp_parse_RQ_packet(
-        tftp_request_t* request,  //out
-        char* buffer,
+bool tftp_view_RQ_packet(
+        tftp_request_view_t* request,  //out
+        const char* buffer,
         uint16_t size)
 {
-    int offset = 0, i = 0;
-    char c;
-    uint16_t op_code;
-
     // The size cannot be smaller than the SMALLEST_TFTP_REQUEST_PACKET
     if (size < SMALLEST_TFTP_REQUEST_PACKET)
         return false;
 
-    // Invalidate the request
-    memset(request, 0, sizeof(tftp_request_t));
-
-    // Get the op_code field
-    op_code = tftp_parse_opcode(buffer, size);
+    request->op_code = tftp_parse_opcode(buffer, size);
 
-    if (op_code == TFTP_INVALID_OPCODE)
+    if (request->op_code == TFTP_INVALID_OPCODE)
         return false;
 
-    offset += sizeof(op_code);
-    size -= sizeof(op_code);
-
-    // Starting from offset 1 copy the file name
-    // in the field filename of the request
-    // POST: size should be a positive value
-    //       the filename length shouldn't be greater than TFTP_MAX_FILENAME_SIZE
-    while ((c = buffer[offset]) && size && i < TFTP_MAX_FILENAME_SIZE) {
-        request->filename[i] = c;
-        ++i;      //destination string index
-        ++offset; //offset of source buffer
-        --size;   //remaining size of source packet
+    std::string_view packet(buffer + TFTP_OPCODE_SIZE, size - TFTP_OPCODE_SIZE);
+
+    if (!tftp_next_string(&packet, &request->filename) ||
+            !tftp_next_string(&packet, &request->mode) ||
+            request->filename.size() >= TFTP_MAX_FILENAME_SIZE)
+    {
+        return false;
     }
 
-    // Skip the string termination char (NULL)
-    --size;
-    ++offset;
+    request->fmode = 
+        tftp_fmode_t(tftp_lookup(tftp_mode_table, request->mode, INVALID_MODE));
 
-    if (!size || i >= TFTP_MAX_FILENAME_SIZE)
+    if (request->fmode == INVALID_MODE)
         return false;
 
-    // Copy the mode string
-    i = 0;
-    while ((c = buffer[offset]) && size && i < TFTP_MAX_MODESTRING_SIZE) {
-        request->mode[i] = c;
-        ++i;      //destination string index
-        ++offset; //offset of source buffer
-        --size;   //remaining size of source packet
-    }
+    // Options (RFC 2347): pairs of null terminated name/value strings.
+    // Unknown options are ignored, a truncated tail is discarded
+    request->option_list = packet;
+    request->options = 0;
 
-    if (!size || i >= TFTP_MAX_MODESTRING_SIZE)
-        return false;
+    std::string_view name, value;
 
-    // Resolve the file mode, and validate the request
-    request->fmode = INVALID_MODE;
-    for (i = 0; i < int(sizeof(tftp_file_mode) / sizeof(const char*)); ++i) {
-        if (((tftp_fmode_t)i) == INVALID_MODE)
-            return false;
+    while (tftp_next_option(&packet, &name, &value))
+        request->options |= tftp_lookup(tftp_option_table, name, 0);
 
-        if (strcmp(request->mode, tftp_file_mode[i]) == 0) {
-            request->fmode = (tftp_fmode_t)i;
-            break;
-        }
-    }
+    return true;
+}
 
-    if (request->fmode == INVALID_MODE)
+
+/* -------------------------------------------------------------------------- */
+
+bool tftp_parse_RQ_packet(
+        tftp_request_t* request,  //out
+        char* buffer,
+        uint16_t size)
+{
+    tftp_request_view_t view;
+
+    if (!tftp_view_RQ_packet(&view, buffer, size))
         return false;
 
+    request->op_code = view.op_code;
+    request->fmode = view.fmode;
+    request->options = view.options;
+
+    // A valid mode is shorter than TFTP_MAX_MODESTRING_SIZE
+    memcpy(request->filename, view.filename.data(), view.filename.size());
+    request->filename[view.filename.size()] = 0;
+
+    memcpy(request->mode, view.mode.data(), view.mode.size());
+    request->mode[view.mode.size()] = 0;
+
     return true;
 }
 
@@ -425,6 +512,43 @@ uint16_t tftp_format_RQ_packet(
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+// returns the size of the packet, 0 if the options do not fit into it
+uint16_t tftp_format_OACK_packet(
+        char* packet,
+        uint16_t max_size,
+        const char* const* names,
+        const char* const* values,
+        int count)
+{
+    uint16_t opCode = htons((uint16_t)TFTP_OACK);
+    int packet_size = 0;
+
+    if (max_size < sizeof(opCode))
+        return 0;
+
+    memcpy(packet, &opCode, sizeof(opCode));
+    packet_size += sizeof(opCode);
+
+    for (int i = 0; i < count; ++i) {
+        int name_len = strlen(names[i]) + 1;
+        int value_len = strlen(values[i]) + 1;
+
+        if (packet_size + name_len + value_len > max_size)
+            return 0;
+
+        memcpy(packet + packet_size, names[i], name_len);
+        packet_size += name_len;
+
+        memcpy(packet + packet_size, values[i], value_len);
+        packet_size += value_len;
+    }
+
+    return packet_size;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 // TFTP packet commuunication utility functions
@@ -466,6 +590,62 @@ bool tftp_send_DATA(
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+// The header is built apart and gathered with the payload, so that the
+// payload can be sent from wherever it lives (e.g. a shared block buffer)
+bool tftp_send_DATA_payload(
+        int sd,
+        uint32_t toAddr,
+        uint16_t toPort,
+        uint16_t block,
+        const char* payload,
+        uint16_t size)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void*)payload;
+    iov.iov_len = size < TFTP_MAX_BUFFER_SIZE ? size : TFTP_MAX_BUFFER_SIZE;
+
+    return tftp_send_DATA_iov(sd, toAddr, toPort, block, &iov, size ? 1 : 0);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// As tftp_send_DATA_payload, for a payload split in several regions
+// (e.g. wrapping around the end of a ring buffer)
+bool tftp_send_DATA_iov(
+        int sd,
+        uint32_t toAddr,
+        uint16_t toPort,
+        uint16_t block,
+        const struct iovec* payload,
+        int iovcnt)
+{
+    enum { MAX_IOV = 8 };
+
+    char header[TFTP_HEADER_SIZE];
+    struct iovec iov[MAX_IOV + 1];
+
+    if (iovcnt > MAX_IOV)
+        return false;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = tftp_build_DATA_header(header, block);
+
+    for (int i = 0; i < iovcnt; ++i)
+        iov[i + 1] = payload[i];
+
+    return 0 < nu_sendmsg(sd,
+            iov,
+            iovcnt + 1,
+            DEFULT_FLAGS,
+            toAddr,
+            toPort);
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 bool tftp_send_ACK(
@@ -474,16 +654,39 @@ bool tftp_send_ACK(
         uint16_t toPort,
         uint16_t block)
 {
-    tftp_ack_t tftp_ack;
+    char packet[TFTP_HEADER_SIZE];
 
-    uint16_t packet_size = 0;
-    packet_size = tftp_format_ACK_packet(&tftp_ack, block);
+    uint16_t packet_size = tftp_build_ACK_packet(packet, block);
 
     return 0 < nu_sendto(sd,
-            (const char*)&tftp_ack,
+            packet,
             packet_size,
             DEFULT_FLAGS,
             toAddr,
             toPort);
 }
 
+
+
+/* -------------------------------------------------------------------------- */
+
+bool tftp_send_OACK(
+        int sd,
+        uint32_t toAddr,
+        uint16_t toPort,
+        const char* const* names,
+        const char* const* values,
+        int count)
+{
+    char packet[TFTP_MAX_BUFFER_SIZE];
+
+    uint16_t packet_size = 
+        tftp_format_OACK_packet(packet, sizeof(packet), names, values, count);
+
+    return packet_size > 0 && 0 < nu_sendto(sd,
+            packet,
+            packet_size,
+            DEFULT_FLAGS,
+            toAddr,
+            toPort);
+}
@@ -18,6 +18,8 @@
 #include <sys/syslimits.h>
 #endif
 #include <stdint.h>
+#include <string_view>
+#include <netinet/in.h>
 #include "nuSockTool.h"
 
 
@@ -39,7 +41,8 @@ typedef uint16_t tftp_opcode_t;
 #define TFTP_DATA           3
 #define TFTP_ACK            4
 #define TFTP_ERROR          5
-#define TFTP_INVALID_OPCODE 6
+#define TFTP_OACK           6
+#define TFTP_INVALID_OPCODE 7
 
 typedef enum _tftp_error_codes_index_t {
     TFTP_ERROR__NOT_DEFINED,
@@ -77,6 +80,10 @@ ACK   | 04    |   Block #  |
        ----------------------------------------
 ERROR | 05    |  ErrorCode |   ErrMsg   |   0  |
        ----------------------------------------
+       2 bytes  string   1 byte   string   1 byte
+       -------------------------------------------------
+OACK  | 06    |  opt1  |   0  |  value1  |   0  | ...   (RFC 2347)
+       -------------------------------------------------
 */
 
 
@@ -118,18 +125,58 @@ tftp_error_t;
 #define TFTP_MAX_MODESTRING_SIZE 32
 #define TFTP_MAX_FILENAME_SIZE PATH_MAX
 
+//Options (RFC 2347) recognized in a request
+#define TFTP_OPTION_MULTICAST 0x00000001  //!< RFC 2090
+
 typedef struct _tftp_request_t {
     tftp_opcode_t op_code; // RRQ/WRQ
     char filename[TFTP_MAX_FILENAME_SIZE];
     char mode[TFTP_MAX_MODESTRING_SIZE];
     tftp_fmode_t fmode;
+    uint32_t options; // TFTP_OPTION_xxx mask
 }
 tftp_request_t;
 
 
+/* -------------------------------------------------------------------------- */
+
+// Non-owning views of the received packets: they point into the datagram
+// buffer, which must outlive them. Nothing is cleared or copied
+
+typedef struct _tftp_request_view_t {
+    tftp_opcode_t op_code;        // RRQ/WRQ
+    std::string_view filename;    // null terminated in the datagram
+    std::string_view mode;
+    tftp_fmode_t fmode;
+    uint32_t options;             // TFTP_OPTION_xxx mask
+    std::string_view option_list; // name/value pairs, see tftp_next_option
+}
+tftp_request_view_t;
+
+typedef struct _tftp_data_view_t {
+    uint16_t block;
+    const char* payload;
+    uint16_t size;                // size of the payload
+}
+tftp_data_view_t;
+
+
 /* -------------------------------------------------------------------------- */
 // TFTP packet parsing/formatting utility functions
 
+bool tftp_view_RQ_packet(tftp_request_view_t* request, const char* buffer, uint16_t size);
+bool tftp_view_DATA_packet(tftp_data_view_t* packet, const char* buffer, uint16_t size);
+
+/**
+ * Gets the next name/value pair of an option list (RFC 2347), 
+ * removing it from the list
+ *
+ * @param option_list: [in/out] options not yet iterated
+ * @return bool: false at the end of the list (or on a truncated pair)
+ */
+bool tftp_next_option(std::string_view* option_list, std::string_view* name, std::string_view* value);
+
+
 tftp_opcode_t tftp_parse_opcode(const char* buffer, uint16_t size);
 bool tftp_parse_RQ_packet(tftp_request_t* request, char* buffer, uint16_t size);
 bool tftp_parse_ERROR_packet(tftp_error_t* packet, const char* buffer, uint16_t* size);
@@ -139,6 +186,36 @@ uint16_t tftp_format_ERROR_packet(tftp_error_t* packet, uint16_t error_code);
 uint16_t tftp_format_DATA_packet(tftp_data_t* packet, uint16_t block, const char* source_data, uint16_t size);
 uint16_t tftp_format_ACK_packet(tftp_ack_t* packet, uint16_t block);
 uint16_t tftp_format_RQ_packet(char* packet, tftp_opcode_t op_code, const char* filename, tftp_fmode_t fmode);
+uint16_t tftp_format_OACK_packet(char* packet, uint16_t max_size, const char* const* names, const char* const* values, int count);
+
+
+/* -------------------------------------------------------------------------- */
+
+// In-place builders: they write the 4 bytes header of a DATA/ACK packet
+// into a slot of the caller (TFTP_HEADER_SIZE bytes), so that a payload
+// can be sent from wherever it lives, gathered with the header
+
+#define TFTP_HEADER_SIZE (2 * sizeof(uint16_t))
+
+static inline uint16_t tftp_build_header(char* slot, uint16_t op_code, uint16_t block)
+{
+    slot[0] = char(op_code >> 8);
+    slot[1] = char(op_code);
+    slot[2] = char(block >> 8);
+    slot[3] = char(block);
+
+    return TFTP_HEADER_SIZE;
+}
+
+static inline uint16_t tftp_build_DATA_header(char* slot, uint16_t block)
+{
+    return tftp_build_header(slot, TFTP_DATA, block);
+}
+
+static inline uint16_t tftp_build_ACK_packet(char* slot, uint16_t block)
+{
+    return tftp_build_header(slot, TFTP_ACK, block);
+}
 
 
 /* -------------------------------------------------------------------------- */
@@ -147,7 +224,10 @@ uint16_t tftp_format_RQ_packet(char* packet, tftp_opcode_t op_code, const char*
 
 bool tftp_send_ERROR(int sd, uint32_t toAddr, uint16_t toPort, uint16_t error_code);
 bool tftp_send_DATA(int sd, uint32_t toAddr, uint16_t toPort, tftp_data_t* tftp_data_ptr, uint16_t size);
+bool tftp_send_DATA_payload(int sd, uint32_t toAddr, uint16_t toPort, uint16_t block, const char* payload, uint16_t size);
+bool tftp_send_DATA_iov(int sd, uint32_t toAddr, uint16_t toPort, uint16_t block, const struct iovec* payload, int iovcnt);
 bool tftp_send_ACK(int sd, uint32_t toAddr, uint16_t toPort, uint16_t block);
+bool tftp_send_OACK(int sd, uint32_t toAddr, uint16_t toPort, const char* const* names, const char* const* values, int count);
 
 
 /* -------------------------------------------------------------------------- */
@@ -0,0 +1,217 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_TIMER_WHEEL_H__
+#define __NU_TIMER_WHEEL_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <vector>
+
+
+/* -------------------------------------------------------------------------- */
+
+#define NU_TIMER_WHEEL_TICK 10 //!< ms
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Coarse monotonic clock: a few ms of resolution, but no syscall
+ * @return uint64_t: ms elapsed since an unspecified point
+ */
+static inline uint64_t nu_coarse_ms()
+{
+    struct timespec ts;
+
+#if defined(CLOCK_MONOTONIC_COARSE)
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+    return uint64_t(ts.tv_sec) * 1000 + uint64_t(ts.tv_nsec) / 1000000;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Timer linked into a timer_wheel, embedded in the object it belongs to
+     */
+    struct wheel_timer
+    {
+        wheel_timer* next = nullptr;
+        wheel_timer* prev = nullptr;
+        uint64_t expires = 0;  //!< tick
+        void* owner = nullptr; //!< for the user of the wheel
+        int kind = 0;          //!< for the user of the wheel
+
+        bool armed() const { return next != nullptr; }
+    };
+
+
+/* -------------------------------------------------------------------------- */
+
+    /**
+     * Hierarchical timer wheel (4 levels of 64 slots).
+     *
+     * A timer is linked into the slot of the level covering its distance
+     * from the current tick: arm and cancel are O(1), regardless of the
+     * count of timers armed. When the lower level wraps around, a slot
+     * of the upper level is cascaded down.
+     * The wheel is not thread safe: it is meant to be owned by an event
+     * loop, which advances it with a coarse monotonic clock.
+     */
+    class timer_wheel
+    {
+        public:
+            enum {
+                LEVELS = 4,
+                SLOT_BITS = 6,
+                SLOTS = 1 << SLOT_BITS
+            };
+
+            explicit timer_wheel(uint64_t now_ms, unsigned tick_ms = NU_TIMER_WHEEL_TICK) :
+                tick_ms_(tick_ms),
+                now_(now_ms / tick_ms)
+            {
+                for (int l = 0; l < LEVELS; ++l) {
+                    for (int s = 0; s < SLOTS; ++s)
+                        slots_[l][s].next = slots_[l][s].prev = &slots_[l][s];
+                }
+            }
+
+            /**
+             * Arms (or re-arms) a timer: it never expires before delay_ms
+             */
+            void arm(wheel_timer* t, uint64_t delay_ms) {
+                if (t->armed())
+                    cancel(t);
+
+                // The current tick is partially elapsed: one more tick
+                t->expires = now_ + (delay_ms + tick_ms_ - 1) / tick_ms_ + 1;
+                insert(t);
+                ++count_;
+            }
+
+            void cancel(wheel_timer* t) {
+                if (!t->armed())
+                    return;
+
+                t->prev->next = t->next;
+                t->next->prev = t->prev;
+                t->next = t->prev = nullptr;
+                --count_;
+            }
+
+            /**
+             * Moves the wheel up to now_ms, collecting the expired timers
+             * (they are disarmed, so they can be re-armed at once)
+             */
+            void advance(uint64_t now_ms, std::vector<wheel_timer*>& expired) {
+                uint64_t target = now_ms / tick_ms_;
+
+                if (count_ == 0 && now_ < target) {
+                    now_ = target; // nothing to expire nor to cascade
+                    return;
+                }
+
+                while (now_ < target) {
+                    ++now_;
+
+                    // Lower level wrapped around: cascade the upper ones
+                    for (int l = 1; l < LEVELS; ++l) {
+                        if (index(now_, l - 1) != 0)
+                            break;
+
+                        cascade(l, index(now_, l));
+                    }
+
+                    wheel_timer* head = &slots_[0][index(now_, 0)];
+
+                    while (head->next != head) {
+                        wheel_timer* t = head->next;
+                        cancel(t);
+                        expired.push_back(t);
+                    }
+                }
+            }
+
+            size_t armed_count() const { return count_; }
+            unsigned tick_ms() const { return tick_ms_; }
+
+        private:
+            timer_wheel(const timer_wheel&) = delete;
+            timer_wheel& operator=(const timer_wheel&) = delete;
+
+            static int index(uint64_t tick, int level) {
+                return int((tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+            }
+
+            void insert(wheel_timer* t) {
+                const uint64_t range = uint64_t(1) << (SLOT_BITS * LEVELS);
+
+                if (t->expires <= now_)
+                    t->expires = now_ + 1;
+                else if (t->expires - now_ >= range)
+                    t->expires = now_ + range - 1;
+
+                uint64_t delta = t->expires - now_;
+                int level = 0;
+
+                while (level < LEVELS - 1 && 
+                        delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+                {
+                    ++level;
+                }
+
+                wheel_timer* head = &slots_[level][index(t->expires, level)];
+
+                t->next = head;
+                t->prev = head->prev;
+                head->prev->next = t;
+                head->prev = t;
+            }
+
+            void cascade(int level, int slot) {
+                wheel_timer* head = &slots_[level][slot];
+
+                while (head->next != head) {
+                    wheel_timer* t = head->next;
+
+                    t->prev->next = t->next;
+                    t->next->prev = t->prev;
+
+                    insert(t);
+                }
+            }
+
+            unsigned tick_ms_;
+            uint64_t now_;  //!< current tick
+            size_t count_ = 0;
+
+            wheel_timer slots_[LEVELS][SLOTS]; //!< list heads
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_TIMER_WHEEL_H__ */
@@ -0,0 +1,114 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+#ifndef __NU_TOKEN_BUCKET_H__
+#define __NU_TOKEN_BUCKET_H__
+
+
+/* -------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Precise monotonic clock
+ * @return uint64_t: us elapsed since an unspecified point
+ */
+static inline uint64_t nu_clock_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000 + uint64_t(ts.tv_nsec) / 1000;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace nu
+{
+
+    /**
+     * Rate limiter shared by the threads sending through it.
+     *
+     * The bucket is kept as the time at which it would be full again
+     * (generic cell rate algorithm): a send moves that time on by its
+     * size over the rate, and must wait for the part exceeding the
+     * burst. Sends reserve their tokens up front, so the waits of the
+     * concurrent senders are spaced out by the rate, and a sender
+     * woken up late (timers have a coarse resolution) does not lose
+     * its share as long as it is late by less than the burst.
+     * Times are kept in ns: the cost of a datagram at a high rate is
+     * a fraction of a us, which would be lost if rounded.
+     * Lock free: a single compare and swap per send.
+     */
+    class token_bucket
+    {
+        public:
+            //! Unlimited, until set_rate()
+            token_bucket() = default;
+
+            /**
+             * @param rate: [in] bytes per second (0 = unlimited)
+             * @param burst: [in] bytes which may be sent at once
+             */
+            void set_rate(uint64_t rate, uint64_t burst) {
+                rate_ = rate;
+                burst_ns_ = rate ? burst * 1000000000 / rate : 0;
+            }
+
+            uint64_t rate() const { return rate_; }
+
+            /**
+             * Takes the tokens of a send
+             * @param bytes: [in] size of the send
+             * @param now_us: [in] nu_clock_us()
+             * @return uint64_t: us to wait before sending (0 = at once)
+             */
+            uint64_t reserve(size_t bytes, uint64_t now_us) {
+                if (!rate_)
+                    return 0;
+
+                uint64_t now_ns = now_us * 1000;
+                uint64_t cost = uint64_t(bytes) * 1000000000 / rate_;
+                uint64_t full = full_ns_.load(std::memory_order_relaxed);
+                uint64_t next;
+
+                do {
+                    next = (full > now_ns ? full : now_ns) + cost;
+                }
+                while (!full_ns_.compare_exchange_weak(full, next,
+                            std::memory_order_relaxed));
+
+                return next > now_ns + burst_ns_ ? 
+                    (next - now_ns - burst_ns_ + 999) / 1000 : 0;
+            }
+
+        private:
+            token_bucket(const token_bucket&) = delete;
+            token_bucket& operator=(const token_bucket&) = delete;
+
+            uint64_t rate_ = 0;
+            uint64_t burst_ns_ = 0;
+            std::atomic<uint64_t> full_ns_ { 0 }; //!< when no token is missing
+    };
+
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#endif /* ! __NU_TOKEN_BUCKET_H__ */
@@ -10,7 +10,18 @@
 /* -------------------------------------------------------------------------- */
 
 #include "nuTrace.h"
+#include "nuRing.h"
+#include "nuCriticalSection.h"
+
 #include <string>
+#include <vector>
+#include <atomic>
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 
 /* -------------------------------------------------------------------------- */
@@ -18,6 +29,21 @@
 using namespace std;
 
 
+/* -------------------------------------------------------------------------- */
+
+//!Records buffered by each thread tracing
+#define NU_TRACE_RING_SIZE 2048
+
+//!Room for the arguments of a record
+#define NU_TRACE_ARGS_SIZE 224
+
+//!Period of the writer thread, when there is nothing left to write
+#define NU_TRACE_DRAIN_PERIOD 10 //!< ms
+
+//!Level of the records of NU_TRACE_INF
+#define NU_TRACE_INF_LEVEL 0xFF
+
+
 /* -------------------------------------------------------------------------- */
 
 static
@@ -46,25 +72,510 @@ const char* nuGetTraceLevelDesc(int level)
 
 /* -------------------------------------------------------------------------- */
 
-void NU_TRACE(const char* signature, unsigned long mask, unsigned long level, const char* format, ...)
+// Asynchronous tracing
+//
+// The threads tracing just copy the format (a string literal, which
+// identifies the trace) and the raw arguments into a ring of their own.
+// A writer thread formats the records of all the rings, in the order
+// of their timestamps, and writes them in batches.
+
+// Record of a trace
+struct trace_record_t {
+    uint64_t ts_us;
+    const char* signature;
+    const char* format;
+    uint8_t level;
+    bool text;  //!< args holds the formatted text (arguments not recordable)
+    char args[NU_TRACE_ARGS_SIZE];
+};
+
+// The ring of a thread tracing
+struct trace_ring_t {
+    nu::spsc_ring<trace_record_t> ring { NU_TRACE_RING_SIZE };
+    atomic<bool> orphan { false }; //!< its thread is gone
+};
+
+// Gives the ring of a thread up when the thread exits
+struct trace_thread_t {
+    trace_ring_t* ring = 0;
+
+    ~trace_thread_t() {
+        if (ring)
+            ring->orphan = true;
+    }
+};
+
+// Kinds of the arguments of a format
+enum trace_arg_t {
+    TRACE_ARG_END,
+    TRACE_ARG_INT,
+    TRACE_ARG_LONG,
+    TRACE_ARG_DOUBLE,
+    TRACE_ARG_STR,
+    TRACE_ARG_PTR,
+    TRACE_ARG_BAD //!< not supported: the trace is formatted at once
+};
+
+static atomic<bool> trace_async { false };
+static atomic<bool> trace_stop { false };
+static atomic<unsigned long> trace_dropped { 0 };
+
+static nu::critical_section trace_rings_cs("trace_rings");
+static vector<trace_ring_t*> trace_rings;
+static thread_local trace_thread_t trace_thread;
+
+static FILE* trace_file = 0;
+static pthread_t trace_writer;
+
+
+/* -------------------------------------------------------------------------- */
+
+static uint64_t trace_clock_us()
 {
-    va_list par_list;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000 + uint64_t(ts.tv_nsec) / 1000;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Scans a format up to its next conversion taking an argument
+// @return const char*: past that conversion, type is TRACE_ARG_END at the end
+static const char* trace_next_arg(const char* p, trace_arg_t* type)
+{
+    *type = TRACE_ARG_END;
+
+    while (*p) {
+        if (*p++ != '%')
+            continue;
+
+        if (*p == '%') {
+            ++p;
+            continue;
+        }
+
+        p += strspn(p, "-+ #0123456789.");
+
+        bool is_long = false;
+
+        while (*p && strchr("hlqjzt", *p)) {
+            is_long = is_long || *p != 'h';
+            ++p;
+        }
+
+        switch (*p) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                *type = is_long ? TRACE_ARG_LONG : TRACE_ARG_INT;
+                break;
+
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                *type = TRACE_ARG_DOUBLE;
+                break;
+
+            case 's':
+                *type = is_long ? TRACE_ARG_BAD : TRACE_ARG_STR;
+                break;
+
+            case 'p':
+                *type = TRACE_ARG_PTR;
+                break;
+
+            default:
+                *type = TRACE_ARG_BAD; // '*' width, long double, %n...
+                return p;
+        }
+
+        return p + 1;
+    }
+
+    return p;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Copies the arguments of a trace into a record (strings included,
+// they may not outlive the call), false if they do not fit
+static bool trace_record_args(trace_record_t* r, const char* format, va_list args)
+{
+    char* out = r->args;
+    char* end = r->args + sizeof(r->args);
+    trace_arg_t type;
+    const char* p = format;
+
+    while (true) {
+        p = trace_next_arg(p, &type);
+
+        if (type == TRACE_ARG_END)
+            break;
+
+        if (type == TRACE_ARG_STR) {
+            const char* str = va_arg(args, const char*);
+
+            if (!str)
+                str = "(null)";
+
+            if (out >= end)
+                return false;
+
+            // Truncated, rather than formatted at once
+            size_t len = strnlen(str, end - out - 1);
 
-    if (NU_TRACE_LEVEL >= level && ((mask & NU_TRACE_MASK) == mask)) {
-        va_start(par_list, format);
+            memcpy(out, str, len);
+            out[len] = 0;
+            out += len + 1;
 
-        TERMINAL_OUTPUT(AT_DISABLE_ALL);
-        TERMINAL_OUTPUT(AT_REVERSEVID_ON);
-        TERMINAL_OUTPUT("%s",signature);
-        TERMINAL_OUTPUT(AT_BOLD_ON "[%u]" AT_DISABLE_ALL "%s>", 
-                unsigned(level), (const char*)NU_TRACE_LEVEL_desc[level]);
+            continue;
+        }
 
-        vprintf(format, par_list);
+        if (out + sizeof(int64_t) > end)
+            return false;
+
+        switch (type) {
+            case TRACE_ARG_INT: {
+                int64_t v = va_arg(args, int);
+                memcpy(out, &v, sizeof(v));
+                break;
+            }
+
+            case TRACE_ARG_LONG: {
+                int64_t v = va_arg(args, long long);
+                memcpy(out, &v, sizeof(v));
+                break;
+            }
+
+            case TRACE_ARG_DOUBLE: {
+                double v = va_arg(args, double);
+                memcpy(out, &v, sizeof(v));
+                break;
+            }
+
+            case TRACE_ARG_PTR: {
+                void* v = va_arg(args, void*);
+                memcpy(out, &v, sizeof(v));
+                break;
+            }
+
+            default:
+                return false;
+        }
+
+        out += sizeof(int64_t);
+    }
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
 
-        TERMINAL_OUTPUT(AT_DISABLE_ALL "\r\n");
+// Records a trace into the ring of the calling thread
+static void trace_record(const char* signature, unsigned level, const char* format, va_list args)
+{
+    trace_ring_t* ring = trace_thread.ring;
+
+    if (!ring) {
+        ring = new trace_ring_t;
+
+        nu::autoCs_t lock(trace_rings_cs);
+        trace_rings.push_back(ring);
+        trace_thread.ring = ring;
+    }
+
+    trace_record_t* r = ring->ring.claim();
+
+    if (!r) {
+        ++trace_dropped; // never wait for the writer
+        return;
+    }
+
+    r->ts_us = trace_clock_us();
+    r->signature = signature;
+    r->format = format;
+    r->level = uint8_t(level);
+
+    va_list copy;
+    va_copy(copy, args);
+
+    r->text = !trace_record_args(r, format, copy);
+
+    if (r->text)
+        vsnprintf(r->args, sizeof(r->args), format, args);
+
+    va_end(copy);
+
+    ring->ring.publish();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Formats the message of a record, one conversion at a time
+static void trace_format(string& line, const trace_record_t* r)
+{
+    if (r->text) {
+        line += r->args;
+        return;
+    }
+
+    const char* arg = r->args;
+    const char* p = r->format;
+    char buf[512];
+
+    while (*p) {
+        trace_arg_t type;
+        const char* next = trace_next_arg(p, &type);
+        string spec(p, next);
+
+        switch (type) {
+            case TRACE_ARG_STR:
+                snprintf(buf, sizeof(buf), spec.c_str(), arg);
+                arg += strlen(arg) + 1;
+                break;
+
+            case TRACE_ARG_INT: {
+                int64_t v;
+                memcpy(&v, arg, sizeof(v));
+                snprintf(buf, sizeof(buf), spec.c_str(), int(v));
+                arg += sizeof(v);
+                break;
+            }
+
+            case TRACE_ARG_LONG: {
+                int64_t v;
+                memcpy(&v, arg, sizeof(v));
+                snprintf(buf, sizeof(buf), spec.c_str(), (long long)v);
+                arg += sizeof(v);
+                break;
+            }
+
+            case TRACE_ARG_DOUBLE: {
+                double v;
+                memcpy(&v, arg, sizeof(v));
+                snprintf(buf, sizeof(buf), spec.c_str(), v);
+                arg += sizeof(v);
+                break;
+            }
+
+            case TRACE_ARG_PTR: {
+                void* v;
+                memcpy(&v, arg, sizeof(v));
+                snprintf(buf, sizeof(buf), spec.c_str(), v);
+                arg += sizeof(v);
+                break;
+            }
+
+            default: // the text after the last conversion
+                snprintf(buf, sizeof(buf), spec.c_str());
+                break;
+        }
+
+        line += buf;
+        p = next;
+    }
+}
 
+
+/* -------------------------------------------------------------------------- */
+
+// Writes the records of all the rings, oldest first
+// @return bool: true if anything was written
+static bool trace_drain()
+{
+    static vector<trace_ring_t*> rings;
+    string line;
+    bool written = false;
+
+    // The records are formatted and written out of the lock, which a
+    // thread tracing for the first time takes (rings are deleted here
+    // only, so the copy stays valid)
+    {
+        nu::autoCs_t lock(trace_rings_cs);
+        rings = trace_rings;
+    }
+
+    while (true) {
+        trace_ring_t* oldest = 0;
+        trace_record_t* r = 0;
+
+        for (trace_ring_t* ring : rings) {
+            trace_record_t* front = ring->ring.front();
+
+            if (front && (!r || front->ts_us < r->ts_us)) {
+                oldest = ring;
+                r = front;
+            }
+        }
+
+        if (!r)
+            break;
+
+        line = AT_DISABLE_ALL AT_REVERSEVID_ON;
+        line += r->signature;
+
+        if (r->level == NU_TRACE_INF_LEVEL) {
+            line += AT_BOLD_ON "[*]" AT_DISABLE_ALL ""
+                AT_TEXT_BLACK "" AT_BG_WHITE "INF" AT_DISABLE_ALL ">";
+        }
+        else {
+            line += AT_BOLD_ON "[" + to_string(r->level) + "]" AT_DISABLE_ALL;
+            line += nuGetTraceLevelDesc(r->level);
+            line += ">";
+        }
+
+        trace_format(line, r);
+        line += AT_DISABLE_ALL "\r\n";
+
+        oldest->ring.pop();
+
+        fwrite(line.data(), 1, line.size(), trace_file);
+        written = true;
+    }
+
+    // Rings of the threads gone, once written
+    {
+        nu::autoCs_t lock(trace_rings_cs);
+
+        for (size_t i = 0; i < trace_rings.size(); ) {
+            trace_ring_t* ring = trace_rings[i];
+
+            if (ring->orphan && ring->ring.empty()) {
+                trace_rings[i] = trace_rings.back();
+                trace_rings.pop_back();
+                delete ring;
+            }
+            else {
+                ++i;
+            }
+        }
+    }
+
+    static unsigned long reported = 0;
+    unsigned long dropped = trace_dropped;
+
+    if (dropped != reported) {
+        fprintf(trace_file, "[TRACE] %lu traces dropped\r\n", dropped - reported);
+        reported = dropped;
+        written = true;
+    }
+
+    if (written)
+        fflush(trace_file);
+
+    return written;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void* trace_writer_thread(void*)
+{
+    while (!trace_stop) {
+        if (!trace_drain())
+            usleep(NU_TRACE_DRAIN_PERIOD * 1000);
+    }
+
+    trace_drain();
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool nu_trace_start(const char* path)
+{
+    if (trace_async)
+        return true;
+
+    fflush(stdout);
+
+    trace_file = path ? fopen(path, "a") : stdout;
+
+    if (!trace_file)
+        return false;
+
+    trace_stop = false;
+
+    if (pthread_create(&trace_writer, NULL, trace_writer_thread, 0) != 0) {
+        if (trace_file != stdout)
+            fclose(trace_file);
+
+        trace_file = 0;
+
+        return false;
+    }
+
+    static bool registered = false;
+
+    if (!registered) {
+        atexit(nu_trace_stop); // write the last traces
+        registered = true;
+    }
+
+    trace_async = true;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void nu_trace_stop()
+{
+    if (!trace_async)
+        return;
+
+    trace_async = false;
+    trace_stop = true;
+
+    pthread_join(trace_writer, NULL);
+
+    if (trace_file != stdout)
+        fclose(trace_file);
+
+    trace_file = 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+unsigned long nu_trace_dropped()
+{
+    return trace_dropped;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void nu_trace(const char* signature, unsigned long mask, unsigned long level, const char* format, ...)
+{
+    va_list par_list;
+
+    // NU_TRACE checked the level and the mask already
+    (void) mask;
+
+    va_start(par_list, format);
+
+    if (trace_async.load(memory_order_relaxed)) {
+        trace_record(signature, unsigned(level), format, par_list);
         va_end(par_list);
+        return;
     }
+
+    TERMINAL_OUTPUT(AT_DISABLE_ALL);
+    TERMINAL_OUTPUT(AT_REVERSEVID_ON);
+    TERMINAL_OUTPUT("%s",signature);
+    TERMINAL_OUTPUT(AT_BOLD_ON "[%u]" AT_DISABLE_ALL "%s>", 
+            unsigned(level), (const char*)NU_TRACE_LEVEL_desc[level]);
+
+    vprintf(format, par_list);
+
+    TERMINAL_OUTPUT(AT_DISABLE_ALL "\r\n");
+
+    va_end(par_list);
 }
 
 
@@ -76,6 +587,12 @@ void NU_TRACE_INF(const char* signature, const char* format, ...)
 
     va_start(par_list, format);
 
+    if (trace_async.load(memory_order_relaxed)) {
+        trace_record(signature, NU_TRACE_INF_LEVEL, format, par_list);
+        va_end(par_list);
+        return;
+    }
+
     TERMINAL_OUTPUT(AT_DISABLE_ALL);
     TERMINAL_OUTPUT(AT_REVERSEVID_ON);
     TERMINAL_OUTPUT("%s",signature);
@@ -20,9 +20,53 @@
 /* -------------------------------------------------------------------------- */
 
 void NU_DUMP_BUFFER(const char* buf, unsigned long size);
-void NU_TRACE(const char* signature, unsigned long mask, unsigned long level, const char* format, ...);
 void NU_TRACE_INF(const char* signature, const char* format, ...);
 
+//Writes a trace, regardless of the current level (use NU_TRACE)
+void nu_trace(const char* signature, unsigned long mask, unsigned long level, const char* format, ...);
+
+
+/* -------------------------------------------------------------------------- */
+
+//Most verbose trace level compiled in (set by the build, see CMakeLists.txt):
+//the traces beyond it are removed at compile time
+#ifndef NU_TRACE_COMPILE_LEVEL
+#define NU_TRACE_COMPILE_LEVEL NU_TL_PED
+#endif
+
+//The arguments of a trace are evaluated only if the trace is enabled
+#define NU_TRACE(signature, mask, level, ...) \
+    do { \
+        if ((level) <= NU_TRACE_COMPILE_LEVEL && \
+                NU_TRACE_LEVEL >= (unsigned long)(level) && \
+                ((mask) & NU_TRACE_MASK) == (unsigned long)(mask)) \
+        { \
+            nu_trace((signature), (mask), (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * Makes NU_TRACE and NU_TRACE_INF asynchronous: the calling thread just
+ * records the format and the arguments in a ring of its own (traces are
+ * dropped if it is full), a writer thread formats and writes them.
+ * Signatures and formats must be string literals.
+ * The traces left are written at exit.
+ *
+ * @param path: [in] file the traces are appended to (0 = stdout)
+ * @return bool: false if tracing stays synchronous
+ */
+bool nu_trace_start(const char* path);
+
+/**
+ * Writes the traces left and makes tracing synchronous again
+ */
+void nu_trace_stop();
+
+/**
+ * @return unsigned long: count of the traces dropped, rings full
+ */
+unsigned long nu_trace_dropped();
+
 
 /* -------------------------------------------------------------------------- */
 
@@ -0,0 +1,87 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+// nutftp-sockpool-test: a socket of the pool, connected to a peer and
+// given back, must come out of the pool again still bound to its port
+
+#include "nuSockPool.h"
+#include "nuSockTool.h"
+
+#include <stdio.h>
+#include <netinet/in.h>
+
+using namespace nu;
+
+
+/* -------------------------------------------------------------------------- */
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1; \
+        } \
+    } while (0)
+
+
+/* -------------------------------------------------------------------------- */
+
+// Port the socket is actually bound to (0 if unbound)
+static unsigned short bound_port(int sd)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+
+    if (getsockname(sd, (struct sockaddr*)&sin, &len) != 0)
+        return 0;
+
+    return ntohs(sin.sin_port);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int main()
+{
+    sock_pool pool(1, 0, 0);
+
+    CHECK(pool.start());
+
+    for (int round = 0; round < 3; ++round) {
+        unsigned short port = 0;
+        int sd = pool.checkout(&port);
+
+        CHECK(sd >= 0);
+        CHECK(port != 0);
+        CHECK(bound_port(sd) == port);
+
+        // As a session does: connect to the client, then give it back
+        CHECK(sock_pool::connect(sd, INADDR_LOOPBACK, 9));
+        CHECK(bound_port(sd) == port);
+
+        pool.checkin(sd);
+
+        unsigned short again = 0;
+        int sd2 = pool.checkout(&again);
+
+        CHECK(sd2 == sd);
+        CHECK(again == port);
+        CHECK(bound_port(sd2) == port);
+
+        pool.checkin(sd2);
+    }
+
+    pool.stop();
+
+    printf("sock_pool: ok\n");
+
+    return 0;
+}
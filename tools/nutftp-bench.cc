@@ -0,0 +1,936 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+// nutftp-bench: load generator for nuTftpServer. Runs many TFTP clients
+// (RRQ and WRQ) on a single thread, a non-blocking UDP socket each,
+// against a server on the same box, and reports the throughput, the
+// latencies, the CPU spent per GB and the failures
+
+#include "nuTftpServer.h"
+#include "nuTftpUtil.h"
+#include "nuSockTool.h"
+#include "nuHistogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+#define BENCH_MAX_BLKSIZE 65464        //!< RFC 2348
+#define BENCH_SCAN_PERIOD 5000         //!< us, timeouts and delayed replies
+#define BENCH_EPOLL_EVENTS 256
+#define BENCH_FILE_PREFIX "nutftp-bench"
+
+//!Wait after creating the files read: the server may learn of new files
+//!asynchronously (its metadata cache is rebuilt on inotify events)
+#define BENCH_SETTLE_MS 1000
+
+//!Not a TFTP error code: the client gave up
+#define BENCH_ERROR_TIMEOUT 8
+#define BENCH_ERRORS (BENCH_ERROR_TIMEOUT + 1)
+
+
+/* -------------------------------------------------------------------------- */
+
+struct bench_options_t {
+    uint32_t server_addr;   //!< host byte order
+    uint16_t port;
+    int requests;           //!< transfers run in total
+    int concurrency;        //!< transfers running at most
+    int wrq_percent;        //!< of the requests, WRQ (the others are RRQ)
+    vector<uint64_t> sizes; //!< of the files, used in turn
+    int blksize;            //!< requested (0 = no option, 512)
+    int windowsize;         //!< requested (0 = no option, 1)
+    double rate;            //!< steady arrivals per s (0 = closed loop)
+    int storm;              //!< requests arriving at once (0 = no storm)
+    int storm_period;       //!< ms between two storms
+    int think_us;           //!< delay of the client before each reply
+    int timeout_ms;         //!< retransmission timeout
+    int retries;
+    const char* get_dir;    //!< creates the files read there
+    const char* put_dir;    //!< removes the files written from there
+    int server_pid;         //!< for the CPU of the server (0 = unknown)
+};
+
+struct bench_client_t {
+    int sd;
+    int id;
+    bool busy;
+    uint16_t opcode;
+    uint64_t size;          //!< of the file (WRQ)
+    uint16_t peer_port;     //!< TID of the server, 0 until it answers
+    bool answered;
+    int blksize;
+    int windowsize;
+    uint64_t base;          //!< RRQ: last block received in order,
+                            //!< WRQ: last block acknowledged
+    uint64_t sent;          //!< WRQ: last block sent
+    uint64_t blocks;        //!< WRQ: blocks of the file
+    int in_window;          //!< RRQ: blocks received since the last ACK
+    uint64_t bytes;
+    uint64_t started_us;
+    uint64_t deadline_us;   //!< of the retransmission
+    uint64_t reply_us;      //!< of a reply delayed by the think time
+    int attempts;
+};
+
+struct bench_stats_t {
+    int ok;
+    int failed;
+    int errors[BENCH_ERRORS];
+    uint64_t bytes;
+    uint64_t retransmits;
+    uint64_t options_declined;
+    nu::histogram first_answer;  //!< us, from the request
+    nu::histogram transfer;      //!< us, of the transfers completed
+};
+
+
+/* -------------------------------------------------------------------------- */
+
+static bench_options_t options;
+static bench_stats_t stats;
+
+static char packet[TFTP_HEADER_SIZE + BENCH_MAX_BLKSIZE];
+static char payload[BENCH_MAX_BLKSIZE]; //!< of the files written
+
+
+/* -------------------------------------------------------------------------- */
+
+static uint64_t clock_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000 + uint64_t(ts.tv_nsec) / 1000;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// CPU (user + system) of this process, in s
+static double cpu_self()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// CPU (user + system) of another process, in s (-1 if not known)
+static double cpu_of(int pid)
+{
+    char path[64];
+    char buf[1024];
+
+    snprintf(path, sizeof(path), "/proc/%i/stat", pid);
+
+    FILE* f = fopen(path, "r");
+
+    if (!f)
+        return -1;
+
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = 0;
+
+    // Fields after the command (which may hold spaces): utime and stime
+    // are the 14th and 15th
+    const char* p = strrchr(buf, ')');
+    unsigned long long utime = 0, stime = 0;
+
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                &utime, &stime) != 2)
+    {
+        return -1;
+    }
+
+    return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// "4K" = 4096, also M and G
+static bool parse_size(const char* text, uint64_t* size)
+{
+    char* end = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+
+    if (end == text)
+        return false;
+
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; ++end; break;
+        case 'm': case 'M': value <<= 20; ++end; break;
+        case 'g': case 'G': value <<= 30; ++end; break;
+        default: break;
+    }
+
+    *size = value;
+
+    return *end == 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void file_name(const bench_client_t* c, char* name, size_t size)
+{
+    if (c->opcode == TFTP_RRQ) {
+        snprintf(name, size, BENCH_FILE_PREFIX "-%llu", (unsigned long long)c->size);
+    }
+    else {
+        snprintf(name, size, BENCH_FILE_PREFIX "-%i-%i.wr",
+                int(getpid()), c->id);
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Creates the files read by the RRQ (if they are not there yet)
+static bool prepare_files(const char* dir, int* created)
+{
+    *created = 0;
+
+    for (uint64_t size : options.sizes) {
+        char path[PATH_MAX];
+        struct stat st;
+
+        snprintf(path, sizeof(path), "%s/" BENCH_FILE_PREFIX "-%llu",
+                dir, (unsigned long long)size);
+
+        if (stat(path, &st) == 0 && uint64_t(st.st_size) == size)
+            continue;
+
+        FILE* f = fopen(path, "wb");
+
+        if (!f) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return false;
+        }
+
+        for (uint64_t left = size; left; ) {
+            size_t chunk = left < sizeof(payload) ? size_t(left) : sizeof(payload);
+            fwrite(payload, 1, chunk, f);
+            left -= chunk;
+        }
+
+        fclose(f);
+        ++*created;
+    }
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void send_to_server(bench_client_t* c, const char* buf, int len)
+{
+    nu_sendto(c->sd, buf, len, 0, options.server_addr,
+            c->peer_port ? c->peer_port : options.port);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// RRQ/WRQ, with the options blksize (RFC 2348) and windowsize (RFC 7440)
+// if they are requested
+static void send_request(bench_client_t* c)
+{
+    char name[128];
+    file_name(c, name, sizeof(name));
+
+    int len = tftp_format_RQ_packet(packet, c->opcode, name, OCTET);
+
+    if (options.blksize) {
+        len += 1 + sprintf(packet + len, "blksize");
+        len += 1 + sprintf(packet + len, "%i", options.blksize);
+    }
+
+    if (options.windowsize) {
+        len += 1 + sprintf(packet + len, "windowsize");
+        len += 1 + sprintf(packet + len, "%i", options.windowsize);
+    }
+
+    send_to_server(c, packet, len);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// WRQ: the blocks of the window not sent yet (all of them, when
+// retransmitting)
+static void send_window(bench_client_t* c, bool again)
+{
+    uint64_t last = c->base + c->windowsize;
+
+    if (last > c->blocks)
+        last = c->blocks;
+
+    for (uint64_t block = again ? c->base + 1 : c->sent + 1; block <= last; ++block) {
+        uint64_t offset = (block - 1) * c->blksize;
+        uint64_t size = c->size - offset;
+
+        if (size > uint64_t(c->blksize))
+            size = c->blksize;
+
+        struct iovec iov[2];
+        char header[TFTP_HEADER_SIZE];
+
+        iov[0].iov_base = header;
+        iov[0].iov_len = tftp_build_DATA_header(header, uint16_t(block));
+        iov[1].iov_base = payload;
+        iov[1].iov_len = size_t(size);
+
+        nu_sendmsg(c->sd, iov, 2, 0, options.server_addr, c->peer_port);
+    }
+
+    c->sent = last;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Sends what the state of the transfer asks for: the request, until the
+// server answers, then the ACK of the last block received (RRQ) or the
+// window of the blocks to send (WRQ)
+static void transmit(bench_client_t* c, bool again, uint64_t now)
+{
+    if (!c->answered)
+        send_request(c);
+    else if (c->opcode == TFTP_RRQ)
+        tftp_send_ACK(c->sd, options.server_addr, c->peer_port, uint16_t(c->base));
+    else
+        send_window(c, again);
+
+    c->deadline_us = now + uint64_t(options.timeout_ms) * 1000;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Answers the server, after the think time
+static void reply(bench_client_t* c, uint64_t now)
+{
+    if (options.think_us) {
+        c->reply_us = now + options.think_us;
+        c->deadline_us = 0;
+    }
+    else {
+        transmit(c, false, now);
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void finish(bench_client_t* c, int error, uint64_t now)
+{
+    if (error < 0) {
+        ++stats.ok;
+        stats.transfer.record(now - c->started_us);
+    }
+    else {
+        ++stats.failed;
+        ++stats.errors[error < BENCH_ERRORS ? error : 0];
+    }
+
+    stats.bytes += c->bytes;
+
+    nu_free_sock(c->sd);
+    c->sd = -1;
+    c->busy = false;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static bool start(bench_client_t* c, int id, int epoll_fd, uint64_t now)
+{
+    c->sd = nu_create();
+
+    if (c->sd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    fcntl(c->sd, F_SETFL, fcntl(c->sd, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->sd, &ev);
+
+    c->id = id;
+    c->busy = true;
+    c->opcode = (id % 100) < options.wrq_percent ? TFTP_WRQ : TFTP_RRQ;
+    c->size = options.sizes[id % options.sizes.size()];
+    c->peer_port = 0;
+    c->answered = false;
+    c->blksize = TFTP_MAX_BUFFER_SIZE;
+    c->windowsize = 1;
+    c->base = 0;
+    c->sent = 0;
+    c->in_window = 0;
+    c->bytes = 0;
+    c->started_us = now;
+    c->reply_us = 0;
+    c->attempts = 0;
+
+    transmit(c, false, now);
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// First answer of the server: the options it accepted (OACK) or none
+static void answered(bench_client_t* c, const char* buf, int len, uint64_t now)
+{
+    c->answered = true;
+    stats.first_answer.record(now - c->started_us);
+
+    if (tftp_parse_opcode(buf, len) == TFTP_OACK) {
+        string_view list(buf + sizeof(uint16_t), len - sizeof(uint16_t));
+        string_view name, value;
+
+        while (tftp_next_option(&list, &name, &value)) {
+            if (name == "blksize")
+                c->blksize = atoi(string(value).c_str());
+            else if (name == "windowsize")
+                c->windowsize = atoi(string(value).c_str());
+        }
+    }
+    else if (options.blksize || options.windowsize) {
+        ++stats.options_declined;
+    }
+
+    if (c->blksize < 8 || c->blksize > BENCH_MAX_BLKSIZE)
+        c->blksize = TFTP_MAX_BUFFER_SIZE;
+
+    if (c->windowsize < 1)
+        c->windowsize = 1;
+
+    // The last block is shorter than blksize, even if empty
+    c->blocks = c->size / c->blksize + 1;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void receive(bench_client_t* c, uint64_t now)
+{
+    static char buf[TFTP_HEADER_SIZE + BENCH_MAX_BLKSIZE];
+
+    while (c->busy) {
+        unsigned int addr = 0;
+        unsigned short port = 0;
+
+        int len = nu_recvfrom(c->sd, buf, sizeof(buf), 0, &addr, &port);
+
+        if (len < 0)
+            return;
+
+        if (c->peer_port && port != c->peer_port)
+            continue; // not the TID of the transfer
+
+        tftp_opcode_t opcode = tftp_parse_opcode(buf, uint16_t(len));
+
+        if (opcode == TFTP_ERROR) {
+            tftp_error_t error;
+            uint16_t size = uint16_t(len);
+
+            tftp_parse_ERROR_packet(&error, buf, &size);
+            finish(c, error.error_code < BENCH_ERROR_TIMEOUT ? error.error_code : 0, now);
+
+            return;
+        }
+
+        if (!c->answered) {
+            c->peer_port = port;
+            answered(c, buf, len, now);
+
+            if (opcode == TFTP_OACK) {
+                // RRQ: ACK 0, WRQ: the first window
+                c->attempts = 0;
+                transmit(c, false, now);
+                continue;
+            }
+        }
+
+        c->attempts = 0;
+
+        if (c->opcode == TFTP_RRQ && opcode == TFTP_DATA) {
+            tftp_data_view_t data;
+
+            if (!tftp_view_DATA_packet(&data, buf, uint16_t(len)))
+                continue;
+
+            if (data.block != uint16_t(c->base + 1)) {
+                // Out of order or again: ACK what was received
+                c->in_window = 0;
+                reply(c, now);
+                continue;
+            }
+
+            ++c->base;
+            c->bytes += data.size;
+
+            if (data.size < c->blksize) {
+                transmit(c, false, now);
+                finish(c, -1, now);
+                return;
+            }
+
+            if (++c->in_window >= c->windowsize) {
+                c->in_window = 0;
+                reply(c, now);
+            }
+            else {
+                c->deadline_us = now + uint64_t(options.timeout_ms) * 1000;
+            }
+        }
+        else if (c->opcode == TFTP_WRQ && opcode == TFTP_ACK) {
+            tftp_ack_t ack;
+
+            if (!tftp_parse_ACK_packet(&ack, buf, uint16_t(len)))
+                continue;
+
+            uint16_t acked = uint16_t(ack.block - uint16_t(c->base));
+
+            if (acked > c->sent - c->base)
+                continue; // older than the window
+
+            c->base += acked;
+            c->bytes = c->base * c->blksize < c->size ? c->base * c->blksize : c->size;
+
+            if (c->base == c->blocks) {
+                finish(c, -1, now);
+                return;
+            }
+
+            if (acked || c->base == 0)
+                reply(c, now);
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Delayed replies and retransmissions
+static void scan(vector<bench_client_t>& clients, uint64_t now)
+{
+    for (auto& c : clients) {
+        if (!c.busy)
+            continue;
+
+        if (c.reply_us) {
+            if (now >= c.reply_us) {
+                c.reply_us = 0;
+                transmit(&c, false, now);
+            }
+        }
+        else if (c.deadline_us && now >= c.deadline_us) {
+            if (++c.attempts > options.retries) {
+                finish(&c, BENCH_ERROR_TIMEOUT, now);
+            }
+            else {
+                ++stats.retransmits;
+                transmit(&c, true, now);
+            }
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void print_latency(const char* name, const nu::histogram& h, double unit)
+{
+    nu::histogram_snapshot* s = new nu::histogram_snapshot;
+    h.merge(s);
+
+    printf("%-16s p50 %9.3f  p90 %9.3f  p99 %9.3f  p99.9 %9.3f  (%llu)\n",
+            name,
+            s->percentile(0.5) / unit,
+            s->percentile(0.9) / unit,
+            s->percentile(0.99) / unit,
+            s->percentile(0.999) / unit,
+            (unsigned long long)s->count);
+
+    delete s;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void report(double elapsed, double cpu, double server_cpu)
+{
+    static const char* errors[BENCH_ERRORS] = {
+        "not defined", "file not found", "access violation", "disk full",
+        "illegal operation", "unknown TID", "file exists", "no such user",
+        "timeout"
+    };
+
+    double gb = stats.bytes / 1e9;
+
+    printf("transfers        %i ok, %i failed, in %.3f s (%.1f/s)\n",
+            stats.ok, stats.failed, elapsed, (stats.ok + stats.failed) / elapsed);
+
+    for (int i = 0; i < BENCH_ERRORS; ++i) {
+        if (stats.errors[i])
+            printf("  %-14s %i\n", errors[i], stats.errors[i]);
+    }
+
+    printf("throughput       %.3f MB/s (%llu bytes)\n",
+            stats.bytes / elapsed / 1e6, (unsigned long long)stats.bytes);
+
+    print_latency("first answer ms", stats.first_answer, 1000.0);
+    print_latency("transfer ms", stats.transfer, 1000.0);
+
+    printf("retransmits      %llu\n", (unsigned long long)stats.retransmits);
+
+    if (stats.options_declined) {
+        printf("options declined %llu (blksize 512, windowsize 1)\n",
+                (unsigned long long)stats.options_declined);
+    }
+
+    if (gb > 0) {
+        printf("cpu              bench %.3f s (%.3f s/GB)", cpu, cpu / gb);
+
+        if (server_cpu >= 0)
+            printf(", server %.3f s (%.3f s/GB)", server_cpu, server_cpu / gb);
+
+        printf("\n");
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --server=ADDR        (127.0.0.1)\n"
+            "  --port=PORT          (69)\n"
+            "  --requests=N         transfers in total (1000)\n"
+            "  --concurrency=N      transfers running at most (100)\n"
+            "  --wrq=PERCENT        of the requests, WRQ (0)\n"
+            "  --sizes=S,...        of the files, e.g. 4K,1M (64K)\n"
+            "  --blksize=N          option requested (none)\n"
+            "  --windowsize=N       option requested (none)\n"
+            "  --rate=N             steady arrivals per s (closed loop)\n"
+            "  --storm=N            requests arriving at once...\n"
+            "  --storm-period=MS    ...every MS (1000)\n"
+            "  --think=US           delay of a client before each reply (0)\n"
+            "  --timeout=MS         retransmission timeout (1000)\n"
+            "  --retries=N          (5)\n"
+            "  --get-dir=DIR        creates there the files read\n"
+            "  --put-dir=DIR        removes from there the files written\n"
+            "  --server-pid=PID     reports the CPU of the server too\n"
+            "  (files read: " BENCH_FILE_PREFIX "-SIZE)\n",
+            name);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static bool parse_option(const char* arg)
+{
+    const char* eq = strchr(arg, '=');
+
+    if (strncmp(arg, "--", 2) != 0 || !eq)
+        return false;
+
+    string name(arg + 2, eq - arg - 2);
+    const char* value = eq + 1;
+
+    if (name == "server") {
+        struct in_addr addr;
+
+        if (!inet_aton(value, &addr))
+            return false;
+
+        options.server_addr = ntohl(addr.s_addr);
+    }
+    else if (name == "port") {
+        options.port = (uint16_t)atoi(value);
+    }
+    else if (name == "requests") {
+        options.requests = atoi(value);
+    }
+    else if (name == "concurrency") {
+        options.concurrency = atoi(value);
+    }
+    else if (name == "wrq") {
+        options.wrq_percent = atoi(value);
+    }
+    else if (name == "sizes") {
+        options.sizes.clear();
+
+        string list(value);
+        size_t begin = 0;
+
+        while (begin <= list.size()) {
+            size_t end = list.find(',', begin);
+
+            if (end == string::npos)
+                end = list.size();
+
+            uint64_t size;
+
+            if (!parse_size(list.substr(begin, end - begin).c_str(), &size))
+                return false;
+
+            options.sizes.push_back(size);
+            begin = end + 1;
+        }
+    }
+    else if (name == "blksize") {
+        options.blksize = atoi(value);
+    }
+    else if (name == "windowsize") {
+        options.windowsize = atoi(value);
+    }
+    else if (name == "rate") {
+        options.rate = atof(value);
+    }
+    else if (name == "storm") {
+        options.storm = atoi(value);
+    }
+    else if (name == "storm-period") {
+        options.storm_period = atoi(value);
+    }
+    else if (name == "think") {
+        options.think_us = atoi(value);
+    }
+    else if (name == "timeout") {
+        options.timeout_ms = atoi(value);
+    }
+    else if (name == "retries") {
+        options.retries = atoi(value);
+    }
+    else if (name == "get-dir") {
+        options.get_dir = value;
+    }
+    else if (name == "put-dir") {
+        options.put_dir = value;
+    }
+    else if (name == "server-pid") {
+        options.server_pid = atoi(value);
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int main(int argc, char* argv[])
+{
+    options.server_addr = INADDR_LOOPBACK;
+    options.port = TFTP_SERVER_PORT;
+    options.requests = 1000;
+    options.concurrency = 100;
+    options.sizes.push_back(64 << 10);
+    options.storm_period = 1000;
+    options.timeout_ms = 1000;
+    options.retries = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!parse_option(argv[i])) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.requests < 1 || options.concurrency < 1 ||
+            (options.blksize &&
+             (options.blksize < 8 || options.blksize > BENCH_MAX_BLKSIZE)))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(payload); ++i)
+        payload[i] = char('A' + i % 26);
+
+    if (options.get_dir) {
+        int created;
+
+        if (!prepare_files(options.get_dir, &created))
+            return 1;
+
+        if (created)
+            usleep(BENCH_SETTLE_MS * 1000);
+    }
+
+    // A socket per client
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    int epoll_fd = epoll_create1(0);
+
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    vector<bench_client_t> clients(options.concurrency);
+
+    for (auto& c : clients) {
+        c.sd = -1;
+        c.busy = false;
+    }
+
+    int scan_period = BENCH_SCAN_PERIOD;
+
+    if (options.think_us && options.think_us < scan_period)
+        scan_period = options.think_us < 1000 ? 1000 : options.think_us;
+
+    double cpu_begin = cpu_self();
+    double server_cpu_begin = options.server_pid ? cpu_of(options.server_pid) : -1;
+
+    uint64_t begin = clock_us();
+    uint64_t next_arrival = begin;
+    uint64_t next_scan = begin + scan_period;
+    int started = 0;
+    int arrived = 0; // started or waiting for a free client
+    int running = 0;
+    size_t next_free = 0;
+
+    struct epoll_event events[BENCH_EPOLL_EVENTS];
+
+    while (started < options.requests || running) {
+        uint64_t now = clock_us();
+
+        // Arrivals: closed loop, steady or storms
+        if (options.storm) {
+            while (now >= next_arrival && arrived < options.requests) {
+                arrived += options.storm;
+                next_arrival += uint64_t(options.storm_period) * 1000;
+            }
+        }
+        else if (options.rate > 0) {
+            while (now >= next_arrival && arrived < options.requests) {
+                ++arrived;
+                next_arrival += uint64_t(1e6 / options.rate);
+            }
+        }
+        else {
+            arrived = options.requests;
+        }
+
+        if (arrived > options.requests)
+            arrived = options.requests;
+
+        while (started < arrived && running < options.concurrency) {
+            while (clients[next_free].busy)
+                next_free = (next_free + 1) % clients.size();
+
+            if (!start(&clients[next_free], started, epoll_fd, now))
+                return 1;
+
+            ++started;
+            ++running;
+        }
+
+        int count = epoll_wait(epoll_fd, events, BENCH_EPOLL_EVENTS, 1);
+        now = clock_us();
+
+        for (int i = 0; i < count; ++i) {
+            bench_client_t* c = (bench_client_t*)events[i].data.ptr;
+
+            if (c->busy) {
+                receive(c, now);
+
+                if (!c->busy)
+                    --running;
+            }
+        }
+
+        if (now >= next_scan) {
+            int busy_before = 0, busy_after = 0;
+
+            for (auto& c : clients)
+                busy_before += c.busy;
+
+            scan(clients, now);
+
+            for (auto& c : clients)
+                busy_after += c.busy;
+
+            running -= busy_before - busy_after;
+            next_scan = now + scan_period;
+        }
+    }
+
+    double elapsed = (clock_us() - begin) / 1e6;
+    double cpu = cpu_self() - cpu_begin;
+    double server_cpu = -1;
+
+    if (server_cpu_begin >= 0) {
+        double end = cpu_of(options.server_pid);
+        server_cpu = end >= 0 ? end - server_cpu_begin : -1;
+    }
+
+    close(epoll_fd);
+
+    if (options.put_dir) {
+        for (int id = 0; id < started; ++id) {
+            bench_client_t c;
+            char name[128];
+            char path[PATH_MAX];
+
+            c.id = id;
+            c.opcode = TFTP_WRQ;
+            file_name(&c, name, sizeof(name));
+            snprintf(path, sizeof(path), "%s/%s", options.put_dir, name);
+            unlink(path);
+        }
+    }
+
+    report(elapsed, cpu, server_cpu);
+
+    return stats.failed ? 2 : 0;
+}
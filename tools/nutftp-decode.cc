@@ -0,0 +1,406 @@
+//  
+// This file is part of nuTftpServer 
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.  
+// Licensed under the MIT License. 
+// See COPYING file in the project root for full license information.
+//
+
+
+/* -------------------------------------------------------------------------- */
+
+// nutftp-decode: converts the binary event log of nuTftpServer
+// (--event-log) to CSV, JSON lines or per session timelines
+
+#include "nuEventLog.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+/* -------------------------------------------------------------------------- */
+
+enum output_t {
+    OUTPUT_CSV,
+    OUTPUT_JSON,
+    OUTPUT_TIMELINE,
+    OUTPUT_SUMMARY
+};
+
+// An event, with its wall clock time
+struct decoded_t {
+    nu::event_t e;
+    uint64_t real_ns;
+};
+
+
+/* -------------------------------------------------------------------------- */
+
+static const char* opcode_name(uint32_t opcode)
+{
+    switch (opcode) {
+        case 1: return "RRQ";
+        case 2: return "WRQ";
+        default: return "?";
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Names of the arguments of an event type (0 if not used)
+static void arg_names(unsigned type, const char** arg1, const char** arg2)
+{
+    *arg1 = 0;
+    *arg2 = 0;
+
+    switch (type) {
+        case nu::EVENT_REQUEST:
+        case nu::EVENT_SESSION_START:
+            *arg1 = "opcode";
+            break;
+
+        case nu::EVENT_SESSION_END:
+            *arg1 = "error";
+            *arg2 = "ms";
+            break;
+
+        case nu::EVENT_DATA_SENT:
+        case nu::EVENT_DATA_RECEIVED:
+            *arg1 = "block";
+            *arg2 = "bytes";
+            break;
+
+        case nu::EVENT_ACK_SENT:
+        case nu::EVENT_ACK_RECEIVED:
+        case nu::EVENT_RETRANSMIT:
+        case nu::EVENT_TIMEOUT:
+            *arg1 = "block";
+            break;
+
+        case nu::EVENT_ERROR:
+            *arg1 = "error";
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static string format_client(const nu::event_t& e)
+{
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u:%u",
+            (e.addr >> 24) & 0xFF, (e.addr >> 16) & 0xFF,
+            (e.addr >> 8) & 0xFF, e.addr & 0xFF, unsigned(e.port));
+
+    return buf;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// UTC, with us
+static string format_time(uint64_t real_ns)
+{
+    time_t secs = time_t(real_ns / 1000000000);
+    struct tm tm;
+    char buf[64];
+
+    gmtime_r(&secs, &tm);
+    size_t len = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + len, sizeof(buf) - len, ".%06uZ",
+            unsigned((real_ns % 1000000000) / 1000));
+
+    return buf;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Converts an event of a log of version 1 to the current format
+static void upgrade_event_v1(nu::event_t* e)
+{
+    switch (e->type) {
+        case nu::EVENT_DATA_SENT:
+            if (e->arg2 >= 4)
+                e->arg2 -= 4; // the header of the datagram
+            break;
+
+        case nu::EVENT_SESSION_END:
+            if (e->arg1 == 0)
+                e->arg1 = uint32_t(-1); // completed
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Appends the events of a file of the log
+static bool read_log(const char* path, vector<decoded_t>& events)
+{
+    FILE* f = fopen(path, "rb");
+
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    nu::event_log_header_t header;
+
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+            strncmp(header.magic, NU_EVENT_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+            (header.version != NU_EVENT_LOG_VERSION && header.version != 1) ||
+            header.record_size != sizeof(nu::event_t))
+    {
+        fprintf(stderr, "%s: not an event log of version 1 to %i\n",
+                path, NU_EVENT_LOG_VERSION);
+        fclose(f);
+
+        return false;
+    }
+
+    decoded_t d;
+
+    while (fread(&d.e, sizeof(d.e), 1, f) == 1) {
+        d.real_ns = header.real_ns + (d.e.ts_ns - header.mono_ns);
+
+        if (header.version == 1)
+            upgrade_event_v1(&d.e);
+
+        events.push_back(d);
+    }
+
+    fclose(f);
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void write_csv(const vector<decoded_t>& events)
+{
+    printf("time,session,event,client,arg1,arg2\n");
+
+    for (const decoded_t& d : events) {
+        printf("%s,%u,%s,%s,%i,%llu\n",
+                format_time(d.real_ns).c_str(),
+                d.e.session,
+                nu::event_type_name(d.e.type),
+                format_client(d.e).c_str(),
+                int(d.e.arg1), // an error code is -1 on success
+                (unsigned long long)d.e.arg2);
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static void write_json(const vector<decoded_t>& events)
+{
+    for (const decoded_t& d : events) {
+        const char* arg1;
+        const char* arg2;
+        arg_names(d.e.type, &arg1, &arg2);
+
+        printf("{\"time\":\"%s\",\"session\":%u,\"event\":\"%s\",\"client\":\"%s\"",
+                format_time(d.real_ns).c_str(),
+                d.e.session,
+                nu::event_type_name(d.e.type),
+                format_client(d.e).c_str());
+
+        if (arg1)
+            printf(",\"%s\":%i", arg1, int(d.e.arg1));
+
+        if (arg2)
+            printf(",\"%s\":%llu", arg2, (unsigned long long)d.e.arg2);
+
+        printf("}\n");
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+// Per session: a summary line, then (unless summary_only) its events,
+// timed from the request
+static void write_timelines(const vector<decoded_t>& events, bool summary_only)
+{
+    map<uint32_t, vector<const decoded_t*>> sessions;
+    map<uint64_t, const decoded_t*> requests; // the last one of each client
+
+    for (const decoded_t& d : events) {
+        uint64_t client = (uint64_t(d.e.addr) << 16) | d.e.port;
+
+        if (d.e.type == nu::EVENT_REQUEST) {
+            requests[client] = &d;
+            continue;
+        }
+
+        vector<const decoded_t*>& timeline = sessions[d.e.session];
+
+        // The request of the session, if logged
+        if (timeline.empty() && d.e.type == nu::EVENT_SESSION_START) {
+            auto r = requests.find(client);
+
+            if (r != requests.end()) {
+                timeline.push_back(r->second);
+                requests.erase(r);
+            }
+        }
+
+        timeline.push_back(&d);
+    }
+
+    for (auto& s : sessions) {
+        const vector<const decoded_t*>& timeline = s.second;
+        const decoded_t* first = timeline.front();
+
+        unsigned data = 0, acks = 0, retransmits = 0, timeouts = 0;
+        uint64_t bytes = 0;
+        uint32_t opcode = 0;
+        bool ended = false;
+        int error = -1; // TFTP_ERROR__SUCCESS
+        uint64_t wait_ns = 0;
+        uint64_t end_ns = timeline.back()->e.ts_ns;
+
+        for (const decoded_t* d : timeline) {
+            switch (d->e.type) {
+                case nu::EVENT_SESSION_START:
+                    opcode = d->e.arg1;
+                    wait_ns = d->e.ts_ns - first->e.ts_ns;
+                    break;
+
+                case nu::EVENT_SESSION_END:
+                    ended = true;
+                    error = int(d->e.arg1);
+                    break;
+
+                case nu::EVENT_DATA_SENT:
+                case nu::EVENT_DATA_RECEIVED:
+                    ++data;
+                    bytes += d->e.arg2;
+                    break;
+
+                case nu::EVENT_ACK_SENT:
+                case nu::EVENT_ACK_RECEIVED:
+                    ++acks;
+                    break;
+
+                case nu::EVENT_RETRANSMIT:
+                    ++retransmits;
+                    break;
+
+                case nu::EVENT_TIMEOUT:
+                    ++timeouts;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        printf("session %u %s %s start=%s wait=%.3fms duration=%.3fms "
+                "data=%u bytes=%llu acks=%u retransmits=%u timeouts=%u %s",
+                s.first,
+                opcode_name(opcode),
+                format_client(first->e).c_str(),
+                format_time(first->real_ns).c_str(),
+                wait_ns / 1e6,
+                (end_ns - first->e.ts_ns) / 1e6,
+                data,
+                (unsigned long long)bytes,
+                acks, retransmits, timeouts,
+                !ended ? "unfinished" : error >= 0 ? "failed" : "ok");
+
+        if (error >= 0)
+            printf(" error=%i", error);
+
+        printf("\n");
+
+        if (summary_only)
+            continue;
+
+        for (const decoded_t* d : timeline) {
+            const char* arg1;
+            const char* arg2;
+            arg_names(d->e.type, &arg1, &arg2);
+
+            printf("  %+12.3fms %s", (d->e.ts_ns - first->e.ts_ns) / 1e6,
+                    nu::event_type_name(d->e.type));
+
+            if (arg1)
+                printf(" %s=%i", arg1, int(d->e.arg1));
+
+            if (arg2)
+                printf(" %s=%llu", arg2, (unsigned long long)d->e.arg2);
+
+            printf("\n");
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int main(int argc, char* argv[])
+{
+    output_t output = OUTPUT_CSV;
+    vector<decoded_t> events;
+    int files = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--csv") == 0)
+            output = OUTPUT_CSV;
+        else if (strcmp(argv[i], "--json") == 0)
+            output = OUTPUT_JSON;
+        else if (strcmp(argv[i], "--timeline") == 0)
+            output = OUTPUT_TIMELINE;
+        else if (strcmp(argv[i], "--summary") == 0)
+            output = OUTPUT_SUMMARY;
+        else if (read_log(argv[i], events))
+            ++files;
+        else
+            return 1;
+    }
+
+    if (!files) {
+        fprintf(stderr,
+                "Usage: %s [--csv|--json|--timeline|--summary] LOG...\n"
+                "  (rotated files first: LOG.3 LOG.2 LOG.1 LOG)\n", argv[0]);
+
+        return 1;
+    }
+
+    switch (output) {
+        case OUTPUT_CSV:
+            write_csv(events);
+            break;
+
+        case OUTPUT_JSON:
+            write_json(events);
+            break;
+
+        case OUTPUT_TIMELINE:
+        case OUTPUT_SUMMARY:
+            write_timelines(events, output == OUTPUT_SUMMARY);
+            break;
+    }
+
+    return 0;
+}